@@ -2,3 +2,4 @@ from ._libsoc import *  # NOQA
 from .gpio import *     # NOQA
 from .i2c import *      # NOQA
 from .spi import *      # NOQA
+from . import stats     # NOQA
@@ -2,12 +2,24 @@ import atexit
 import contextlib
 import threading
 import time
+from ctypes import c_char_p, c_void_p
 
 from ._libsoc import (
     DIRECTION_INPUT, DIRECTION_OUTPUT,
     EDGE_BOTH, EDGE_FALLING, EDGE_NONE, EDGE_RISING,
-    LS_GPIO_SHARED, LS_GPIO_GREEDY, LS_GPIO_WEAK, api
+    LS_GPIO_SHARED, LS_GPIO_GREEDY, LS_GPIO_WEAK, api,
+    gpio_get_level, gpio_poll, gpio_set_level
 )
+from . import stats
+
+# Handles are pointers, which ctypes would otherwise truncate to an int
+api.libsoc_gpio_request.restype = c_void_p
+api.libsoc_board_init.restype = c_void_p
+for _f in ('gpio_free', 'gpio_set_direction', 'gpio_get_direction',
+           'gpio_set_edge', 'gpio_get_edge', 'gpio_wait_interrupt',
+           'board_free'):
+    getattr(api, 'libsoc_' + _f).argtypes = [c_void_p]
+api.libsoc_board_gpio_id.argtypes = [c_void_p, c_char_p]
 
 
 class InterruptHandler(threading.Thread):
@@ -53,7 +65,7 @@ class GPIO(object):
         '''Opens a file descriptor to the GPIO and configures it.'''
         assert self._gpio is None
         self._gpio = api.libsoc_gpio_request(self.id, self.mode)
-        if self._gpio == 0:  # NULL from native code
+        if not self._gpio:  # NULL from native code
             raise IOError('Unable to open GPIO_%d' % self.id)
         self.set_direction(self.direction, self.edge)
 
@@ -63,6 +75,11 @@ class GPIO(object):
             api.libsoc_gpio_free(self._gpio)
             self._gpio = None
 
+    def stats(self):
+        '''Returns the counters of the GPIO as in libsoc.stats.snapshot, or
+        None unless libsoc.stats.enable() was called before it was opened.'''
+        return stats.device_stats('gpio', self.id)
+
     def set_direction(self, direction, edge):
         self._validate_direction(direction, edge)
         api.libsoc_gpio_set_direction(self._gpio, self.direction)
@@ -94,21 +111,22 @@ class GPIO(object):
 
     @staticmethod
     def set_debug(enabled):
+        # Enabled turns on every level, including per transfer tracing
         v = 0
         if enabled:
-            v = 1
+            v = 2
         api.libsoc_set_debug(v)
 
     def set_high(self):
         assert self.direction == DIRECTION_OUTPUT
-        api.libsoc_gpio_set_level(self._gpio, 1)
+        gpio_set_level(self._gpio, 1)
 
     def set_low(self):
         assert self.direction == DIRECTION_OUTPUT
-        api.libsoc_gpio_set_level(self._gpio, 0)
+        gpio_set_level(self._gpio, 0)
 
     def is_high(self):
-        l = api.libsoc_gpio_get_level(self._gpio)
+        l = gpio_get_level(self._gpio)
         if l == -1:
             raise IOError('Error reading GPIO_%d level' % self.id)
         return l == 1
@@ -132,7 +150,7 @@ class GPIO(object):
         polling. Returns True if an interrupt occurred, False on an error or
         timeout
         '''
-        return api.libsoc_gpio_poll(self._gpio, timeout_ms) == 0
+        return gpio_poll(self._gpio, timeout_ms) == 0
 
     def start_interrupt_handler(self, interrupt_callback):
         '''Returns a thread that continuosly polls the GPIO. If an interrupt is
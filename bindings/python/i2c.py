@@ -1,9 +1,12 @@
-import sys
-from ctypes import create_string_buffer
+from ctypes import c_void_p
 
-from ._libsoc import api
+from ._libsoc import api, i2c_read, i2c_readinto, i2c_write
+from . import stats
 
-PY3 = sys.version_info >= (3, 0)
+# Handles are pointers, which ctypes would otherwise truncate to an int
+api.libsoc_i2c_init.restype = c_void_p
+for _f in ('i2c_free', 'i2c_set_timeout'):
+    getattr(api, 'libsoc_' + _f).argtypes = [c_void_p]
 
 
 class I2C(object):
@@ -27,7 +30,7 @@ class I2C(object):
         '''Opens a file descriptor to the GPIO and configures it.'''
         assert self._i2c is None
         self._i2c = api.libsoc_i2c_init(self.bus, self.addr)
-        if self._i2c == 0:  # NULL from native code
+        if not self._i2c:  # NULL from native code
             raise IOError(
                 'Unable to open i2c bus(%d) addr(%d)' % (self.bus, self.addr))
 
@@ -37,11 +40,18 @@ class I2C(object):
             api.libsoc_i2c_free(self._i2c)
             self._i2c = None
 
+    def stats(self):
+        '''Returns the counters of the device as in libsoc.stats.snapshot,
+        or None unless libsoc.stats.enable() was called before it was
+        opened.'''
+        return stats.device_stats('i2c', (self.bus, self.addr))
+
     @staticmethod
     def set_debug(enabled):
+        # Enabled turns on every level, including per transfer tracing
         v = 0
         if enabled:
-            v = 1
+            v = 2
         api.libsoc_set_debug(v)
 
     def set_timeout(self, timeout):
@@ -50,14 +60,15 @@ class I2C(object):
         api.libsoc_i2c_set_timeout(self._i2c, timeout)
 
     def read(self, num_bytes):
-        buff = create_string_buffer(num_bytes)
-        if api.libsoc_i2c_read(self._i2c, buff, num_bytes) == -1:
-            raise IOError('Error reading i2c device')
-        return buff.value
+        return i2c_read(self._i2c, num_bytes)
+
+    def readinto(self, buff):
+        '''Reads len(buff) bytes into buff, which may be any writable object
+        with the buffer protocol such as a bytearray, memoryview or numpy
+        array. Returns the number of bytes read.'''
+        return i2c_readinto(self._i2c, buff)
 
     def write(self, byte_array):
-        if PY3:
-            buff = bytes(byte_array)
-        else:
-            buff = ''.join(map(chr, byte_array))
-        api.libsoc_i2c_write(self._i2c, buff, len(buff))
+        '''Writes byte_array, which may be a sequence of ints or any object
+        with the buffer protocol, used without a copy.'''
+        i2c_write(self._i2c, byte_array)
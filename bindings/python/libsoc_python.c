@@ -1,9 +1,459 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "libsoc_gpio.h"
 #include "libsoc_spi.h"
+#include "libsoc_i2c.h"
+
+/* Exported by libsoc for the bindings, but not part of its headers */
+extern int libsoc_gpio_poll(gpio *gpio, int timeout);
+
+/*
+ * The hot paths of the GPIO, SPI and I2C classes call these directly rather
+ * than going through ctypes. The handles are passed as the address returned
+ * by the libsoc init functions, and the GIL is released around every call
+ * into libsoc so other threads run while the bus is busy.
+ */
+
+static int
+_handle(PyObject *obj, void **handle)
+{
+  if (obj == Py_None) {
+    PyErr_SetString(PyExc_IOError, "Device is not open");
+    return 0;
+  }
+
+  *handle = PyLong_AsVoidPtr(obj);
+  if (*handle == NULL) {
+    if (!PyErr_Occurred())
+      PyErr_SetString(PyExc_IOError, "Device is not open");
+    return 0;
+  }
+
+  return 1;
+}
+
+static PyObject *
+gpio_set_level(PyObject *self, PyObject *args)
+{
+  gpio *gpio;
+  int level, ret;
+
+  if (!PyArg_ParseTuple(args, "O&i:gpio_set_level", _handle, &gpio, &level))
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_gpio_set_level(gpio, level);
+  Py_END_ALLOW_THREADS
+
+  return PyLong_FromLong(ret);
+}
+
+static PyObject *
+gpio_get_level(PyObject *self, PyObject *args)
+{
+  gpio *gpio;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&:gpio_get_level", _handle, &gpio))
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_gpio_get_level(gpio);
+  Py_END_ALLOW_THREADS
+
+  return PyLong_FromLong(ret);
+}
+
+static PyObject *
+gpio_poll(PyObject *self, PyObject *args)
+{
+  gpio *gpio;
+  int timeout, ret;
+
+  if (!PyArg_ParseTuple(args, "O&i:gpio_poll", _handle, &gpio, &timeout))
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_gpio_poll(gpio, timeout);
+  Py_END_ALLOW_THREADS
+
+  return PyLong_FromLong(ret);
+}
+
+/*
+ * Get the data to write. Objects with the buffer protocol, such as bytes,
+ * bytearray, memoryview or numpy arrays, are used in place, anything else
+ * like a list of ints is copied into a bytearray first. A lone int is
+ * refused, bytearray() would turn it into that many zero bytes.
+ */
+static int
+_tx_buffer(PyObject *obj, Py_buffer *view, Py_ssize_t max)
+{
+  PyObject *copy;
+  int ret;
+
+  if (PyObject_CheckBuffer(obj)) {
+    ret = PyObject_GetBuffer(obj, view, PyBUF_SIMPLE);
+  } else if (PyIndex_Check(obj)) {
+    PyErr_SetString(PyExc_TypeError,
+        "Expected bytes or a sequence of ints, not an int");
+    return -1;
+  } else {
+    copy = PyByteArray_FromObject(obj);
+    if (copy == NULL)
+      return -1;
+    ret = PyObject_GetBuffer(copy, view, PyBUF_SIMPLE);
+    Py_DECREF(copy);
+  }
+
+  if (ret < 0)
+    return -1;
+
+  if (view->len > max) {
+    PyBuffer_Release(view);
+    PyErr_SetString(PyExc_ValueError, "Invalid number of bytes");
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Get a writable buffer to read into. It stays exported until released, so
+ * it can be filled without the GIL while other threads run.
+ */
+static int
+_rx_buffer(PyObject *obj, Py_buffer *view, Py_ssize_t max)
+{
+  if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE) < 0)
+    return -1;
+
+  if (view->len <= 0 || view->len > max) {
+    PyBuffer_Release(view);
+    PyErr_SetString(PyExc_ValueError, "Invalid number of bytes");
+    return -1;
+  }
+
+  return 0;
+}
+
+static PyObject *
+spi_write(PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  Py_buffer tx;
+  spi *spi;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&O:spi_write", _handle, &spi, &obj))
+    return NULL;
+
+  if (_tx_buffer(obj, &tx, UINT32_MAX) < 0)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_spi_write(spi, tx.buf, tx.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&tx);
+
+  return PyLong_FromLong(ret);
+}
+
+static PyObject *
+spi_read(PyObject *self, PyObject *args)
+{
+  PyObject *rx;
+  spi *spi;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&n:spi_read", _handle, &spi, &len))
+    return NULL;
+
+  if (len <= 0 || len > UINT32_MAX) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of bytes");
+    return NULL;
+  }
+
+  rx = PyBytes_FromStringAndSize(NULL, len);
+  if (rx == NULL)
+    return NULL;
+
+  // Nothing else holds rx yet, so it can be filled without the GIL
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_spi_read(spi, (uint8_t *) PyBytes_AS_STRING(rx), len);
+  Py_END_ALLOW_THREADS
+
+  if (ret == EXIT_FAILURE) {
+    Py_DECREF(rx);
+    PyErr_SetString(PyExc_IOError, "Error reading spi device");
+    return NULL;
+  }
+
+  return rx;
+}
+
+static PyObject *
+spi_readinto(PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  Py_buffer rx;
+  spi *spi;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&O:spi_readinto", _handle, &spi, &obj))
+    return NULL;
+
+  if (_rx_buffer(obj, &rx, UINT32_MAX) < 0)
+    return NULL;
+
+  len = rx.len;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_spi_read(spi, rx.buf, rx.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&rx);
+
+  if (ret == EXIT_FAILURE) {
+    PyErr_SetString(PyExc_IOError, "Error reading spi device");
+    return NULL;
+  }
+
+  return PyLong_FromSsize_t(len);
+}
+
+/*
+ * Full duplex transfer of len bytes into rx, a shorter write is padded with
+ * zeros while the rest is clocked in. Called without the GIL.
+ */
+static int
+_spi_rw(spi *spi, Py_buffer *tx, uint8_t *rx, Py_ssize_t len)
+{
+  uint8_t *padded = NULL, *buf = tx->buf;
+  int ret;
+
+  if (tx->len < len) {
+    padded = calloc(1, len);
+    if (padded == NULL)
+      return -ENOMEM;
+    memcpy(padded, tx->buf, tx->len);
+    buf = padded;
+  }
+
+  ret = libsoc_spi_rw(spi, buf, rx, len);
+
+  free(padded);
+
+  return ret;
+}
+
+static PyObject *
+_spi_rw_error(int ret)
+{
+  if (ret == -ENOMEM)
+    return PyErr_NoMemory();
+
+  PyErr_SetString(PyExc_IOError, "Error rw spi device");
+  return NULL;
+}
+
+static PyObject *
+spi_rw(PyObject *self, PyObject *args)
+{
+  PyObject *obj, *rx;
+  Py_buffer tx;
+  spi *spi;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&On:spi_rw", _handle, &spi, &obj, &len))
+    return NULL;
+
+  if (len <= 0 || len > UINT32_MAX) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of bytes");
+    return NULL;
+  }
+
+  // Bytes beyond the read would never be clocked out
+  if (_tx_buffer(obj, &tx, len) < 0)
+    return NULL;
+
+  rx = PyBytes_FromStringAndSize(NULL, len);
+  if (rx == NULL) {
+    PyBuffer_Release(&tx);
+    return NULL;
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = _spi_rw(spi, &tx, (uint8_t *) PyBytes_AS_STRING(rx), len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&tx);
+
+  if (ret != EXIT_SUCCESS) {
+    Py_DECREF(rx);
+    return _spi_rw_error(ret);
+  }
+
+  return rx;
+}
+
+static PyObject *
+spi_rw_into(PyObject *self, PyObject *args)
+{
+  PyObject *tx_obj, *rx_obj;
+  Py_buffer tx, rx;
+  spi *spi;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&OO:spi_rw_into", _handle, &spi, &tx_obj,
+      &rx_obj))
+    return NULL;
+
+  if (_rx_buffer(rx_obj, &rx, UINT32_MAX) < 0)
+    return NULL;
+
+  // Bytes beyond the read would never be clocked out
+  if (_tx_buffer(tx_obj, &tx, rx.len) < 0) {
+    PyBuffer_Release(&rx);
+    return NULL;
+  }
+
+  len = rx.len;
+
+  // The same buffer may be passed to write from and read into
+  Py_BEGIN_ALLOW_THREADS
+  ret = _spi_rw(spi, &tx, rx.buf, rx.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&tx);
+  PyBuffer_Release(&rx);
+
+  if (ret != EXIT_SUCCESS)
+    return _spi_rw_error(ret);
+
+  return PyLong_FromSsize_t(len);
+}
+
+static PyObject *
+i2c_write(PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  Py_buffer tx;
+  i2c *i2c;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&O:i2c_write", _handle, &i2c, &obj))
+    return NULL;
+
+  if (_tx_buffer(obj, &tx, UINT16_MAX) < 0)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_i2c_write(i2c, tx.buf, tx.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&tx);
+
+  return PyLong_FromLong(ret);
+}
+
+static PyObject *
+i2c_read(PyObject *self, PyObject *args)
+{
+  PyObject *rx;
+  i2c *i2c;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&n:i2c_read", _handle, &i2c, &len))
+    return NULL;
+
+  if (len <= 0 || len > UINT16_MAX) {
+    PyErr_SetString(PyExc_ValueError, "Invalid number of bytes");
+    return NULL;
+  }
+
+  rx = PyBytes_FromStringAndSize(NULL, len);
+  if (rx == NULL)
+    return NULL;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_i2c_read(i2c, (uint8_t *) PyBytes_AS_STRING(rx), len);
+  Py_END_ALLOW_THREADS
+
+  if (ret == EXIT_FAILURE) {
+    Py_DECREF(rx);
+    PyErr_SetString(PyExc_IOError, "Error reading i2c device");
+    return NULL;
+  }
+
+  return rx;
+}
+
+static PyObject *
+i2c_readinto(PyObject *self, PyObject *args)
+{
+  PyObject *obj;
+  Py_buffer rx;
+  i2c *i2c;
+  Py_ssize_t len;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O&O:i2c_readinto", _handle, &i2c, &obj))
+    return NULL;
+
+  if (_rx_buffer(obj, &rx, UINT16_MAX) < 0)
+    return NULL;
+
+  len = rx.len;
+
+  Py_BEGIN_ALLOW_THREADS
+  ret = libsoc_i2c_read(i2c, rx.buf, rx.len);
+  Py_END_ALLOW_THREADS
+
+  PyBuffer_Release(&rx);
+
+  if (ret == EXIT_FAILURE) {
+    PyErr_SetString(PyExc_IOError, "Error reading i2c device");
+    return NULL;
+  }
+
+  return PyLong_FromSsize_t(len);
+}
 
 static PyMethodDef functions[] = {
+    {"gpio_set_level", gpio_set_level, METH_VARARGS,
+     "gpio_set_level(handle, level) -> int"},
+    {"gpio_get_level", gpio_get_level, METH_VARARGS,
+     "gpio_get_level(handle) -> int"},
+    {"gpio_poll", gpio_poll, METH_VARARGS,
+     "gpio_poll(handle, timeout_ms) -> int"},
+    {"spi_write", spi_write, METH_VARARGS,
+     "spi_write(handle, tx) -> int"},
+    {"spi_read", spi_read, METH_VARARGS,
+     "spi_read(handle, num_bytes) -> bytes"},
+    {"spi_readinto", spi_readinto, METH_VARARGS,
+     "spi_readinto(handle, rx) -> int"},
+    {"spi_rw", spi_rw, METH_VARARGS,
+     "spi_rw(handle, tx, num_bytes) -> bytes"},
+    {"spi_rw_into", spi_rw_into, METH_VARARGS,
+     "spi_rw_into(handle, tx, rx) -> int"},
+    {"i2c_write", i2c_write, METH_VARARGS,
+     "i2c_write(handle, tx) -> int"},
+    {"i2c_read", i2c_read, METH_VARARGS,
+     "i2c_read(handle, num_bytes) -> bytes"},
+    {"i2c_readinto", i2c_readinto, METH_VARARGS,
+     "i2c_readinto(handle, rx) -> int"},
     {NULL, NULL, 0, NULL}        /* Sentinel */
 };
 
@@ -1,13 +1,18 @@
-import sys
-
-from ctypes import create_string_buffer
+from ctypes import c_void_p
 
 from ._libsoc import (
     BITS_8, BITS_16, BPW_ERROR,
-    MODE_0, MODE_1, MODE_2, MODE_3, MODE_ERROR, api
+    MODE_0, MODE_1, MODE_2, MODE_3, MODE_ERROR, api,
+    spi_read, spi_readinto, spi_rw, spi_rw_into, spi_write
 )
+from . import stats
 
-PY3 = sys.version_info >= (3, 0)
+# Handles are pointers, which ctypes would otherwise truncate to an int
+api.libsoc_spi_init.restype = c_void_p
+for _f in ('spi_free', 'spi_set_mode', 'spi_get_mode', 'spi_set_speed',
+           'spi_get_speed', 'spi_set_bits_per_word',
+           'spi_get_bits_per_word'):
+    getattr(api, 'libsoc_' + _f).argtypes = [c_void_p]
 
 
 class SPI(object):
@@ -39,7 +44,7 @@ class SPI(object):
     def open(self):
         assert self._spi is None
         self._spi = api.libsoc_spi_init(self.device, self.chip)
-        if self._spi == 0:
+        if not self._spi:
             raise IOError('Unable to open spi device(%d)' % self.device)
         self.set_mode(self.mode)
         if self.get_mode() != self.mode:
@@ -56,11 +61,18 @@ class SPI(object):
             api.libsoc_spi_free(self._spi)
             self._spi = None
 
+    def stats(self):
+        '''Returns the counters of the device as in libsoc.stats.snapshot,
+        or None unless libsoc.stats.enable() was called before it was
+        opened.'''
+        return stats.device_stats('spi', (self.device, self.chip))
+
     @staticmethod
     def set_debug(enabled):
+        # Enabled turns on every level, including per transfer tracing
         v = 0
         if enabled:
-            v = 1
+            v = 2
         api.libsoc_set_debug(v)
 
     def set_bits_per_word(self, bpw):
@@ -102,27 +114,28 @@ class SPI(object):
 
     def read(self, num_bytes):
         assert num_bytes > 0
-        buff = create_string_buffer(num_bytes)
-        if api.libsoc_spi_read(self._spi, buff, num_bytes) == -1:
-            raise IOError('Error reading spi device')
-        return buff.raw
+        return spi_read(self._spi, num_bytes)
+
+    def readinto(self, buff):
+        '''Reads len(buff) bytes into buff, which may be any writable object
+        with the buffer protocol such as a bytearray, memoryview or numpy
+        array. Returns the number of bytes read.'''
+        return spi_readinto(self._spi, buff)
 
     def write(self, byte_array):
+        '''Writes byte_array, which may be a sequence of ints or any object
+        with the buffer protocol, used without a copy.'''
         assert len(byte_array) > 0
-        if PY3:
-            buff = bytes(byte_array)
-        else:
-            buff = ''.join(map(chr, byte_array))
-        api.libsoc_spi_write(self._spi, buff, len(buff))
+        spi_write(self._spi, byte_array)
 
     def rw(self, num_bytes, byte_array):
         assert num_bytes > 0
         assert len(byte_array) > 0
-        rbuff = create_string_buffer(num_bytes)
-        if PY3:
-            wbuff = bytes(byte_array)
-        else:
-            wbuff = ''.join(map(chr, byte_array))
-        if api.libsoc_spi_rw(self._spi, wbuff, rbuff, num_bytes) != 0:
-            raise IOError('Error rw spi device')
-        return rbuff.raw
+        return spi_rw(self._spi, byte_array, num_bytes)
+
+    def rw_into(self, byte_array, buff):
+        '''Writes byte_array while reading len(buff) bytes into buff, padding
+        a shorter byte_array with zeros, a longer one raises ValueError. Both
+        may be the same buffer. Returns the number of bytes read.'''
+        assert len(byte_array) > 0
+        return spi_rw_into(self._spi, byte_array, buff)
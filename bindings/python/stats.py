@@ -0,0 +1,86 @@
+from ctypes import POINTER, Structure, c_double, c_int, c_uint32, c_uint64
+
+from ._libsoc import api
+
+STATS_GPIO = 0
+STATS_SPI = 1
+STATS_I2C = 2
+STATS_PWM = 3
+
+STATS_BUCKETS = 32
+
+_TYPES = {
+    STATS_GPIO: 'gpio',
+    STATS_SPI: 'spi',
+    STATS_I2C: 'i2c',
+    STATS_PWM: 'pwm',
+}
+
+
+class _IOStats(Structure):
+    _fields_ = [
+        ('type', c_int),
+        ('device', c_uint32),
+        ('ops', c_uint64),
+        ('bytes', c_uint64),
+        ('errors', c_uint64),
+        ('total_ns', c_uint64),
+        ('max_ns', c_uint64),
+        ('latency', c_uint64 * STATS_BUCKETS),
+    ]
+
+
+api.libsoc_stats_percentile.restype = c_uint64
+api.libsoc_stats_percentile.argtypes = [POINTER(_IOStats), c_double]
+
+
+def enable(enabled=True):
+    '''Count the operations of devices opened afterwards.'''
+    api.libsoc_stats_enable(1 if enabled else 0)
+
+
+def _device(type, device):
+    if type == STATS_SPI:
+        return (device >> 8, device & 0xff)
+    if type == STATS_I2C:
+        return (device >> 8, device & 0xff)
+    if type == STATS_PWM:
+        return (device >> 16, device & 0xffff)
+    return device
+
+
+def snapshot():
+    '''Returns a list of dicts holding the counters of every open device
+    which has them. Latencies are in nanoseconds, "latency" is the
+    histogram where bucket n counts operations taking 2^(n-1) to 2^n - 1ns.
+    '''
+    num = api.libsoc_stats_snapshot(None, 0)
+    while True:
+        buff = (_IOStats * max(num, 1))()
+        n = api.libsoc_stats_snapshot(buff, num)
+        if n <= num:
+            break
+        num = n
+    result = []
+    for s in buff[:n]:
+        result.append({
+            'type': _TYPES.get(s.type, s.type),
+            'device': _device(s.type, s.device),
+            'ops': s.ops,
+            'bytes': s.bytes,
+            'errors': s.errors,
+            'mean_ns': s.total_ns // s.ops if s.ops else 0,
+            'max_ns': s.max_ns,
+            'p50_ns': api.libsoc_stats_percentile(s, 50),
+            'p99_ns': api.libsoc_stats_percentile(s, 99),
+            'latency': list(s.latency),
+        })
+    return result
+
+
+def device_stats(type, device):
+    '''Returns the counters of one device as in snapshot, or None.'''
+    for s in snapshot():
+        if s['type'] == type and s['device'] == device:
+            return s
+    return None
@@ -1,10 +1,17 @@
 /* SPDX-License-Identifier: LGPL-2.1-only */
 
+#include <ctype.h>
 #include <dirent.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "libsoc_board.h"
 #include "libsoc_debug.h"
@@ -19,75 +26,1019 @@ _get_conf_file()
   return name;
 }
 
+/*
+ * Probing parses every board file, so the model each one matches is kept in
+ * an index in the cache dir. The index records the mtime of the board file
+ * dir and the mtime and size of every board file, any change makes it stale
+ * and the full scan rebuilds it. The device tree model is read once per probe whichever path is taken.
+ */
+#define BOARD_INDEX_NAME "board.index"
+#define BOARD_INDEX_MAGIC "libsoc-board-index 2"
+
+struct dt_model
+{
+  char *dtfile;
+  char *model;
+  struct dt_model *next;
+};
+
+static const char *
+_get_data_dir()
+{
+  const char *name = getenv("LIBSOC_DATA_DIR");
+  if (name == NULL)
+    name = DATA_DIR;
+  return name;
+}
+
+static const char *
+_get_cache_dir()
+{
+  const char *name = getenv("LIBSOC_CACHE_DIR");
+  if (name == NULL)
+    name = CACHE_DIR;
+  return name;
+}
+
+// The cache dir is normally made at install time, create it when it is not
 static int
-_probe_config(conffile *conf)
+_make_cache_dir()
+{
+  const char *dir = _get_cache_dir();
+
+  if (mkdir(dir, 0755) && errno != EEXIST)
+    {
+      libsoc_debug(__func__, "unable to create cache dir %s", dir);
+      return EXIT_FAILURE;
+    }
+  return EXIT_SUCCESS;
+}
+
+// The probed model of a device tree file, read at most once per probe
+static const char *
+_read_model(struct dt_model **models, const char *dtfile)
+{
+  struct dt_model *m;
+
+  for (m = *models; m; m = m->next)
+    {
+      if (!strcmp(m->dtfile, dtfile))
+        return m->model;
+    }
+
+  m = calloc(1, sizeof(struct dt_model));
+  if (!m)
+    return NULL;
+  m->dtfile = strdup(dtfile);
+  m->model = file_read_contents(dtfile);
+  m->next = *models;
+  *models = m;
+  return m->model;
+}
+
+static void
+_free_models(struct dt_model *models)
 {
-  const char *dtfile = conffile_get(conf, "board", "dtfile", "/proc/device-tree/model");
-  const char *match = conffile_get(conf, "board", "model", NULL);
-  if (match)
+  struct dt_model *m;
+
+  while (models)
     {
-      char *probed = file_read_contents(dtfile);
-      if (probed)
+      m = models;
+      models = m->next;
+      free(m->dtfile);
+      free(m->model);
+      free(m);
+    }
+}
+
+/*
+ * A parsed board file is also written to the cache dir in a binary form that
+ * later processes map read only instead of parsing the text. The cache holds
+ * every setting in a table sorted by section and key, and a minimal perfect
+ * hash of the GPIO section so a pin name resolves with one hash and one
+ * string compare. The SPI, I2C and PWM sections are stored resolved, as
+ * sorted arrays of the public structs. All offsets are from the start of the
+ * file. The source file mtime, size and inode are recorded, any change
+ * regenerates the cache.
+ */
+#define BOARD_CACHE_MAGIC "LSOCBRDC"
+#define BOARD_CACHE_VERSION 2
+#define BOARD_CACHE_MAX_DISP (1 << 16)
+#define BOARD_CACHE_ALIGN(x) (((x) + 7) & ~7)
+
+struct board_cache
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t length;
+  int64_t src_sec;
+  int64_t src_nsec;
+  int64_t src_size;
+  uint64_t src_ino;
+  uint32_t num_buckets;
+  uint32_t num_pins;
+  uint32_t num_entries;
+  uint32_t num_spi;
+  uint32_t num_i2c;
+  uint32_t num_pwm;
+  uint32_t buckets;
+  uint32_t pins;
+  uint32_t entries;
+  uint32_t spi;
+  uint32_t i2c;
+  uint32_t pwm;
+};
+
+struct board_cache_pin
+{
+  uint32_t name;
+  int32_t gpio;
+};
+
+struct board_cache_entry
+{
+  uint32_t section;
+  uint32_t key;
+  uint32_t val;
+};
+
+// Setting gathered from a conffile while building the cache
+struct cache_setting
+{
+  const char *section;
+  const char *key;
+  const char *val;
+};
+
+static uint64_t
+_pin_hash(const char *name)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+
+  while (*name)
+    {
+      hash ^= (unsigned char) *name++;
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+static uint32_t
+_pin_bucket(uint64_t hash, uint32_t num_buckets)
+{
+  return (hash >> 32) % num_buckets;
+}
+
+static uint32_t
+_pin_slot(uint64_t hash, uint32_t disp, uint32_t num_pins)
+{
+  hash ^= disp * 0x9e3779b97f4a7c15ULL;
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  return hash % num_pins;
+}
+
+static void
+_get_cache_file(const char *path, char *cache_path)
+{
+  char real[PATH_MAX];
+  uint64_t hash;
+
+  if (!realpath(path, real))
+    snprintf(real, sizeof(real), "%s", path);
+  hash = _pin_hash(real);
+  snprintf(cache_path, PATH_MAX, "%s/board-%016llx.cache", _get_cache_dir(),
+           (unsigned long long) hash);
+}
+
+static const struct board_cache *
+_map_cache(const char *cache_path, struct stat *src_st, size_t *len)
+{
+  const struct board_cache *cache;
+  const struct board_cache_pin *pins;
+  const struct board_cache_entry *entries;
+  const char *base;
+  struct stat st;
+  uint32_t i;
+  int fd;
+
+  fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) || st.st_size < sizeof(struct board_cache))
+    {
+      close(fd);
+      return NULL;
+    }
+  cache = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (cache == MAP_FAILED)
+    return NULL;
+  base = (const char *) cache;
+
+  if (memcmp(cache->magic, BOARD_CACHE_MAGIC, sizeof(cache->magic)) ||
+      cache->version != BOARD_CACHE_VERSION || cache->length != st.st_size ||
+      cache->src_sec != src_st->st_mtim.tv_sec ||
+      cache->src_nsec != src_st->st_mtim.tv_nsec ||
+      cache->src_size != src_st->st_size || cache->src_ino != src_st->st_ino)
+    goto stale;
+
+  // Bounds are checked once so lookups can trust every offset
+  if ((cache->num_pins && !cache->num_buckets) ||
+      cache->buckets > cache->length ||
+      (cache->length - cache->buckets) / sizeof(uint32_t) < cache->num_buckets ||
+      cache->pins > cache->length ||
+      (cache->length - cache->pins) / sizeof(*pins) < cache->num_pins ||
+      cache->entries > cache->length ||
+      (cache->length - cache->entries) / sizeof(*entries) < cache->num_entries ||
+      cache->spi > cache->length ||
+      (cache->length - cache->spi) / sizeof(board_spi) < cache->num_spi ||
+      cache->i2c > cache->length ||
+      (cache->length - cache->i2c) / sizeof(board_i2c) < cache->num_i2c ||
+      cache->pwm > cache->length ||
+      (cache->length - cache->pwm) / sizeof(board_pwm) < cache->num_pwm ||
+      base[cache->length - 1] != '\0')
+    goto stale;
+
+  pins = (const struct board_cache_pin *) (base + cache->pins);
+  for (i = 0; i < cache->num_pins; i++)
+    {
+      if (pins[i].name >= cache->length)
+        goto stale;
+    }
+  entries = (const struct board_cache_entry *) (base + cache->entries);
+  for (i = 0; i < cache->num_entries; i++)
+    {
+      if (entries[i].section >= cache->length ||
+          entries[i].key >= cache->length || entries[i].val >= cache->length)
+        goto stale;
+    }
+
+  libsoc_debug(__func__, "using board cache %s", cache_path);
+  *len = st.st_size;
+  return cache;
+
+stale:
+  libsoc_debug(__func__, "board cache %s is stale", cache_path);
+  munmap((void *) cache, st.st_size);
+  return NULL;
+}
+
+static int
+_setting_cmp(const void *a, const void *b)
+{
+  const struct cache_setting *sa = a, *sb = b;
+  int ret = strcmp(sa->section, sb->section);
+
+  return ret ? ret : strcmp(sa->key, sb->key);
+}
+
+// Parse an unsigned number in any base strtoul accepts, no sign allowed
+static int
+_parse_uint(const char *str, char **end, unsigned long max, unsigned long *val)
+{
+  if (!isdigit((unsigned char) *str))
+    return EXIT_FAILURE;
+  errno = 0;
+  *val = strtoul(str, end, 0);
+  if (errno || *val > max)
+    return EXIT_FAILURE;
+  while (isspace((unsigned char) **end))
+    (*end)++;
+  return EXIT_SUCCESS;
+}
+
+// SPI entries are "device.chip_select [mode [speed]]"
+static int
+_resolve_spi(const char *name, const char *val, board_spi *spi)
+{
+  unsigned long device, cs, num;
+  char *end;
+
+  if (_parse_uint(val, &end, UINT16_MAX, &device) || *end != '.' ||
+      _parse_uint(end + 1, &end, UINT8_MAX, &cs))
+    return EXIT_FAILURE;
+  spi->device = device;
+  spi->chip_select = cs;
+  spi->mode = MODE_ERROR;
+  spi->speed = 0;
+
+  if (*end)
+    {
+      if (_parse_uint(end, &end, MODE_3, &num))
+        return EXIT_FAILURE;
+      spi->mode = num;
+    }
+  if (*end)
+    {
+      if (_parse_uint(end, &end, UINT32_MAX, &num))
+        return EXIT_FAILURE;
+      spi->speed = num;
+    }
+  if (*end)
+    return EXIT_FAILURE;
+
+  snprintf(spi->name, sizeof(spi->name), "%s", name);
+  snprintf(spi->path, sizeof(spi->path), "/dev/spidev%u.%u", spi->device,
+           spi->chip_select);
+  return EXIT_SUCCESS;
+}
+
+// I2C entries are "bus [address]"
+static int
+_resolve_i2c(const char *name, const char *val, board_i2c *i2c)
+{
+  unsigned long bus, address = 0;
+  char *end;
+
+  if (_parse_uint(val, &end, UINT8_MAX, &bus))
+    return EXIT_FAILURE;
+  if (*end && _parse_uint(end, &end, 127, &address))
+    return EXIT_FAILURE;
+  if (*end)
+    return EXIT_FAILURE;
+  i2c->bus = bus;
+  i2c->address = address;
+
+  snprintf(i2c->name, sizeof(i2c->name), "%s", name);
+  snprintf(i2c->path, sizeof(i2c->path), "/dev/i2c-%u", i2c->bus);
+  return EXIT_SUCCESS;
+}
+
+// PWM entries are "chip.num [period [normal|inversed]]"
+static int
+_resolve_pwm(const char *name, const char *val, board_pwm *pwm)
+{
+  unsigned long chip, num, period;
+  char *end;
+
+  if (_parse_uint(val, &end, UINT16_MAX, &chip) || *end != '.' ||
+      _parse_uint(end + 1, &end, UINT16_MAX, &num))
+    return EXIT_FAILURE;
+  pwm->chip = chip;
+  pwm->num = num;
+  pwm->period = 0;
+  pwm->polarity = POLARITY_ERROR;
+
+  if (*end)
+    {
+      if (_parse_uint(end, &end, UINT32_MAX, &period))
+        return EXIT_FAILURE;
+      pwm->period = period;
+    }
+  if (*end)
+    {
+      if (!strcmp(end, "normal"))
+        pwm->polarity = NORMAL;
+      else if (!strcmp(end, "inversed"))
+        pwm->polarity = INVERSED;
+      else
+        return EXIT_FAILURE;
+    }
+
+  snprintf(pwm->name, sizeof(pwm->name), "%s", name);
+  snprintf(pwm->path, sizeof(pwm->path), "/sys/class/pwm/pwmchip%u/pwm%u",
+           pwm->chip, pwm->num);
+  return EXIT_SUCCESS;
+}
+
+/*
+ * The visible settings of a conffile sorted by section and key, only the
+ * first section of a name and the last value of a key can be looked up
+ */
+static struct cache_setting *
+_get_settings(conffile *conf, uint32_t *num)
+{
+  struct cache_setting *settings;
+  uint32_t i, n = 0;
+  section *s, *t;
+  keyval *kv;
+
+  for (s = conf->sections; s; s = s->next)
+    for (kv = s->settings; kv; kv = kv->next)
+      n++;
+  settings = calloc(n ? n : 1, sizeof(struct cache_setting));
+  if (!settings)
+    return NULL;
+
+  n = 0;
+  for (s = conf->sections; s; s = s->next)
+    {
+      for (t = conf->sections; t != s && strcmp(t->name, s->name); t = t->next)
+        ;
+      if (t != s)
+        continue;
+      for (kv = s->settings; kv; kv = kv->next)
         {
-          int rc = strcmp(probed, match);
-	  free(probed);
-	  return !rc;
+          settings[n].section = s->name;
+          settings[n].key = kv->key;
+          settings[n].val = conffile_get(conf, s->name, kv->key, "");
+          n++;
         }
     }
-  else
+  qsort(settings, n, sizeof(struct cache_setting), _setting_cmp);
+  for (i = 0, *num = 0; i < n; i++)
     {
-      libsoc_debug(__func__, "No 'model' value found in 'board' section");
+      if (*num && !_setting_cmp(&settings[*num - 1], &settings[i]))
+        continue;
+      settings[(*num)++] = settings[i];
     }
-  return 0;
+  return settings;
 }
 
-static board_config *
-_probe()
+/*
+ * Resolve the SPI, I2C and PWM sections into one block owned by the config,
+ * invalid entries are skipped with a warning. The settings are sorted so the
+ * arrays are sorted by name.
+ */
+static int
+_resolve_resources(struct cache_setting *settings, uint32_t num,
+                   board_config *bc)
 {
-  board_config *bc = NULL;
-  conffile *conf = NULL;
-  const char *confs_dir = DATA_DIR;
-  char tmp[PATH_MAX];
-  DIR *dirp;
-  struct dirent *dp;
+  board_spi *spi;
+  board_i2c *i2c;
+  board_pwm *pwm;
+  uint32_t i, num_spi = 0, num_i2c = 0, num_pwm = 0;
+  size_t spi_len, pwm_len;
+  int ret;
+
+  for (i = 0; i < num; i++)
+    {
+      if (!strcmp(settings[i].section, "SPI"))
+        num_spi++;
+      else if (!strcmp(settings[i].section, "I2C"))
+        num_i2c++;
+      else if (!strcmp(settings[i].section, "PWM"))
+        num_pwm++;
+    }
+  if (!num_spi && !num_i2c && !num_pwm)
+    return EXIT_SUCCESS;
+
+  spi_len = BOARD_CACHE_ALIGN(num_spi * sizeof(board_spi));
+  pwm_len = BOARD_CACHE_ALIGN(num_pwm * sizeof(board_pwm));
+  bc->resources = calloc(1, spi_len + pwm_len + num_i2c * sizeof(board_i2c));
+  if (!bc->resources)
+    return EXIT_FAILURE;
+  spi = bc->resources;
+  pwm = (board_pwm *) ((char *) bc->resources + spi_len);
+  i2c = (board_i2c *) ((char *) bc->resources + spi_len + pwm_len);
+  bc->spi = spi;
+  bc->pwm = pwm;
+  bc->i2c = i2c;
 
-  if ((dirp = opendir(confs_dir)) != NULL)
+  for (i = 0; i < num; i++)
     {
-      do
+      const char *sect = settings[i].section;
+
+      if (!strcmp(sect, "SPI"))
+        ret = _resolve_spi(settings[i].key, settings[i].val,
+                           &spi[bc->num_spi]);
+      else if (!strcmp(sect, "I2C"))
+        ret = _resolve_i2c(settings[i].key, settings[i].val,
+                           &i2c[bc->num_i2c]);
+      else if (!strcmp(sect, "PWM"))
+        ret = _resolve_pwm(settings[i].key, settings[i].val,
+                           &pwm[bc->num_pwm]);
+      else
+        continue;
+
+      if (ret == EXIT_FAILURE || strlen(settings[i].key) >= BOARD_NAME_MAX)
         {
-          if ((dp = readdir(dirp)) != NULL)
+          libsoc_warn("Invalid %s entry: %s = %s", sect, settings[i].key,
+                      settings[i].val);
+          continue;
+        }
+
+      if (!strcmp(sect, "SPI"))
+        bc->num_spi++;
+      else if (!strcmp(sect, "I2C"))
+        bc->num_i2c++;
+      else
+        bc->num_pwm++;
+    }
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Hash and displace, pins are split into buckets which are placed largest
+ * first, each searching for a displacement that moves all its pins to free
+ * slots. With two pins per bucket on average a displacement is found quickly.
+ */
+static int
+_build_pin_hash(const uint64_t *hashes, uint32_t num_pins, uint32_t num_buckets,
+                uint32_t *disps, uint32_t *slots)
+{
+  uint32_t *sizes, *order, *members, *first, *taken;
+  uint32_t i, j, b, d, n, tmp;
+  int ret = EXIT_FAILURE;
+
+  sizes = calloc(num_buckets, sizeof(uint32_t));
+  order = calloc(num_buckets, sizeof(uint32_t));
+  first = calloc(num_buckets + 1, sizeof(uint32_t));
+  members = calloc(num_pins, sizeof(uint32_t));
+  taken = calloc(num_pins, sizeof(uint32_t));
+  if (!sizes || !order || !first || !members || !taken)
+    goto free;
+
+  for (i = 0; i < num_pins; i++)
+    sizes[_pin_bucket(hashes[i], num_buckets)]++;
+  for (b = 0; b < num_buckets; b++)
+    {
+      first[b + 1] = first[b] + sizes[b];
+      order[b] = b;
+      sizes[b] = 0;
+    }
+  for (i = 0; i < num_pins; i++)
+    {
+      b = _pin_bucket(hashes[i], num_buckets);
+      members[first[b] + sizes[b]++] = i;
+    }
+
+  // Insertion sort, largest buckets first
+  for (i = 1; i < num_buckets; i++)
+    {
+      tmp = order[i];
+      for (j = i; j > 0 && sizes[order[j - 1]] < sizes[tmp]; j--)
+        order[j] = order[j - 1];
+      order[j] = tmp;
+    }
+
+  // taken[] holds the slot owner plus one, so zero is free
+  for (i = 0; i < num_buckets && sizes[order[i]]; i++)
+    {
+      b = order[i];
+      for (d = 0; d < BOARD_CACHE_MAX_DISP; d++)
+        {
+          for (n = 0; n < sizes[b]; n++)
             {
-              char *ext = strrchr(dp->d_name, '.');
-              if (ext && !strcmp(ext, ".conf"))
-                {
-		  strcpy(tmp, confs_dir);
-		  strcat(tmp, "/");
-		  strcat(tmp, dp->d_name);
-		  conf = conffile_load(tmp);
-		  if (conf)
-		    {
-		      libsoc_debug(__func__, "probing %s for board support", tmp);
-                      if(_probe_config(conf))
-		        {
-			  libsoc_debug(__func__, "probing match for %s", tmp);
-                          bc = calloc(1, sizeof(board_config));
-                          bc->conf = conf;
-			}
-		      else
-		        conffile_free(conf);
-		    }
-                }
+              tmp = _pin_slot(hashes[members[first[b] + n]], d, num_pins);
+              if (taken[tmp])
+                break;
+              taken[tmp] = members[first[b] + n] + 1;
             }
-        } while (dp != NULL && bc == NULL);
-      closedir(dirp);
+          if (n == sizes[b])
+            break;
+          while (n--)
+            taken[_pin_slot(hashes[members[first[b] + n]], d, num_pins)] = 0;
+        }
+      if (d == BOARD_CACHE_MAX_DISP)
+        goto free;
+      disps[b] = d;
+    }
+
+  // Return the slot of each pin
+  for (i = 0; i < num_pins; i++)
+    slots[taken[i] - 1] = i;
+  ret = EXIT_SUCCESS;
+
+free:
+  free(sizes);
+  free(order);
+  free(first);
+  free(members);
+  free(taken);
+  return ret;
+}
+
+static uint32_t
+_cache_string(char *buf, uint32_t *off, const char *str)
+{
+  uint32_t start = *off;
+  size_t len = strlen(str) + 1;
+
+  memcpy(buf + start, str, len);
+  *off += len;
+  return start;
+}
+
+/*
+ * Serialise a parsed board file, written to a temporary file and renamed so
+ * other processes only ever map a complete cache
+ */
+static void
+_write_cache(struct cache_setting *settings, uint32_t num, board_config *bc,
+             struct stat *src_st, const char *cache_path)
+{
+  struct board_cache *cache;
+  struct board_cache_pin *pins;
+  struct board_cache_entry *entries;
+  uint32_t *disps, *slots = NULL, *pin_settings = NULL;
+  uint64_t *hashes = NULL;
+  uint32_t num_pins = 0, num_buckets, i, off;
+  size_t strings = 0, length;
+  char *buf = NULL, tmp_path[PATH_MAX + 16];
+  int64_t gpio;
+  int fd, written;
+
+  hashes = calloc(num ? num : 1, sizeof(uint64_t));
+  pin_settings = calloc(num ? num : 1, sizeof(uint32_t));
+  slots = calloc(num ? num : 1, sizeof(uint32_t));
+  if (!hashes || !pin_settings || !slots)
+    goto free;
+
+  for (i = 0; i < num; i++)
+    {
+      strings += strlen(settings[i].section) + strlen(settings[i].key) +
+                 strlen(settings[i].val) + 3;
+      if (!strcmp(settings[i].section, "GPIO") &&
+          file_parse_int(settings[i].val, strlen(settings[i].val), &gpio) ==
+            EXIT_SUCCESS && gpio >= INT_MIN && gpio <= INT_MAX)
+        {
+          hashes[num_pins] = _pin_hash(settings[i].key);
+          pin_settings[num_pins++] = i;
+        }
+    }
+  num_buckets = num_pins / 2 + 1;
+
+  length = sizeof(struct board_cache) + num_buckets * sizeof(uint32_t) +
+           num_pins * sizeof(struct board_cache_pin) +
+           BOARD_CACHE_ALIGN(bc->num_spi * sizeof(board_spi)) +
+           BOARD_CACHE_ALIGN(bc->num_pwm * sizeof(board_pwm)) +
+           BOARD_CACHE_ALIGN(bc->num_i2c * sizeof(board_i2c)) +
+           num * sizeof(struct board_cache_entry) + strings + 1;
+  if (length > INT_MAX)
+    goto free;
+  buf = calloc(1, length);
+  if (!buf)
+    goto free;
+
+  cache = (struct board_cache *) buf;
+  memcpy(cache->magic, BOARD_CACHE_MAGIC, sizeof(cache->magic));
+  cache->version = BOARD_CACHE_VERSION;
+  cache->length = length;
+  cache->src_sec = src_st->st_mtim.tv_sec;
+  cache->src_nsec = src_st->st_mtim.tv_nsec;
+  cache->src_size = src_st->st_size;
+  cache->src_ino = src_st->st_ino;
+  cache->num_buckets = num_buckets;
+  cache->num_pins = num_pins;
+  cache->num_entries = num;
+  cache->num_spi = bc->num_spi;
+  cache->num_i2c = bc->num_i2c;
+  cache->num_pwm = bc->num_pwm;
+  cache->buckets = sizeof(struct board_cache);
+  cache->pins = cache->buckets + num_buckets * sizeof(uint32_t);
+  cache->spi = BOARD_CACHE_ALIGN(cache->pins +
+                                 num_pins * sizeof(struct board_cache_pin));
+  cache->pwm = BOARD_CACHE_ALIGN(cache->spi + bc->num_spi * sizeof(board_spi));
+  cache->i2c = BOARD_CACHE_ALIGN(cache->pwm + bc->num_pwm * sizeof(board_pwm));
+  cache->entries = BOARD_CACHE_ALIGN(cache->i2c +
+                                     bc->num_i2c * sizeof(board_i2c));
+
+  memcpy(buf + cache->spi, bc->spi, bc->num_spi * sizeof(board_spi));
+  memcpy(buf + cache->pwm, bc->pwm, bc->num_pwm * sizeof(board_pwm));
+  memcpy(buf + cache->i2c, bc->i2c, bc->num_i2c * sizeof(board_i2c));
+
+  disps = (uint32_t *) (buf + cache->buckets);
+  pins = (struct board_cache_pin *) (buf + cache->pins);
+  entries = (struct board_cache_entry *) (buf + cache->entries);
+
+  if (num_pins && _build_pin_hash(hashes, num_pins, num_buckets, disps,
+                                  slots) == EXIT_FAILURE)
+    {
+      libsoc_debug(__func__, "no perfect hash found for %u pins", num_pins);
+      goto free;
+    }
+
+  off = cache->entries + num * sizeof(struct board_cache_entry);
+  for (i = 0; i < num; i++)
+    {
+      if (i && !strcmp(settings[i].section, settings[i - 1].section))
+        entries[i].section = entries[i - 1].section;
+      else
+        entries[i].section = _cache_string(buf, &off, settings[i].section);
+      entries[i].key = _cache_string(buf, &off, settings[i].key);
+      entries[i].val = _cache_string(buf, &off, settings[i].val);
+    }
+  for (i = 0; i < num_pins; i++)
+    {
+      const char *val = settings[pin_settings[i]].val;
+
+      file_parse_int(val, strlen(val), &gpio);
+      pins[slots[i]].name = entries[pin_settings[i]].key;
+      pins[slots[i]].gpio = gpio;
+    }
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.%d", cache_path, getpid());
+  if (_make_cache_dir() == EXIT_FAILURE)
+    goto free;
+  fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      libsoc_debug(__func__, "unable to write board cache %s", tmp_path);
+      goto free;
+    }
+  written = file_write(fd, buf, length);
+  if (close(fd) || written != (int) length || rename(tmp_path, cache_path))
+    {
+      libsoc_debug(__func__, "unable to write board cache %s", cache_path);
+      unlink(tmp_path);
     }
   else
+    libsoc_debug(__func__, "wrote board cache %s", cache_path);
+
+free:
+  free(hashes);
+  free(pin_settings);
+  free(slots);
+  free(buf);
+}
+
+static int
+_cache_gpio_id(const struct board_cache *cache, const char *pin)
+{
+  const char *base = (const char *) cache;
+  const uint32_t *disps = (const uint32_t *) (base + cache->buckets);
+  const struct board_cache_pin *pins;
+  uint64_t hash;
+  uint32_t slot;
+
+  if (!cache->num_pins)
+    return -1;
+
+  hash = _pin_hash(pin);
+  slot = _pin_slot(hash, disps[_pin_bucket(hash, cache->num_buckets)],
+                   cache->num_pins);
+  pins = (const struct board_cache_pin *) (base + cache->pins) + slot;
+
+  return strcmp(base + pins->name, pin) ? -1 : pins->gpio;
+}
+
+static const char *
+_cache_get(const struct board_cache *cache, const char *sectname,
+           const char *key, const char *defval)
+{
+  const char *base = (const char *) cache;
+  const struct board_cache_entry *entries, *e;
+  uint32_t lo = 0, hi = cache->num_entries, mid;
+  int ret;
+
+  entries = (const struct board_cache_entry *) (base + cache->entries);
+  while (lo < hi)
     {
-      libsoc_warn("Unable to read directory: %s", confs_dir);
+      mid = lo + (hi - lo) / 2;
+      e = &entries[mid];
+      ret = strcmp(sectname, base + e->section);
+      if (!ret)
+        ret = strcmp(key, base + e->key);
+      if (!ret)
+        return base + e->val;
+      if (ret < 0)
+        hi = mid;
+      else
+        lo = mid + 1;
     }
+  return defval;
+}
+
+static board_config *
+_load_board(const char *path)
+{
+  const struct board_cache *cache;
+  struct cache_setting *settings;
+  char cache_path[PATH_MAX];
+  board_config *bc;
+  conffile *conf;
+  struct stat st;
+  uint32_t num;
+
+  if (stat(path, &st))
+    return NULL;
+  bc = calloc(1, sizeof(board_config));
+  if (!bc)
+    return NULL;
+
+  bc->path = strdup(path);
+  if (!bc->path)
+    {
+      free(bc);
+      return NULL;
+    }
+
+  _get_cache_file(path, cache_path);
+  cache = _map_cache(cache_path, &st, &bc->cache_len);
+  if (cache)
+    {
+      bc->cache = cache;
+      bc->spi = (const board_spi *) ((const char *) cache + cache->spi);
+      bc->num_spi = cache->num_spi;
+      bc->i2c = (const board_i2c *) ((const char *) cache + cache->i2c);
+      bc->num_i2c = cache->num_i2c;
+      bc->pwm = (const board_pwm *) ((const char *) cache + cache->pwm);
+      bc->num_pwm = cache->num_pwm;
+      return bc;
+    }
+
+  conf = conffile_load(path);
+  if (!conf)
+    {
+      libsoc_board_free(bc);
+      return NULL;
+    }
+  bc->parsed = conf;
+  settings = _get_settings(conf, &num);
+  if (!settings || _resolve_resources(settings, num, bc) == EXIT_FAILURE)
+    {
+      free(settings);
+      libsoc_board_free(bc);
+      return NULL;
+    }
+  _write_cache(settings, num, bc, &st, cache_path);
+  free(settings);
   return bc;
 }
 
+/*
+ * Look the model up in the index. Returns 1 with the matching board file in
+ * match, empty when no board matches, or 0 if the index is missing or stale.
+ */
+static int
+_probe_index(struct dt_model **models, struct stat *dir_st, char *match)
+{
+  char path[PATH_MAX];
+  char *index, *line, *next, *fields[6];
+  const char *probed;
+  struct stat st;
+  long long dir_sec, dir_nsec;
+  int i;
+
+  snprintf(path, sizeof(path), "%s/%s", _get_cache_dir(), BOARD_INDEX_NAME);
+  if (access(path, R_OK))
+    return 0;
+  index = file_read_contents(path);
+  if (!index)
+    return 0;
+
+  // Header, then the board file dir mtime
+  line = index;
+  next = strchr(line, '\n');
+  if (!next || strncmp(line, BOARD_INDEX_MAGIC "\n", next - line + 1))
+    goto stale;
+  line = next + 1;
+  if (sscanf(line, "%lld %lld", &dir_sec, &dir_nsec) != 2 ||
+      dir_sec != dir_st->st_mtim.tv_sec || dir_nsec != dir_st->st_mtim.tv_nsec)
+    goto stale;
+
+  /*
+   * Entries are mtime seconds and nanoseconds, size, file name, dtfile and
+   * model, tab separated. Files without a model have an empty one. Every
+   * file is checked so an edit to any of them is seen, not just the match.
+   */
+  match[0] = '\0';
+  for (line = strchr(line, '\n'); line && line[1]; line = next)
+    {
+      line++;
+      next = strchr(line, '\n');
+      if (!next)
+        goto stale;
+      *next = '\0';
+      fields[0] = line;
+      for (i = 1; i < 6; i++)
+        {
+          fields[i] = strchr(fields[i - 1], '\t');
+          if (!fields[i])
+            goto stale;
+          *fields[i]++ = '\0';
+        }
+
+      snprintf(path, sizeof(path), "%s/%s", _get_data_dir(), fields[3]);
+      if (stat(path, &st) || st.st_mtim.tv_sec != atoll(fields[0]) ||
+          st.st_mtim.tv_nsec != atoll(fields[1]) ||
+          st.st_size != atoll(fields[2]))
+        goto stale;
+
+      if (match[0] || !fields[5][0])
+        continue;
+      probed = _read_model(models, fields[4]);
+      if (probed && !strcmp(probed, fields[5]))
+        {
+          libsoc_debug(__func__, "index match for %s", path);
+          strcpy(match, path);
+        }
+    }
+
+  // A fresh index without a match means no board file supports this board
+  free(index);
+  return 1;
+
+stale:
+  libsoc_debug(__func__, "board index is stale");
+  free(index);
+  return 0;
+}
+
+static void
+_probe_scan(struct dt_model **models, struct stat *dir_st, char *match)
+{
+  conffile *conf;
+  const char *confs_dir = _get_data_dir();
+  const char *dtfile, *model, *probed;
+  char tmp[PATH_MAX], index_path[PATH_MAX], tmp_index_path[PATH_MAX + 16];
+  struct stat st;
+  FILE *index = NULL;
+  DIR *dirp;
+  struct dirent *dp;
+
+  match[0] = '\0';
+  if ((dirp = opendir(confs_dir)) == NULL)
+    {
+      libsoc_warn("Unable to read directory: %s", confs_dir);
+      return;
+    }
+
+  // Without a writable cache dir probing still works, just unindexed
+  snprintf(index_path, sizeof(index_path), "%s/%s", _get_cache_dir(),
+           BOARD_INDEX_NAME);
+  snprintf(tmp_index_path, sizeof(tmp_index_path), "%s.%d", index_path,
+           getpid());
+  if (_make_cache_dir() == EXIT_SUCCESS)
+    index = fopen(tmp_index_path, "w");
+  if (!index)
+    libsoc_debug(__func__, "unable to write board index %s", tmp_index_path);
+  else
+    fprintf(index, BOARD_INDEX_MAGIC "\n%lld %lld\n",
+            (long long) dir_st->st_mtim.tv_sec,
+            (long long) dir_st->st_mtim.tv_nsec);
+
+  // Every file is visited so the index is complete, the first match wins
+  while ((dp = readdir(dirp)) != NULL)
+    {
+      char *ext = strrchr(dp->d_name, '.');
+      if (!ext || strcmp(ext, ".conf"))
+        continue;
+
+      snprintf(tmp, sizeof(tmp), "%s/%s", confs_dir, dp->d_name);
+      if (stat(tmp, &st))
+        continue;
+      conf = conffile_load(tmp);
+      dtfile = model = NULL;
+      if (conf)
+        {
+          libsoc_debug(__func__, "probing %s for board support", tmp);
+          dtfile = conffile_get(conf, "board", "dtfile",
+                                "/proc/device-tree/model");
+          model = conffile_get(conf, "board", "model", NULL);
+          if (!model)
+            libsoc_debug(__func__,
+                         "No 'model' value found in 'board' section");
+        }
+
+      // Files without a model are indexed too, so an edit adding one is seen
+      if (index && (strpbrk(dp->d_name, "\t\n") || (model &&
+          (strpbrk(dtfile, "\t\n") || strpbrk(model, "\t\n")))))
+        {
+          libsoc_debug(__func__, "unable to index %s", tmp);
+          fclose(index);
+          unlink(tmp_index_path);
+          index = NULL;
+        }
+      if (index)
+        fprintf(index, "%lld\t%lld\t%lld\t%s\t%s\t%s\n",
+                (long long) st.st_mtim.tv_sec, (long long) st.st_mtim.tv_nsec,
+                (long long) st.st_size, dp->d_name, model ? dtfile : "",
+                model ? model : "");
+
+      probed = model ? _read_model(models, dtfile) : NULL;
+      if (!match[0] && probed && !strcmp(probed, model))
+        {
+          libsoc_debug(__func__, "probing match for %s", tmp);
+          strcpy(match, tmp);
+        }
+      conffile_free(conf);
+    }
+  closedir(dirp);
+
+  if (index)
+    {
+      if (fclose(index) || rename(tmp_index_path, index_path))
+        {
+          libsoc_debug(__func__, "unable to write board index %s", index_path);
+          unlink(tmp_index_path);
+        }
+    }
+}
+
+static board_config *
+_probe()
+{
+  struct dt_model *models = NULL;
+  struct stat dir_st;
+  char match[PATH_MAX];
+
+  if (stat(_get_data_dir(), &dir_st))
+    {
+      libsoc_warn("Unable to read directory: %s", _get_data_dir());
+      return NULL;
+    }
+
+  if (!_probe_index(&models, &dir_st, match))
+    _probe_scan(&models, &dir_st, match);
+
+  _free_models(models);
+  return match[0] ? _load_board(match) : NULL;
+}
+
 board_config*
 libsoc_board_init()
 {
@@ -96,13 +1047,7 @@ libsoc_board_init()
 
   if (!access(conf, F_OK))
     {
-      bc = calloc(sizeof(board_config), 1);
-      bc->conf = conffile_load(conf);
-      if (!bc->conf)
-        {
-          free(bc);
-          bc = NULL;
-        }
+      bc = _load_board(conf);
     }
     else
     {
@@ -119,7 +1064,11 @@ libsoc_board_free(board_config *config)
 {
   if (config)
     {
-        conffile_free(config->conf);
+        if (config->cache)
+          munmap((void *) config->cache, config->cache_len);
+        conffile_free(config->parsed);
+        free(config->path);
+        free(config->resources);
         free(config);
     }
 }
@@ -127,5 +1076,119 @@ libsoc_board_free(board_config *config)
 int
 libsoc_board_gpio_id(board_config *config, const char* pin)
 {
-  return conffile_get_int(config->conf, "GPIO", pin, -1);
+  if (config->cache)
+    return _cache_gpio_id(config->cache, pin);
+  return conffile_get_int(config->parsed, "GPIO", pin, -1);
+}
+
+const char*
+libsoc_board_get(board_config *config, const char *sectname, const char *key,
+  const char *defval)
+{
+  if (config->cache)
+    return _cache_get(config->cache, sectname, key, defval);
+  return conffile_get(config->parsed, sectname, key, defval);
+}
+
+// Only code wanting the conffile itself pays for parsing a cached config
+conffile*
+libsoc_board_conf(board_config *config)
+{
+  if (!config->parsed)
+    config->parsed = conffile_load(config->path);
+  return config->parsed;
+}
+
+static int
+_name_cmp(const void *name, const void *resource)
+{
+  // Every resource struct starts with its name
+  return strcmp(name, resource);
+}
+
+const board_spi*
+libsoc_board_spi(board_config *config, const char *name)
+{
+  return bsearch(name, config->spi, config->num_spi, sizeof(board_spi),
+                 _name_cmp);
+}
+
+const board_i2c*
+libsoc_board_i2c(board_config *config, const char *name)
+{
+  return bsearch(name, config->i2c, config->num_i2c, sizeof(board_i2c),
+                 _name_cmp);
+}
+
+const board_pwm*
+libsoc_board_pwm(board_config *config, const char *name)
+{
+  return bsearch(name, config->pwm, config->num_pwm, sizeof(board_pwm),
+                 _name_cmp);
+}
+
+spi*
+libsoc_board_spi_init(board_config *config, const char *name)
+{
+  const board_spi *res = libsoc_board_spi(config, name);
+  spi *spi;
+
+  if (!res)
+    {
+      libsoc_warn("No SPI named %s in the board config", name);
+      return NULL;
+    }
+
+  spi = libsoc_spi_init(res->device, res->chip_select);
+  if (!spi)
+    return NULL;
+
+  if ((res->mode != MODE_ERROR &&
+       libsoc_spi_set_mode(spi, res->mode) == EXIT_FAILURE) ||
+      (res->speed && libsoc_spi_set_speed(spi, res->speed) == EXIT_FAILURE))
+    {
+      libsoc_spi_free(spi);
+      return NULL;
+    }
+  return spi;
+}
+
+i2c*
+libsoc_board_i2c_init(board_config *config, const char *name)
+{
+  const board_i2c *res = libsoc_board_i2c(config, name);
+
+  if (!res)
+    {
+      libsoc_warn("No I2C named %s in the board config", name);
+      return NULL;
+    }
+  return libsoc_i2c_init(res->bus, res->address);
+}
+
+pwm*
+libsoc_board_pwm_request(board_config *config, const char *name,
+  shared_mode mode)
+{
+  const board_pwm *res = libsoc_board_pwm(config, name);
+  pwm *pwm;
+
+  if (!res)
+    {
+      libsoc_warn("No PWM named %s in the board config", name);
+      return NULL;
+    }
+
+  pwm = libsoc_pwm_request(res->chip, res->num, mode);
+  if (!pwm)
+    return NULL;
+
+  if ((res->polarity != POLARITY_ERROR &&
+       libsoc_pwm_set_polarity(pwm, res->polarity) == EXIT_FAILURE) ||
+      (res->period && libsoc_pwm_set_period(pwm, res->period) == EXIT_FAILURE))
+    {
+      libsoc_pwm_free(pwm);
+      return NULL;
+    }
+  return pwm;
 }
@@ -6,133 +6,278 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "libsoc_debug.h"
 #include "libsoc_conffile.h"
 
+/*
+ * A loaded file is a single block: the conffile struct, the file text with
+ * keys and values terminated in place, then the sections, keyvals and hash
+ * table slots. conffile_free is one free().
+ */
+#define ARENA_ALIGN(x) (((x) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+enum line_kind { LINE_BLANK, LINE_SECTION, LINE_KEYVAL };
+
 static char *
 trim(char *buf)
 {
-  size_t len = strlen(buf);
-  while (isspace(buf[--len]))
-    buf[len] = '\0';
-  while (isspace(*buf))
+  char *end = buf + strlen(buf);
+  while (end > buf && isspace((unsigned char) end[-1]))
+    *--end = '\0';
+  while (isspace((unsigned char) *buf))
     buf++;
   return buf;
 }
 
-static keyval*
-_create_keyval(const char *path, char *line)
+static enum line_kind
+_line_kind(const char *line)
+{
+  while (isspace((unsigned char) *line))
+    line++;
+  if (*line == '\0' || *line == '#')
+    return LINE_BLANK;
+  if (*line == '[')
+    return LINE_SECTION;
+  return LINE_KEYVAL;
+}
+
+// FNV-1a, short keys such as pin names hash well and quickly
+static unsigned int
+_hash(const char *str)
+{
+  unsigned int hash = 2166136261u;
+  while (*str)
+    hash = (hash ^ (unsigned char) *str++) * 16777619u;
+  return hash;
+}
+
+// Keep the load factor at or below a half so probe chains stay short
+static unsigned int
+_table_size(unsigned int count)
+{
+  unsigned int size = 8;
+  while (size < count * 2)
+    size <<= 1;
+  return size;
+}
+
+static keyval **
+_index_section(section *s, keyval **slots)
 {
   keyval *kv;
-  char *key, *val, *save;
-  key = strtok_r(line, "=", &save);
-  val = strtok_r(NULL, "\n", &save);
-  if (!val)
+  unsigned int count = 0, size, i;
+
+  for (kv = s->settings; kv; kv = kv->next)
+    count++;
+
+  size = _table_size(count);
+  s->table = slots;
+  s->table_mask = size - 1;
+
+  // Settings are stored newest first, so a repeated key keeps its last value
+  for (kv = s->settings; kv; kv = kv->next)
+    {
+      kv->hash = _hash(kv->key);
+      for (i = kv->hash & s->table_mask; s->table[i]; i = (i + 1) & s->table_mask)
+        {
+          if (s->table[i]->hash == kv->hash && !strcmp(s->table[i]->key, kv->key))
+            break;
+        }
+      if (!s->table[i])
+        s->table[i] = kv;
+    }
+  return slots + size;
+}
+
+static int
+_parse_section(const char *path, char *line, section *s)
+{
+  char *name = strchr(line, '[') + 1;
+  char *close = strchr(name, ']');
+
+  if (!close || *trim(close + 1) != '\0')
+    {
+      libsoc_warn("Invalid section line in %s:\n%s\n", path, line);
+      return -1;
+    }
+  *close = '\0';
+  name = trim(name);
+  if (strlen(name) >= sizeof(s->name))
+    {
+      libsoc_warn("Section name too long in %s: %s\n", path, name);
+      return -1;
+    }
+  strcpy(s->name, name);
+  return 0;
+}
+
+static int
+_parse_keyval(const char *path, char *line, keyval *kv)
+{
+  char *eq = strchr(line, '=');
+
+  if (!eq)
     {
       libsoc_warn("Invalid key = value in %s:\n%s\n", path, line);
-      return NULL;
+      return -1;
+    }
+  *eq = '\0';
+  kv->key = trim(line);
+  kv->val = trim(eq + 1);
+  if (*kv->key == '\0')
+    {
+      libsoc_warn("Missing key in %s before: %s\n", path, kv->val);
+      return -1;
     }
-  key = trim(key);
-  val = trim(val);
-  kv = calloc(1, sizeof(keyval));
-  kv->key = strdup(key);
-  kv->val = strdup(val);
-  return kv;
+  return 0;
 }
 
 conffile *
 conffile_load(const char *path)
 {
-  int rc;
   FILE *fp;
-  char line[256];
-  conffile *conf = calloc(1, sizeof(conffile));
-  section *stmp = NULL;
-  keyval *ktmp = NULL;
+  struct stat st;
+  conffile *conf, *tmp;
+  size_t size, text_off, sect_off, kv_off, table_off;
+  unsigned int nsect = 0, nkv = 0, nslots = 0, count = 0;
+  char *text, *end, *line, *nl;
+  section *sections, *stmp;
+  keyval *kvs, **slots;
 
   fp = fopen (path, "r");
-  if (fp)
+  if (!fp)
     {
-      while(fgets(line, sizeof(line), fp))
+      libsoc_warn("Unable to open board config: %s\n", path);
+      return calloc(1, sizeof(conffile));
+    }
+
+  if (fstat(fileno(fp), &st))
+    {
+      fclose(fp);
+      return NULL;
+    }
+
+  // Read the whole file in one go into the start of the arena
+  size = st.st_size;
+  text_off = ARENA_ALIGN(sizeof(conffile));
+  conf = malloc(text_off + size + 1);
+  if (!conf)
+    {
+      fclose(fp);
+      return NULL;
+    }
+  text = (char *) conf + text_off;
+  if (fread(text, 1, size, fp) != size)
+    {
+      libsoc_warn("Unable to read board config: %s\n", path);
+      fclose(fp);
+      free(conf);
+      return NULL;
+    }
+  fclose(fp);
+  text[size] = '\0';
+  end = text + size;
+
+  // Lines are walked as C strings once split, a NUL would split them again
+  if (memchr(text, '\0', size))
+    {
+      libsoc_warn("Board config contains a NUL byte: %s\n", path);
+      free(conf);
+      return NULL;
+    }
+
+  // First pass terminates each line and counts what needs storing
+  for (line = text; line < end; line = nl + 1)
+    {
+      nl = memchr(line, '\n', end - line);
+      if (!nl)
+        nl = end;
+      *nl = '\0';
+      switch (_line_kind(line))
         {
-          if (*line == '#' || *line == '\0' || *line == '\n')
-	    continue;
-          if (line[0] == '[')
-            {
-              // new section
-              stmp = calloc(1, sizeof(section));
-              stmp->next = conf->sections;
-              conf->sections = stmp;
-
-              rc = strlen(line);
-              if (line[rc-2] != ']' || (rc-2) > sizeof(stmp->name))
-                {
-                  libsoc_warn("Invalid section line in %s:\n%s\n", path, line);
-                  goto cleanup;
-                }
-              line[rc-2] = '\0';
-              strcpy(stmp->name, trim(&line[1]));
-            }
-          else
-            {
-              if (!conf->sections)
-                {
-                  libsoc_warn("Section must be declared in %s before line: %s\n",
-                              path, line);
-                }
-              ktmp = _create_keyval(path, line);
-              if (ktmp)
-                {
-                  ktmp->next = conf->sections->settings;
-                  conf->sections->settings = ktmp;
-                }
-              else
-                {
-                  goto cleanup;
-                }
-            }
+        case LINE_SECTION:
+          if (nsect)
+            nslots += _table_size(count);
+          nsect++;
+          count = 0;
+          break;
+        case LINE_KEYVAL:
+          nkv++;
+          count++;
+          break;
+        default:
+          break;
         }
-      fclose(fp);
     }
-  else
+  if (nsect)
+    nslots += _table_size(count);
+
+  // Grow the arena to hold the structures, nothing points into it yet
+  sect_off = ARENA_ALIGN(text_off + size + 1);
+  kv_off = sect_off + nsect * sizeof(section);
+  table_off = kv_off + nkv * sizeof(keyval);
+  tmp = realloc(conf, table_off + nslots * sizeof(keyval *));
+  if (!tmp)
     {
-        libsoc_warn("Unable to open board config: %s\n", path);
+      free(conf);
+      return NULL;
     }
+  conf = tmp;
+  text = (char *) conf + text_off;
+  end = text + size;
+  sections = (section *) ((char *) conf + sect_off);
+  kvs = (keyval *) ((char *) conf + kv_off);
+  slots = (keyval **) ((char *) conf + table_off);
+  memset(slots, 0, nslots * sizeof(keyval *));
+  conf->sections = NULL;
+
+  // Second pass fills in the structures, strings stay in the text
+  for (line = text; line < end; line = nl + 1)
+    {
+      // Parsing terminates keys and values in place, so step on first
+      nl = line + strlen(line);
+      switch (_line_kind(line))
+        {
+        case LINE_SECTION:
+          stmp = sections++;
+          if (_parse_section(path, line, stmp))
+            goto cleanup;
+          stmp->settings = NULL;
+          stmp->next = conf->sections;
+          conf->sections = stmp;
+          break;
+        case LINE_KEYVAL:
+          if (!conf->sections)
+            {
+              libsoc_warn("Section must be declared in %s before line: %s\n",
+                          path, line);
+              goto cleanup;
+            }
+          if (_parse_keyval(path, line, kvs))
+            goto cleanup;
+          kvs->next = conf->sections->settings;
+          conf->sections->settings = kvs++;
+          break;
+        default:
+          break;
+        }
+    }
+
+  for (stmp = conf->sections; stmp; stmp = stmp->next)
+    slots = _index_section(stmp, slots);
 
   return conf;
 
 cleanup:
-  if (fp)
-    fclose(fp);
-  conffile_free(conf);
+  free(conf);
   return NULL;
 }
 
 void conffile_free(conffile *conf)
 {
-  section *sptr, *stmp;
-  keyval *kptr, *ktmp;
-
-  if (!conf)
-    return;
-
-  sptr = conf->sections;
-  while (sptr)
-    {
-      kptr = sptr->settings;
-      while (kptr)
-        {
-          ktmp = kptr->next;
-          free(kptr->key);
-          free(kptr->val);
-          free(kptr);
-          kptr = ktmp;
-        }
-      stmp = sptr->next;
-      free(sptr);
-      sptr = stmp;
-    }
+  free(conf);
 }
 
 const char*
@@ -143,12 +288,12 @@ conffile_get(conffile *conf, const char *sectname, const char *key, const char *
     {
       if (!strcmp(s->name, sectname))
         {
-          keyval *kv = s->settings;
-          while(kv)
+          unsigned int hash = _hash(key), i;
+          keyval *kv;
+          for (i = hash & s->table_mask; (kv = s->table[i]); i = (i + 1) & s->table_mask)
             {
-              if (!strcmp(kv->key, key))
+              if (kv->hash == hash && !strcmp(kv->key, key))
                 return kv->val;
-              kv = kv->next;
             }
           return defval;
         }
@@ -3,14 +3,14 @@
 #include <stdarg.h>
 #include <stdio.h>
 
-int debug = 0;
+#include "libsoc_log.h"
+
+int libsoc_debug_level = LIBSOC_DEBUG_OFF;
 
 void
 libsoc_debug (const char *func, char *format, ...)
 {
-#ifdef DEBUG
-
-  if (debug)
+  if (libsoc_debug_enabled (LIBSOC_DEBUG_INFO))
     {
       va_list args;
 
@@ -24,7 +24,6 @@ libsoc_debug (const char *func, char *format, ...)
 
       fprintf (stderr, "\n");
     }
-#endif
 }
 
 void
@@ -46,15 +45,18 @@ libsoc_set_debug (int level)
 {
 #ifdef DEBUG
 
+  if (level < LIBSOC_DEBUG_OFF || level > LIBSOC_DEBUG_TRACE)
+    level = LIBSOC_DEBUG_TRACE;
+
   if (level)
     {
-      debug = 1;
-      libsoc_debug (__func__, "debug enabled");
+      libsoc_debug_level = level;
+      libsoc_debug (__func__, "debug enabled at level %d", level);
     }
   else
     {
       libsoc_debug (__func__, "debug disabled");
-      debug = 0;
+      libsoc_debug_level = LIBSOC_DEBUG_OFF;
     }
 
 #else
@@ -69,11 +71,13 @@ libsoc_get_debug ()
 {
 #ifdef DEBUG
 
-  return debug;
+  return libsoc_debug_level;
 
 #else
 
   printf ("libsoc-debug: warning debug support missing!\n");
 
+  return LIBSOC_DEBUG_OFF;
+
 #endif
 }
@@ -4,8 +4,14 @@
 #include <fcntl.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
 
+#include "libsoc_file.h"
+
 int file_open(const char *path, int flags)
 {
   int fd = open(path, flags);
@@ -34,8 +40,8 @@ int file_write(int fd, const char *str, int len)
 
 int file_read(int fd, void *buf, int count)
 {
-  lseek (fd, 0, SEEK_SET);
-  int ret = read(fd, buf, count);
+  // Attributes are always read from the start, pread saves the lseek
+  int ret = pread(fd, buf, count, 0);
 
   if (ret < 0)
   {
@@ -67,18 +73,153 @@ int file_close(int fd)
   return 0;
 }
 
-#define INT_STR_BUF 20
+// Room for a value and trailing newline, longer reads can't be a valid int
+#define INT_READ_BUF 32
+
+static const char digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+int file_format_int(char *buf, int64_t val)
+{
+  char tmp[FILE_INT_STR_BUF];
+  char *p = tmp + sizeof(tmp);
+  uint64_t u = val < 0 ? -(uint64_t) val : (uint64_t) val;
+  int i, len;
+
+  // Two digits per division, written backwards from the end of tmp
+  while (u >= 100)
+  {
+    i = (u % 100) * 2;
+    u /= 100;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
+  }
+
+  if (u >= 10)
+  {
+    i = u * 2;
+    *--p = digit_pairs[i + 1];
+    *--p = digit_pairs[i];
+  }
+  else
+  {
+    *--p = '0' + u;
+  }
+
+  if (val < 0)
+  {
+    *--p = '-';
+  }
+
+  len = tmp + sizeof(tmp) - p;
+
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+
+  return len;
+}
+
+static int is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+int file_parse_int(const char *buf, int len, int64_t *val)
+{
+  const char *p = buf, *end = buf + len;
+  uint64_t u = 0, limit = INT64_MAX;
+  int neg = 0, digits = 0;
+
+  while (p < end && is_space(*p))
+  {
+    p++;
+  }
+
+  if (p < end && (*p == '-' || *p == '+'))
+  {
+    neg = *p == '-';
+    p++;
+  }
+
+  if (neg)
+  {
+    limit = (uint64_t) INT64_MAX + 1;
+  }
+
+  for (; p < end && *p >= '0' && *p <= '9'; p++, digits++)
+  {
+    if (u > (limit - (*p - '0')) / 10)
+    {
+      errno = ERANGE;
+      return EXIT_FAILURE;
+    }
+
+    u = u * 10 + (*p - '0');
+  }
+
+  // Only whitespace, normally sysfs's newline, may follow the digits
+  while (p < end && is_space(*p))
+  {
+    p++;
+  }
+
+  if (digits == 0 || (p < end && *p != '\0'))
+  {
+    errno = EINVAL;
+    return EXIT_FAILURE;
+  }
+
+  *val = neg ? (int64_t) (0 - u) : (int64_t) u;
+
+  return EXIT_SUCCESS;
+}
+
+int file_read_int64_fd(int fd, int64_t *val)
+{
+  char buf[INT_READ_BUF];
+  int len;
+
+  len = file_read(fd, buf, INT_READ_BUF);
+
+  if (len < 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (len == INT_READ_BUF)
+  {
+    errno = ERANGE;
+    return EXIT_FAILURE;
+  }
+
+  return file_parse_int(buf, len, val);
+}
 
 int file_read_int_fd(int fd, int *tmp)
 {
-  char buf[INT_STR_BUF];
+  int64_t val;
 
-  if (file_read(fd, buf, INT_STR_BUF) < 0)
+  if (file_read_int64_fd(fd, &val) == EXIT_FAILURE)
   {
     return EXIT_FAILURE;
   }
 
-  *tmp = atoi(buf);
+  if (val < INT_MIN || val > INT_MAX)
+  {
+    errno = ERANGE;
+    return EXIT_FAILURE;
+  }
+
+  *tmp = val;
 
   return EXIT_SUCCESS;
 }
@@ -104,13 +245,12 @@ int file_read_int_path(char *path, int *tmp)
   return EXIT_SUCCESS;
 }
 
-int file_write_int_fd(int fd, int val)
+int file_write_int64_fd(int fd, int64_t val)
 {
-  char buf[INT_STR_BUF];
-
-  sprintf(buf, "%d", val);
+  char buf[FILE_INT_STR_BUF];
+  int len = file_format_int(buf, val);
 
-  if (file_write(fd, buf, INT_STR_BUF) < 0)
+  if (file_write(fd, buf, len) != len)
   {
     return EXIT_FAILURE;
   }
@@ -118,6 +258,11 @@ int file_write_int_fd(int fd, int val)
   return EXIT_SUCCESS;
 }
 
+int file_write_int_fd(int fd, int val)
+{
+  return file_write_int64_fd(fd, val);
+}
+
 int file_write_int_path(char *path, int val)
 {
   int fd, ret;
@@ -199,18 +344,121 @@ char* file_read_contents(const char *path)
     return NULL;
   }
 
-  fd = file_open(path, O_RDONLY);
+  fd = file_open(path, O_RDONLY | O_CLOEXEC);
   if (fd < 0)
     return NULL;
 
-  buf = malloc(st.st_size);
+  // Terminated so text files such as the device tree model are strings
+  buf = malloc(st.st_size + 1);
   if (buf)
   {
     if (file_read(fd, buf, st.st_size) != st.st_size)
     {
       free(buf);
-      return NULL;
+      buf = NULL;
+    }
+    else
+    {
+      buf[st.st_size] = '\0';
     }
   }
+
+  file_close(fd);
+
   return buf;
 }
+
+int file_read_attr_fd(int fd, char *buf, int len)
+{
+  int ret;
+
+  if (len < 2)
+  {
+    return -1;
+  }
+
+  ret = file_read(fd, buf, len - 1);
+
+  if (ret < 0)
+  {
+    return -1;
+  }
+
+  // Drop sysfs's trailing newline so the value can be compared directly
+  while (ret > 0 && is_space(buf[ret - 1]))
+  {
+    ret--;
+  }
+
+  buf[ret] = '\0';
+
+  return ret;
+}
+
+int file_read_attr(const char *path, char *buf, int len)
+{
+  int fd, ret;
+
+  fd = file_open(path, O_RDONLY | O_CLOEXEC);
+
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  ret = file_read_attr_fd(fd, buf, len);
+
+  if (file_close(fd) < 0)
+  {
+    return -1;
+  }
+
+  return ret;
+}
+
+int file_lookup_enum(const char *str, int len, const file_enum *table,
+  int num, int fallback)
+{
+  int i;
+
+  for (i = 0; i < num; i++)
+  {
+    if (table[i].len == len && memcmp(table[i].str, str, len) == 0)
+    {
+      return table[i].value;
+    }
+  }
+
+  return fallback;
+}
+
+int file_read_enum_fd(int fd, const file_enum *table, int num, int fallback)
+{
+  char buf[FILE_ATTR_BUF];
+  int len;
+
+  len = file_read_attr_fd(fd, buf, FILE_ATTR_BUF);
+
+  if (len < 0)
+  {
+    return fallback;
+  }
+
+  return file_lookup_enum(buf, len, table, num, fallback);
+}
+
+int file_read_enum_path(const char *path, const file_enum *table, int num,
+  int fallback)
+{
+  char buf[FILE_ATTR_BUF];
+  int len;
+
+  len = file_read_attr(path, buf, FILE_ATTR_BUF);
+
+  if (len < 0)
+  {
+    return fallback;
+  }
+
+  return file_lookup_enum(buf, len, table, num, fallback);
+}
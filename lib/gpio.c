@@ -11,7 +11,7 @@
 #include <string.h>
 
 #include "libsoc_file.h"
-#include "libsoc_debug.h"
+#include "libsoc_log.h"
 #include "libsoc_gpio.h"
 
 #define STR_BUF 256
@@ -20,37 +20,86 @@ const char gpio_level_strings[2][STR_BUF] = { "0", "1" };
 const char gpio_direction_strings[2][STR_BUF] = { "in", "out" };
 const char gpio_edge_strings[4][STR_BUF] = { "rising", "falling", "none", "both" };
 
-void
-libsoc_gpio_debug (const char *func, int gpio, char *format, ...)
+static const file_enum gpio_direction_table[] = {
+  FILE_ENUM ("in", INPUT),
+  FILE_ENUM ("out", OUTPUT),
+};
+
+static const file_enum gpio_edge_table[] = {
+  FILE_ENUM ("rising", RISING),
+  FILE_ENUM ("falling", FALLING),
+  FILE_ENUM ("none", NONE),
+  FILE_ENUM ("both", BOTH),
+};
+
+static void LIBSOC_PRINTER (3)
+libsoc_gpio_debug_print (const char *func, int gpio, char *format, ...)
 {
-#ifdef DEBUG
+  va_list args;
+
+  fprintf (stderr, "libsoc-gpio-debug: ");
 
-  if (libsoc_get_debug ())
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+
+  if (gpio >= 0)
     {
-      va_list args;
+      fprintf (stderr, " (%d, %s)", gpio, func);
+    }
+  else
+    {
+      fprintf (stderr, " (NULL, %s)", func);
+    }
 
-      fprintf (stderr, "libsoc-gpio-debug: ");
+  fprintf (stderr, "\n");
+}
 
-      va_start (args, format);
-      vfprintf (stderr, format, args);
-      va_end (args);
+#define libsoc_gpio_debug(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_INFO, libsoc_gpio_debug_print, __VA_ARGS__)
+#define libsoc_gpio_trace(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_TRACE, libsoc_gpio_debug_print, __VA_ARGS__)
+
+/*
+ * Requested gpios are shared within the process, the gpio stays exported
+ * and its value fd open until the last reference is freed. The slow sysfs
+ * export and unexport run without the lock, the entry is marked busy
+ * meanwhile and requests for the same gpio wait for it on the condition.
+ */
+struct gpio_registry_entry
+{
+  unsigned int id;
+  gpio *gpio;
+  int refs;
+  int busy;
+  struct gpio_registry_entry *next;
+};
+
+static struct gpio_registry_entry *gpio_registry;
+static pthread_mutex_t gpio_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gpio_registry_cond = PTHREAD_COND_INITIALIZER;
+
+// Remove an entry and wake requests waiting on it, called with the lock held
+static void
+libsoc_gpio_registry_remove (struct gpio_registry_entry *entry)
+{
+  struct gpio_registry_entry **prev;
 
-      if (gpio >= 0)
-	{
-	  fprintf (stderr, " (%d, %s)", gpio, func);
-	}
-      else
+  for (prev = &gpio_registry; *prev; prev = &(*prev)->next)
+    {
+      if (*prev == entry)
 	{
-	  fprintf (stderr, " (NULL, %s)", func);
+	  *prev = entry->next;
+	  break;
 	}
-
-      fprintf (stderr, "\n");
     }
-#endif
+
+  free (entry);
+  pthread_cond_broadcast (&gpio_registry_cond);
 }
 
-gpio *
-libsoc_gpio_request (unsigned int gpio_id, gpio_mode mode)
+static gpio *
+libsoc_gpio_open (unsigned int gpio_id, gpio_mode mode)
 {
   gpio *new_gpio;
   char tmp_str[STR_BUF];
@@ -134,6 +183,7 @@ libsoc_gpio_request (unsigned int gpio_id, gpio_mode mode)
   new_gpio->gpio = gpio_id;
   new_gpio->shared = shared;
   new_gpio->callback = NULL;
+  new_gpio->stats = libsoc_stats_new (LS_STATS_GPIO, gpio_id);
 
   // Set up a pollfd in case we are used for polling later
   new_gpio->pfd.fd = new_gpio->value_fd;
@@ -143,18 +193,12 @@ libsoc_gpio_request (unsigned int gpio_id, gpio_mode mode)
   return new_gpio;
 }
 
-int
-libsoc_gpio_free (gpio * gpio)
+static int
+libsoc_gpio_close (gpio * gpio)
 {
   char tmp_str[STR_BUF];
   int fd;
 
-  if (gpio == NULL)
-    {
-      libsoc_gpio_debug (__func__, -1, "invalid gpio pointer");
-      return EXIT_FAILURE;
-    }
-
   libsoc_gpio_debug (__func__, gpio->gpio, "freeing gpio");
 
   if (gpio->callback != NULL)
@@ -167,6 +211,9 @@ libsoc_gpio_free (gpio * gpio)
   if (file_close (gpio->value_fd) < 0)
     return EXIT_FAILURE;
 
+  libsoc_stats_free (gpio->stats);
+  gpio->stats = NULL;
+
   if (gpio->shared == 1)
     {
       free (gpio);
@@ -199,6 +246,131 @@ libsoc_gpio_free (gpio * gpio)
   return EXIT_SUCCESS;
 }
 
+gpio *
+libsoc_gpio_request (unsigned int gpio_id, gpio_mode mode)
+{
+  struct gpio_registry_entry *entry;
+  gpio *new_gpio;
+
+  pthread_mutex_lock (&gpio_registry_lock);
+
+  while (1)
+    {
+      for (entry = gpio_registry; entry; entry = entry->next)
+	{
+	  if (entry->id == gpio_id)
+	    break;
+	}
+
+      if (entry == NULL || !entry->busy)
+	break;
+
+      // Another thread is exporting or unexporting it, look again after
+      pthread_cond_wait (&gpio_registry_cond, &gpio_registry_lock);
+    }
+
+  if (entry)
+    {
+      // Weak requests fail on exported gpios, including our own
+      if (mode == LS_GPIO_WEAK)
+	{
+	  pthread_mutex_unlock (&gpio_registry_lock);
+	  libsoc_gpio_debug (__func__, gpio_id, "gpio already requested");
+	  return NULL;
+	}
+
+      entry->refs++;
+      pthread_mutex_unlock (&gpio_registry_lock);
+
+      libsoc_gpio_debug (__func__, gpio_id, "sharing gpio, %d references",
+			 entry->refs);
+
+      return entry->gpio;
+    }
+
+  entry = malloc (sizeof (struct gpio_registry_entry));
+
+  if (entry == NULL)
+    {
+      pthread_mutex_unlock (&gpio_registry_lock);
+      return NULL;
+    }
+
+  entry->id = gpio_id;
+  entry->gpio = NULL;
+  entry->refs = 1;
+  entry->busy = 1;
+  entry->next = gpio_registry;
+  gpio_registry = entry;
+
+  pthread_mutex_unlock (&gpio_registry_lock);
+
+  new_gpio = libsoc_gpio_open (gpio_id, mode);
+
+  pthread_mutex_lock (&gpio_registry_lock);
+
+  if (new_gpio)
+    {
+      entry->gpio = new_gpio;
+      entry->busy = 0;
+      pthread_cond_broadcast (&gpio_registry_cond);
+    }
+  else
+    {
+      libsoc_gpio_registry_remove (entry);
+    }
+
+  pthread_mutex_unlock (&gpio_registry_lock);
+
+  return new_gpio;
+}
+
+int
+libsoc_gpio_free (gpio * gpio)
+{
+  struct gpio_registry_entry *entry;
+  int ret;
+
+  if (gpio == NULL)
+    {
+      libsoc_gpio_debug (__func__, -1, "invalid gpio pointer");
+      return EXIT_FAILURE;
+    }
+
+  pthread_mutex_lock (&gpio_registry_lock);
+
+  for (entry = gpio_registry; entry; entry = entry->next)
+    {
+      if (entry->gpio == gpio)
+	break;
+    }
+
+  if (entry && --entry->refs > 0)
+    {
+      pthread_mutex_unlock (&gpio_registry_lock);
+      libsoc_gpio_debug (__func__, gpio->gpio,
+			 "dropped reference, gpio still in use");
+      return EXIT_SUCCESS;
+    }
+
+  // Keep the entry until it is unexported, so a new request cannot race it
+  if (entry)
+    entry->busy = 1;
+
+  pthread_mutex_unlock (&gpio_registry_lock);
+
+  ret = libsoc_gpio_close (gpio);
+
+  if (entry)
+    {
+      pthread_mutex_lock (&gpio_registry_lock);
+      libsoc_gpio_registry_remove (entry);
+      pthread_mutex_unlock (&gpio_registry_lock);
+    }
+
+  return ret;
+}
+
 int
 libsoc_gpio_set_direction (gpio * current_gpio, gpio_direction direction)
 {
@@ -234,8 +406,8 @@ libsoc_gpio_set_direction (gpio * current_gpio, gpio_direction direction)
 gpio_direction
 libsoc_gpio_get_direction (gpio * current_gpio)
 {
-  int fd;
-  char tmp_str[STR_BUF];
+  char path[STR_BUF];
+  gpio_direction direction;
 
   if (current_gpio == NULL)
     {
@@ -243,48 +415,50 @@ libsoc_gpio_get_direction (gpio * current_gpio)
       return DIRECTION_ERROR;
     }
 
-  sprintf (tmp_str, "/sys/class/gpio/gpio%d/direction", current_gpio->gpio);
-
-  fd = file_open (tmp_str, O_RDONLY);
-
-  if (fd < 0)
-    return DIRECTION_ERROR;
-
-  lseek (fd, 0, SEEK_SET);
-
-  if (file_read (fd, tmp_str, STR_BUF) < 0)
-    return DIRECTION_ERROR;
+  sprintf (path, "/sys/class/gpio/gpio%d/direction", current_gpio->gpio);
 
-  if (file_close (fd) < 0)
-    return DIRECTION_ERROR;
+  direction = file_read_enum_path (path, gpio_direction_table,
+				   FILE_ENUM_NUM (gpio_direction_table),
+				   DIRECTION_ERROR);
 
-  if (strncmp (tmp_str, "in", 2) <= 0)
+  if (direction == DIRECTION_ERROR)
     {
       libsoc_gpio_debug (__func__, current_gpio->gpio,
-			 "read direction as input");
-      return INPUT;
+			 "reading direction failed");
     }
   else
     {
       libsoc_gpio_debug (__func__, current_gpio->gpio,
-			 "read direction as output");
-      return OUTPUT;
+			 "read direction as %s",
+			 gpio_direction_strings[direction]);
     }
+
+  return direction;
 }
 
 int
 libsoc_gpio_set_level (gpio * current_gpio, gpio_level level)
 {
+  uint64_t start;
+  int ret;
+
   if (current_gpio == NULL)
     {
       libsoc_gpio_debug (__func__, -1, "invalid gpio pointer");
       return EXIT_FAILURE;
     }
 
-  libsoc_gpio_debug (__func__, current_gpio->gpio, "setting level to %d",
+  libsoc_gpio_trace (__func__, current_gpio->gpio, "setting level to %d",
 		     level);
 
-  if (file_write (current_gpio->value_fd, gpio_level_strings[level], 1) < 0)
+  start = libsoc_io_begin (current_gpio->stats);
+
+  ret = file_write (current_gpio->value_fd, gpio_level_strings[level], 1);
+
+  libsoc_io_end (start, current_gpio->stats, LS_TRACE_GPIO_SET_LEVEL,
+		 current_gpio->gpio, level, ret);
+
+  if (ret < 0)
     return EXIT_FAILURE;
 
   return EXIT_SUCCESS;
@@ -294,6 +468,8 @@ gpio_level
 libsoc_gpio_get_level (gpio * current_gpio)
 {
   char level[2];
+  uint64_t start;
+  ssize_t ret;
 
   if (current_gpio == NULL)
     {
@@ -301,9 +477,16 @@ libsoc_gpio_get_level (gpio * current_gpio)
       return LEVEL_ERROR;
     }
 
+  start = libsoc_io_begin (current_gpio->stats);
+
   lseek (current_gpio->value_fd, 0, SEEK_SET);
 
-  if (read (current_gpio->value_fd, level, 2) != 2)
+  ret = read (current_gpio->value_fd, level, 2);
+
+  libsoc_io_end (start, current_gpio->stats, LS_TRACE_GPIO_GET_LEVEL,
+		 current_gpio->gpio, ret == 2 && level[0] != '0', ret);
+
+  if (ret != 2)
   {
     libsoc_gpio_debug (__func__, current_gpio->gpio, "level read failed");
     perror ("libgpio");
@@ -312,12 +495,12 @@ libsoc_gpio_get_level (gpio * current_gpio)
 
   if (level[0] == '0')
     {
-      libsoc_gpio_debug (__func__, current_gpio->gpio, "read level as low");
+      libsoc_gpio_trace (__func__, current_gpio->gpio, "read level as low");
       return LOW;
     }
   else
     {
-      libsoc_gpio_debug (__func__, current_gpio->gpio, "read level as high");
+      libsoc_gpio_trace (__func__, current_gpio->gpio, "read level as high");
       return HIGH;
     }
 }
@@ -356,8 +539,8 @@ libsoc_gpio_set_edge (gpio * current_gpio, gpio_edge edge)
 gpio_edge
 libsoc_gpio_get_edge (gpio * current_gpio)
 {
-  int fd;
-  char tmp_str[STR_BUF];
+  char path[STR_BUF];
+  gpio_edge edge;
 
   if (current_gpio == NULL)
     {
@@ -365,43 +548,22 @@ libsoc_gpio_get_edge (gpio * current_gpio)
       return EDGE_ERROR;
     }
 
-  sprintf (tmp_str, "/sys/class/gpio/gpio%d/edge", current_gpio->gpio);
-
-  fd = file_open (tmp_str, O_RDONLY);
-
-  if (fd < 0)
-    return EDGE_ERROR;
-
-  lseek (fd, 0, SEEK_SET);
-
-  if (file_read (fd, tmp_str, STR_BUF) < 0)
-    return EDGE_ERROR;
+  sprintf (path, "/sys/class/gpio/gpio%d/edge", current_gpio->gpio);
 
-  if (file_close (fd) < 0)
-    return EDGE_ERROR;
+  edge = file_read_enum_path (path, gpio_edge_table,
+			      FILE_ENUM_NUM (gpio_edge_table), EDGE_ERROR);
 
-  if (strncmp (tmp_str, "r", 1) == 0)
-    {
-      libsoc_gpio_debug (__func__, current_gpio->gpio, "read edge as rising");
-      return RISING;
-    }
-  else if (strncmp (tmp_str, "f", 1) == 0)
+  if (edge == EDGE_ERROR)
     {
-      libsoc_gpio_debug (__func__, current_gpio->gpio,
-			 "read edge as falling");
-      return FALLING;
-    }
-  else if (strncmp (tmp_str, "b", 1) == 0)
-    {
-      libsoc_gpio_debug (__func__, current_gpio->gpio,
-			 "read edge as both");
-      return BOTH;
+      libsoc_gpio_debug (__func__, current_gpio->gpio, "reading edge failed");
     }
   else
     {
-      libsoc_gpio_debug (__func__, current_gpio->gpio, "read edge as none");
-      return NONE;
+      libsoc_gpio_debug (__func__, current_gpio->gpio, "read edge as %s",
+			 gpio_edge_strings[edge]);
     }
+
+  return edge;
 }
 
 int
@@ -409,12 +571,19 @@ libsoc_gpio_poll (gpio * gpio, int timeout)
 {
   int rc;
   char c;
+  uint64_t start;
+
+  start = libsoc_io_begin (gpio->stats);
 
   // do an initial read to clear interrupt,
   rc = lseek(gpio->value_fd, 0, SEEK_SET);
   rc = read(gpio->value_fd, &c, 1);
 
   rc = poll(&gpio->pfd, 1, timeout);
+
+  libsoc_io_end (start, gpio->stats, LS_TRACE_GPIO_POLL, gpio->gpio, timeout,
+		 rc);
+
   if (rc == -1)
     {
       libsoc_gpio_debug (__func__, gpio->gpio, "poll failed");
@@ -468,7 +637,7 @@ __libsoc_new_interrupt_callback_thread (void *void_gpio)
     {
       if (libsoc_gpio_poll(gpio, -1) == LS_INT_TRIGGERED)
         {
-          libsoc_gpio_debug (__func__, gpio->gpio, "caught interrupt");
+          libsoc_gpio_trace (__func__, gpio->gpio, "caught interrupt");
           gpio->callback->callback_fn (gpio->callback->callback_arg);
         }
     }
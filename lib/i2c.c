@@ -5,42 +5,236 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/ioctl.h>
+#include <sys/eventfd.h>
 #include <linux/types.h>
 
 #include "libsoc_i2c.h"
-#include "libsoc_debug.h"
+#include "libsoc_log.h"
 #include "libsoc_file.h"
 
-void
-libsoc_i2c_debug (const char *func, i2c * i2c, char *format, ...)
+/*
+ * One worker thread per bus runs queued transfers in order, completed
+ * requests are handed back on a per device list and signalled on the
+ * device's eventfd.
+ */
+
+struct i2c_worker {
+  uint8_t bus;
+  int refcount;
+  int stop;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  pthread_cond_t completed;
+  i2c_request *head;
+  i2c_request *tail;
+};
+
+struct i2c_async {
+  struct i2c_worker *worker;
+  int event_fd;
+  int pending;
+  i2c_request *done_head;
+  i2c_request *done_tail;
+};
+
+static struct i2c_worker *i2c_workers[256];
+static pthread_mutex_t i2c_workers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+libsoc_i2c_kernel_open (uint8_t bus)
+{
+  char path[40];
+
+  sprintf (path, "/dev/i2c-%d", bus);
+
+  if (!file_valid (path))
+    return -1;
+
+  return file_open (path, O_SYNC | O_RDWR);
+}
+
+static int
+libsoc_i2c_kernel_ioctl (int fd, unsigned long request, unsigned long arg)
+{
+  return ioctl (fd, request, arg);
+}
+
+static const i2c_backend i2c_kernel_backend = {
+  .open = libsoc_i2c_kernel_open,
+  .close = file_close,
+  .ioctl = libsoc_i2c_kernel_ioctl,
+};
+
+static const i2c_backend *current_backend = &i2c_kernel_backend;
+
+static void LIBSOC_PRINTER (3)
+libsoc_i2c_debug_print (const char *func, i2c * i2c, char *format, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "libsoc-i2c-debug: ");
+
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+
+  if (i2c == NULL)
+    {
+      fprintf (stderr, " (NULL, %s)", func);
+    }
+  else
+    {
+      fprintf (stderr, " (i2c-%d, %d, %s)", i2c->bus,
+	       i2c->address, func);
+    }
+
+  fprintf (stderr, "\n");
+}
+
+#define libsoc_i2c_debug(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_INFO, libsoc_i2c_debug_print, __VA_ARGS__)
+#define libsoc_i2c_trace(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_TRACE, libsoc_i2c_debug_print, __VA_ARGS__)
+
+static const int i2c_default_retry_errno[] = {
+  ENXIO, EREMOTEIO, EAGAIN, ETIMEDOUT, 0
+};
+
+static int
+libsoc_i2c_retryable (i2c * i2c, int err)
 {
-#ifdef DEBUG
+  const int *list = i2c_default_retry_errno;
+  int i;
+
+  if (i2c->policy.retry_errno[0] != 0)
+    list = i2c->policy.retry_errno;
 
-  if (libsoc_get_debug ())
+  for (i = 0; i < 8 && list[i] != 0; i++)
     {
-      va_list args;
+      if (list[i] == err)
+	return 1;
+    }
 
-      fprintf (stderr, "libsoc-i2c-debug: ");
+  return 0;
+}
+
+/*
+ * Issue one I2C_RDWR ioctl, traced as a read if any of its messages read
+ */
+static int
+libsoc_i2c_rdwr (i2c * i2c, struct i2c_rdwr_ioctl_data *packets)
+{
+  uint64_t start = libsoc_io_begin (i2c->stats);
+  int i, ret, op = LS_TRACE_I2C_WRITE;
+  uint32_t len = 0;
 
-      va_start (args, format);
-      vfprintf (stderr, format, args);
-      va_end (args);
+  ret = i2c->backend->ioctl (i2c->fd, I2C_RDWR, (unsigned long) packets);
 
-      if (i2c == NULL)
+  if (__builtin_expect (start != 0, 0))
+    {
+      for (i = 0; i < packets->nmsgs; i++)
 	{
-	  fprintf (stderr, " (NULL, %s)", func);
+	  len += packets->msgs[i].len;
+
+	  if (packets->msgs[i].flags & I2C_M_RD)
+	    op = LS_TRACE_I2C_READ;
 	}
-      else
+
+      libsoc_io_end (start, i2c->stats, op,
+		     LIBSOC_TRACE_I2C_ID (i2c->bus, packets->msgs[0].addr),
+		     len, ret);
+    }
+
+  return ret;
+}
+
+/*
+ * Send a single transaction of one or more messages, resending it as the
+ * device's policy allows. A partial transfer fails the whole transaction,
+ * which is resent from its first message so repeated starts are kept.
+ */
+static int
+libsoc_i2c_xfer (i2c * i2c, struct i2c_msg *msgs, int num)
+{
+  struct i2c_rdwr_ioctl_data packets;
+  int ret, attempt = 0, backoff = i2c->policy.backoff;
+
+  while (1)
+    {
+      packets.msgs = msgs;
+      packets.nmsgs = num;
+
+      ret = libsoc_i2c_rdwr (i2c, &packets);
+
+      if (ret >= num)
+	return EXIT_SUCCESS;
+
+      // A short count is a bus fault rather than a device error, always
+      // worth resending while attempts remain
+      if (ret >= 0)
+	errno = EIO;
+      else if (!libsoc_i2c_retryable (i2c, errno))
+	return EXIT_FAILURE;
+
+      if (attempt >= i2c->policy.retries)
+	return EXIT_FAILURE;
+
+      attempt++;
+
+      libsoc_i2c_trace (__func__, i2c, "retrying message, attempt %d",
+			attempt);
+
+      if (backoff > 0)
 	{
-	  fprintf (stderr, " (i2c-%d, %d, %s)", i2c->bus,
-		   i2c->address, func);
+	  usleep (backoff);
+	  backoff *= 2;
 	}
+    }
+}
+
+/*
+ * Send a batch of independent transactions of group messages each in one
+ * ioctl. If the batch fails each transaction is resent on its own with its
+ * own retries rather than resending the whole batch.
+ */
+static int
+libsoc_i2c_transfer (i2c * i2c, struct i2c_msg *msgs, int num, int group)
+{
+  struct i2c_rdwr_ioctl_data packets;
+  int i, ret;
+
+  if (num <= group)
+    return libsoc_i2c_xfer (i2c, msgs, num);
+
+  packets.msgs = msgs;
+  packets.nmsgs = num;
 
-      fprintf (stderr, "\n");
+  ret = libsoc_i2c_rdwr (i2c, &packets);
+
+  if (ret >= num)
+    return EXIT_SUCCESS;
+
+  if (ret < 0 &&
+      (i2c->policy.retries == 0 || !libsoc_i2c_retryable (i2c, errno)))
+    return EXIT_FAILURE;
+
+  libsoc_i2c_debug (__func__, i2c, "batch failed, resending individually");
+
+  // Skip transactions the adapter reported as complete
+  for (i = ret > 0 ? ret - ret % group : 0; i < num; i += group)
+    {
+      if (libsoc_i2c_xfer (i2c, &msgs[i], num - i < group ? num - i : group)
+	  == EXIT_FAILURE)
+	return EXIT_FAILURE;
     }
-#endif
+
+  return EXIT_SUCCESS;
 }
 
 i2c *
@@ -59,27 +253,26 @@ libsoc_i2c_init (uint8_t i2c_bus, uint8_t i2c_address)
       return NULL;
     }
 
-  char path[40];
-
   i2c_dev->bus = i2c_bus;
   i2c_dev->address = i2c_address;
+  i2c_dev->async = NULL;
 
-  sprintf (path, "/dev/i2c-%d", i2c_dev->bus);
+  memset (&i2c_dev->policy, 0, sizeof (i2c_policy));
 
-  if (!file_valid (path))
-    {
-      libsoc_i2c_debug (__func__, i2c_dev, "%s not a vaild device", path);
-      goto error;
-    }
-
-  i2c_dev->fd = file_open (path, O_SYNC | O_RDWR);
+  i2c_dev->backend = current_backend;
+  i2c_dev->fd = i2c_dev->backend->open (i2c_bus);
 
   if (i2c_dev->fd < 0)
     {
-      libsoc_i2c_debug (__func__, i2c_dev, "%s could not be opened", path);
+      libsoc_i2c_debug (__func__, i2c_dev, "i2c-%d could not be opened",
+			i2c_bus);
       goto error;
     }
 
+  i2c_dev->stats = libsoc_stats_new (LS_STATS_I2C,
+				     LIBSOC_TRACE_I2C_ID (i2c_bus,
+							  i2c_address));
+
   return i2c_dev;
 
 error:
@@ -89,6 +282,162 @@ error:
   return NULL;
 }
 
+static void *
+__libsoc_i2c_worker_thread (void *void_worker)
+{
+  struct i2c_worker *worker = void_worker;
+  struct i2c_msg message;
+  struct i2c_async *async;
+  i2c_request *req;
+  uint64_t one = 1;
+
+  pthread_mutex_lock (&worker->lock);
+
+  while (1)
+    {
+      while (worker->head == NULL && !worker->stop)
+	pthread_cond_wait (&worker->queued, &worker->lock);
+
+      if (worker->head == NULL)
+	break;
+
+      req = worker->head;
+      worker->head = req->next;
+      if (worker->head == NULL)
+	worker->tail = NULL;
+
+      pthread_mutex_unlock (&worker->lock);
+
+      message.addr = req->i2c->address;
+      message.flags = req->read ? I2C_M_RD : 0;
+      message.len = req->len;
+      message.buf = req->buffer;
+
+      req->result = libsoc_i2c_xfer (req->i2c, &message, 1);
+
+      if (req->result == EXIT_FAILURE)
+	libsoc_i2c_debug (__func__, req->i2c, "async message failed");
+
+      pthread_mutex_lock (&worker->lock);
+
+      async = req->i2c->async;
+      req->next = NULL;
+
+      if (async->done_tail)
+	async->done_tail->next = req;
+      else
+	async->done_head = req;
+
+      async->done_tail = req;
+      async->pending--;
+
+      if (write (async->event_fd, &one, sizeof (one)) != sizeof (one))
+	libsoc_i2c_debug (__func__, req->i2c, "eventfd write failed");
+
+      pthread_cond_broadcast (&worker->completed);
+    }
+
+  pthread_mutex_unlock (&worker->lock);
+
+  return NULL;
+}
+
+static struct i2c_worker *
+libsoc_i2c_worker_get (uint8_t bus)
+{
+  struct i2c_worker *worker;
+
+  pthread_mutex_lock (&i2c_workers_lock);
+
+  worker = i2c_workers[bus];
+
+  if (worker == NULL)
+    {
+      worker = calloc (1, sizeof (struct i2c_worker));
+
+      if (worker == NULL)
+	goto out;
+
+      worker->bus = bus;
+
+      pthread_mutex_init (&worker->lock, NULL);
+      pthread_cond_init (&worker->queued, NULL);
+      pthread_cond_init (&worker->completed, NULL);
+
+      if (pthread_create (&worker->thread, NULL,
+			  __libsoc_i2c_worker_thread, worker) != 0)
+	{
+	  pthread_cond_destroy (&worker->completed);
+	  pthread_cond_destroy (&worker->queued);
+	  pthread_mutex_destroy (&worker->lock);
+	  free (worker);
+	  worker = NULL;
+	  goto out;
+	}
+
+      i2c_workers[bus] = worker;
+    }
+
+  worker->refcount++;
+
+out:
+  pthread_mutex_unlock (&i2c_workers_lock);
+
+  return worker;
+}
+
+static void
+libsoc_i2c_worker_put (struct i2c_worker *worker)
+{
+  pthread_mutex_lock (&i2c_workers_lock);
+
+  if (--worker->refcount > 0)
+    {
+      pthread_mutex_unlock (&i2c_workers_lock);
+      return;
+    }
+
+  i2c_workers[worker->bus] = NULL;
+
+  pthread_mutex_unlock (&i2c_workers_lock);
+
+  pthread_mutex_lock (&worker->lock);
+  worker->stop = 1;
+  pthread_cond_signal (&worker->queued);
+  pthread_mutex_unlock (&worker->lock);
+
+  pthread_join (worker->thread, NULL);
+
+  pthread_cond_destroy (&worker->completed);
+  pthread_cond_destroy (&worker->queued);
+  pthread_mutex_destroy (&worker->lock);
+  free (worker);
+}
+
+static void
+libsoc_i2c_async_free (i2c * i2c)
+{
+  struct i2c_async *async = i2c->async;
+
+  if (async == NULL)
+    return;
+
+  // Let any transfers still queued for this device finish first
+  pthread_mutex_lock (&async->worker->lock);
+
+  while (async->pending > 0)
+    pthread_cond_wait (&async->worker->completed, &async->worker->lock);
+
+  pthread_mutex_unlock (&async->worker->lock);
+
+  libsoc_i2c_worker_put (async->worker);
+
+  file_close (async->event_fd);
+  free (async);
+
+  i2c->async = NULL;
+}
+
 int
 libsoc_i2c_free (i2c * i2c)
 {
@@ -99,10 +448,14 @@ libsoc_i2c_free (i2c * i2c)
     }
 
   libsoc_i2c_debug (__func__, i2c, "freeing i2c device");
-  
-  if (file_close (i2c->fd) < 0)
+
+  libsoc_i2c_async_free (i2c);
+
+  if (i2c->backend->close (i2c->fd) < 0)
     return EXIT_FAILURE;
 
+  libsoc_stats_free (i2c->stats);
+
   free (i2c);
 
   return EXIT_SUCCESS;
@@ -111,10 +464,7 @@ libsoc_i2c_free (i2c * i2c)
 int 
 libsoc_i2c_ioctl(i2c * i2c, int num_messages)
 {
-   i2c->packets.msgs = i2c->messages;
-   i2c->packets.nmsgs = num_messages;
-
-   if (ioctl(i2c->fd, I2C_RDWR, &i2c->packets) < 0)
+   if (libsoc_i2c_xfer(i2c, i2c->messages, num_messages) == EXIT_FAILURE)
    {
       libsoc_i2c_debug(__func__, i2c, "message failed");
       perror ("libsoc-i2c-debug");
@@ -127,7 +477,7 @@ libsoc_i2c_ioctl(i2c * i2c, int num_messages)
 int
 libsoc_i2c_set_timeout(i2c * i2c, int timeout)
 {
-   if (ioctl(i2c->fd, I2C_TIMEOUT, timeout) < 0)
+   if (i2c->backend->ioctl(i2c->fd, I2C_TIMEOUT, timeout) < 0)
    {
       libsoc_i2c_debug(__func__, i2c, "setting timeout failed");
       perror ("libsoc-i2c-debug");
@@ -139,6 +489,35 @@ libsoc_i2c_set_timeout(i2c * i2c, int timeout)
    return EXIT_SUCCESS;
 }
 
+int
+libsoc_i2c_set_policy(i2c * i2c, i2c_policy * policy)
+{
+   if (i2c == NULL || policy == NULL)
+   {
+      libsoc_i2c_debug(__func__, i2c, "i2c | policy was NULL");
+      return EXIT_FAILURE;
+   }
+
+   if (policy->timeout >= 0 &&
+       libsoc_i2c_set_timeout(i2c, policy->timeout) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+
+   if (policy->kernel_retries >= 0 &&
+       i2c->backend->ioctl(i2c->fd, I2C_RETRIES, policy->kernel_retries) < 0)
+   {
+      libsoc_i2c_debug(__func__, i2c, "setting retries failed");
+      perror ("libsoc-i2c-debug");
+      return EXIT_FAILURE;
+   }
+
+   i2c->policy = *policy;
+
+   libsoc_i2c_debug(__func__, i2c, "policy set to %d retries, %dus backoff",
+                    policy->retries, policy->backoff);
+
+   return EXIT_SUCCESS;
+}
+
 int 
 libsoc_i2c_write (i2c * i2c, uint8_t * buffer, uint16_t len)
 { 
@@ -148,7 +527,7 @@ libsoc_i2c_write (i2c * i2c, uint8_t * buffer, uint16_t len)
       return EXIT_FAILURE;
     }
     
-      libsoc_i2c_debug(__func__, i2c, "Writing buffer of length %d", len);
+      libsoc_i2c_trace(__func__, i2c, "Writing buffer of length %d", len);
   
    i2c->messages[0].addr = i2c->address;
    i2c->messages[0].flags = 0;
@@ -167,7 +546,7 @@ libsoc_i2c_read (i2c * i2c, uint8_t * buffer, uint16_t len)
       return EXIT_FAILURE;
     }
     
-    libsoc_i2c_debug(__func__, i2c, "Reading buffer of length %d", len);
+    libsoc_i2c_trace(__func__, i2c, "Reading buffer of length %d", len);
   
    i2c->messages[0].addr = i2c->address;
    i2c->messages[0].flags = I2C_M_RD;
@@ -177,3 +556,585 @@ libsoc_i2c_read (i2c * i2c, uint8_t * buffer, uint16_t len)
    return libsoc_i2c_ioctl(i2c, 1);
 }
 
+
+#define I2C_EEPROM_MAX_TRANSFER 8192
+#define I2C_EEPROM_WRITE_TIMEOUT 10
+
+// Delay between ACK polls in microseconds when the policy has no backoff,
+// a write cycle takes milliseconds
+#define I2C_EEPROM_POLL_INTERVAL 200
+
+// Read chunks sent per I2C_RDWR, each takes an address and a data message
+#define I2C_EEPROM_READ_BATCH (I2C_RDWR_IOCTL_MAX_MSGS / 2)
+
+static int
+libsoc_i2c_eeprom_valid (i2c * i2c, i2c_eeprom * eeprom, uint8_t * buffer)
+{
+  if (i2c == NULL || eeprom == NULL || buffer == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "i2c | eeprom | buffer was NULL");
+      return 0;
+    }
+
+  if (eeprom->addr_len != 1 && eeprom->addr_len != 2)
+    {
+      libsoc_i2c_debug (__func__, i2c, "address length must be 1 or 2");
+      return 0;
+    }
+
+  if (eeprom->max_transfer && eeprom->max_transfer <= eeprom->addr_len)
+    {
+      libsoc_i2c_debug (__func__, i2c, "max transfer too small");
+      return 0;
+    }
+
+  return 1;
+}
+
+/*
+ * Work out the i2c address and memory address bytes for an offset, and
+ * how many bytes may be transferred before the memory address wraps
+ */
+static uint32_t
+libsoc_i2c_eeprom_address (i2c * i2c, i2c_eeprom * eeprom, uint32_t offset,
+			   uint16_t * addr, uint8_t * mem_addr)
+{
+  uint32_t block = 1 << (8 * eeprom->addr_len);
+
+  *addr = i2c->address | ((offset / block) & 0x7);
+
+  if (eeprom->addr_len == 2)
+    {
+      mem_addr[0] = (offset >> 8) & 0xff;
+      mem_addr[1] = offset & 0xff;
+    }
+  else
+    {
+      mem_addr[0] = offset & 0xff;
+    }
+
+  return block - (offset % block);
+}
+
+static uint64_t
+libsoc_i2c_now_ms ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Send a write, retrying while the EEPROM NAKs because it is busy with a
+ * previous write cycle. Using the next page write as the ACK poll keeps
+ * page writes back to back without a separate polling round trip. Polls
+ * are spaced out by the policy backoff so the bus is free for other
+ * devices during the cycle, and which errors mean busy comes from the
+ * policy, any other error fails the write. Once the deadline passes, or
+ * after a short transfer, the write is sent once more with the policy's
+ * own retries.
+ */
+static int
+libsoc_i2c_eeprom_xfer (i2c * i2c, struct i2c_msg *msg, int timeout)
+{
+  struct i2c_rdwr_ioctl_data packets;
+  uint64_t deadline = libsoc_i2c_now_ms () + timeout;
+  int ret, interval = i2c->policy.backoff;
+
+  if (interval <= 0)
+    interval = I2C_EEPROM_POLL_INTERVAL;
+
+  packets.msgs = msg;
+  packets.nmsgs = 1;
+
+  while (timeout && libsoc_i2c_now_ms () <= deadline)
+    {
+      ret = libsoc_i2c_rdwr (i2c, &packets);
+
+      if (ret > 0)
+	return EXIT_SUCCESS;
+
+      // A short count was ACKed, so it is resent below like a timed out
+      // poll, any error the policy doesn't retry fails the write outright
+      if (ret == 0)
+	break;
+
+      if (!libsoc_i2c_retryable (i2c, errno))
+	{
+	  libsoc_i2c_debug (__func__, i2c, "write failed");
+	  perror ("libsoc-i2c-debug");
+	  return EXIT_FAILURE;
+	}
+
+      usleep (interval);
+    }
+
+  if (libsoc_i2c_xfer (i2c, msg, 1) == EXIT_FAILURE)
+    {
+      libsoc_i2c_debug (__func__, i2c, "write cycle did not complete");
+      perror ("libsoc-i2c-debug");
+      return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_i2c_eeprom_read (i2c * i2c, i2c_eeprom * eeprom, uint32_t offset,
+			uint8_t * buffer, uint32_t len)
+{
+  struct i2c_msg messages[I2C_EEPROM_READ_BATCH * 2];
+  uint8_t mem_addrs[I2C_EEPROM_READ_BATCH][2];
+  uint32_t max, chunk;
+  uint16_t addr;
+  int n;
+
+  if (!libsoc_i2c_eeprom_valid (i2c, eeprom, buffer))
+    return EXIT_FAILURE;
+
+  libsoc_i2c_trace (__func__, i2c, "Reading %u bytes from EEPROM offset %u",
+		    len, offset);
+
+  max = eeprom->max_transfer ? eeprom->max_transfer : I2C_EEPROM_MAX_TRANSFER;
+
+  while (len > 0)
+    {
+      // Batch as many chunks as possible into a single ioctl
+      for (n = 0; n < I2C_EEPROM_READ_BATCH && len > 0; n++)
+	{
+	  chunk = libsoc_i2c_eeprom_address (i2c, eeprom, offset, &addr,
+					     mem_addrs[n]);
+
+	  if (chunk > max)
+	    chunk = max;
+
+	  if (chunk > len)
+	    chunk = len;
+
+	  messages[n * 2].addr = addr;
+	  messages[n * 2].flags = 0;
+	  messages[n * 2].len = eeprom->addr_len;
+	  messages[n * 2].buf = mem_addrs[n];
+
+	  messages[n * 2 + 1].addr = addr;
+	  messages[n * 2 + 1].flags = I2C_M_RD;
+	  messages[n * 2 + 1].len = chunk;
+	  messages[n * 2 + 1].buf = buffer;
+
+	  offset += chunk;
+	  buffer += chunk;
+	  len -= chunk;
+	}
+
+      if (libsoc_i2c_transfer (i2c, messages, n * 2, 2) == EXIT_FAILURE)
+	{
+	  libsoc_i2c_debug (__func__, i2c, "EEPROM read failed");
+	  perror ("libsoc-i2c-debug");
+	  return EXIT_FAILURE;
+	}
+    }
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_i2c_eeprom_write (i2c * i2c, i2c_eeprom * eeprom, uint32_t offset,
+			 uint8_t * buffer, uint32_t len)
+{
+  struct i2c_msg msg;
+  uint8_t *tx;
+  uint32_t max, chunk;
+  int timeout;
+
+  if (!libsoc_i2c_eeprom_valid (i2c, eeprom, buffer))
+    return EXIT_FAILURE;
+
+  libsoc_i2c_trace (__func__, i2c, "Writing %u bytes to EEPROM offset %u",
+		    len, offset);
+
+  max = eeprom->max_transfer ? eeprom->max_transfer : I2C_EEPROM_MAX_TRANSFER;
+  max -= eeprom->addr_len;
+
+  if (eeprom->page_size && eeprom->page_size < max)
+    max = eeprom->page_size;
+
+  // Devices without pages have no write cycle to wait for
+  timeout = 0;
+
+  if (eeprom->page_size)
+    {
+      timeout = eeprom->write_timeout ? eeprom->write_timeout :
+	I2C_EEPROM_WRITE_TIMEOUT;
+    }
+
+  tx = malloc (eeprom->addr_len + max);
+
+  if (tx == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "failed to allocate memory");
+      return EXIT_FAILURE;
+    }
+
+  msg.flags = 0;
+  msg.buf = tx;
+
+  while (len > 0)
+    {
+      chunk = libsoc_i2c_eeprom_address (i2c, eeprom, offset, &msg.addr, tx);
+
+      if (eeprom->page_size &&
+	  chunk > eeprom->page_size - (offset % eeprom->page_size))
+	chunk = eeprom->page_size - (offset % eeprom->page_size);
+
+      if (chunk > max)
+	chunk = max;
+
+      if (chunk > len)
+	chunk = len;
+
+      memcpy (tx + eeprom->addr_len, buffer, chunk);
+      msg.len = eeprom->addr_len + chunk;
+
+      if (libsoc_i2c_eeprom_xfer (i2c, &msg, timeout) == EXIT_FAILURE)
+	goto error;
+
+      offset += chunk;
+      buffer += chunk;
+      len -= chunk;
+    }
+
+  // ACK poll with an address only write for the final write cycle
+  if (timeout)
+    {
+      msg.len = eeprom->addr_len;
+
+      if (libsoc_i2c_eeprom_xfer (i2c, &msg, timeout) == EXIT_FAILURE)
+	goto error;
+    }
+
+  free (tx);
+
+  return EXIT_SUCCESS;
+
+error:
+
+  free (tx);
+
+  return EXIT_FAILURE;
+}
+
+#define I2C_SCAN_FIRST 0x03
+#define I2C_SCAN_LAST  0x77
+
+static int
+libsoc_i2c_scan_probe (const i2c_backend * backend, int fd, uint8_t address,
+		       unsigned long funcs)
+{
+  struct i2c_smbus_ioctl_data args;
+  union i2c_smbus_data data;
+
+  if (backend->ioctl (fd, I2C_SLAVE, address) < 0)
+    {
+      // Bound to a kernel driver, so something is there
+      return errno == EBUSY;
+    }
+
+  /*
+   * Quick write is the cheapest probe, but some EEPROMs treat it as a
+   * write, so use read byte for the common EEPROM address ranges like
+   * i2cdetect does
+   */
+  if ((funcs & I2C_FUNC_SMBUS_QUICK) &&
+      !((address >= 0x30 && address <= 0x37) ||
+        (address >= 0x50 && address <= 0x5f)))
+    {
+      args.read_write = I2C_SMBUS_WRITE;
+      args.command = 0;
+      args.size = I2C_SMBUS_QUICK;
+      args.data = NULL;
+    }
+  else if (funcs & I2C_FUNC_SMBUS_READ_BYTE)
+    {
+      args.read_write = I2C_SMBUS_READ;
+      args.command = 0;
+      args.size = I2C_SMBUS_BYTE;
+      args.data = &data;
+    }
+  else
+    {
+      return 0;
+    }
+
+  return backend->ioctl (fd, I2C_SMBUS, (unsigned long) &args) >= 0;
+}
+
+static void *
+__libsoc_i2c_scan_thread (void *void_scan)
+{
+  i2c_scan *scan = void_scan;
+  const i2c_backend *backend = current_backend;
+  unsigned long funcs;
+  int fd, i, all = 1;
+
+  memset (scan->present, 0, sizeof (scan->present));
+  scan->result = EXIT_FAILURE;
+
+  for (i = 0; i < sizeof (scan->probe); i++)
+    {
+      if (scan->probe[i])
+	all = 0;
+    }
+
+  fd = backend->open (scan->bus);
+
+  if (fd < 0)
+    return NULL;
+
+  if (backend->ioctl (fd, I2C_FUNCS, (unsigned long) &funcs) < 0)
+    {
+      perror ("libsoc-i2c-debug");
+      backend->close (fd);
+      return NULL;
+    }
+
+  for (i = I2C_SCAN_FIRST; i <= I2C_SCAN_LAST; i++)
+    {
+      if (!all && !(scan->probe[i / 8] & (1 << (i % 8))))
+	continue;
+
+      if (libsoc_i2c_scan_probe (backend, fd, i, funcs))
+	scan->present[i / 8] |= 1 << (i % 8);
+    }
+
+  backend->close (fd);
+
+  scan->result = EXIT_SUCCESS;
+
+  return NULL;
+}
+
+int
+libsoc_i2c_scan (i2c_scan * scans, int num_buses)
+{
+  pthread_t *threads;
+  int *started;
+  int i, ret = EXIT_SUCCESS;
+
+  if (scans == NULL || num_buses <= 0)
+    {
+      libsoc_i2c_debug (__func__, NULL, "no buses to scan");
+      return EXIT_FAILURE;
+    }
+
+  threads = calloc (num_buses, sizeof (pthread_t));
+  started = calloc (num_buses, sizeof (int));
+
+  if (threads == NULL || started == NULL)
+    {
+      libsoc_i2c_debug (__func__, NULL, "failed to allocate memory");
+      free (threads);
+      free (started);
+      return EXIT_FAILURE;
+    }
+
+  // Scan the last bus on the calling thread, or any bus whose thread
+  // could not be started
+  for (i = 0; i < num_buses - 1; i++)
+    {
+      started[i] = pthread_create (&threads[i], NULL,
+				   __libsoc_i2c_scan_thread, &scans[i]) == 0;
+    }
+
+  for (i = 0; i < num_buses; i++)
+    {
+      if (!started[i])
+	__libsoc_i2c_scan_thread (&scans[i]);
+    }
+
+  for (i = 0; i < num_buses; i++)
+    {
+      if (started[i])
+	pthread_join (threads[i], NULL);
+
+      libsoc_i2c_debug (__func__, NULL, "scan of i2c-%d %s", scans[i].bus,
+			scans[i].result == EXIT_SUCCESS ? "done" : "failed");
+
+      if (scans[i].result != EXIT_SUCCESS)
+	ret = EXIT_FAILURE;
+    }
+
+  free (threads);
+  free (started);
+
+  return ret;
+}
+
+int
+libsoc_i2c_scan_present (i2c_scan * scan, uint8_t address)
+{
+  if (scan == NULL || address > 127)
+    return 0;
+
+  return (scan->present[address / 8] >> (address % 8)) & 1;
+}
+
+void
+libsoc_i2c_set_backend (const i2c_backend * new_backend)
+{
+  current_backend = new_backend ? new_backend : &i2c_kernel_backend;
+}
+
+int
+libsoc_i2c_async_init (i2c * i2c)
+{
+  struct i2c_async *async;
+
+  if (i2c == NULL)
+    {
+      libsoc_i2c_debug (__func__, NULL, "i2c was not valid");
+      return EXIT_FAILURE;
+    }
+
+  if (i2c->async != NULL)
+    return EXIT_SUCCESS;
+
+  libsoc_i2c_debug (__func__, i2c, "enabling async transfers");
+
+  async = calloc (1, sizeof (struct i2c_async));
+
+  if (async == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "failed to allocate memory");
+      return EXIT_FAILURE;
+    }
+
+  async->event_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  if (async->event_fd < 0)
+    {
+      libsoc_i2c_debug (__func__, i2c, "failed to create eventfd");
+      perror ("libsoc-i2c-debug");
+      free (async);
+      return EXIT_FAILURE;
+    }
+
+  async->worker = libsoc_i2c_worker_get (i2c->bus);
+
+  if (async->worker == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "failed to start bus worker");
+      file_close (async->event_fd);
+      free (async);
+      return EXIT_FAILURE;
+    }
+
+  i2c->async = async;
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_i2c_async_get_fd (i2c * i2c)
+{
+  if (i2c == NULL || i2c->async == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "async was not enabled");
+      return -1;
+    }
+
+  return i2c->async->event_fd;
+}
+
+static int
+libsoc_i2c_submit (i2c * i2c, i2c_request * req, uint8_t * buffer,
+		   uint16_t len, int rd)
+{
+  struct i2c_worker *worker;
+
+  if (i2c == NULL || req == NULL || buffer == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "i2c | req | buffer was NULL");
+      return EXIT_FAILURE;
+    }
+
+  if (i2c->async == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "async was not enabled");
+      return EXIT_FAILURE;
+    }
+
+  req->i2c = i2c;
+  req->buffer = buffer;
+  req->len = len;
+  req->read = rd;
+  req->result = EXIT_FAILURE;
+  req->next = NULL;
+
+  worker = i2c->async->worker;
+
+  pthread_mutex_lock (&worker->lock);
+
+  if (worker->tail)
+    worker->tail->next = req;
+  else
+    worker->head = req;
+
+  worker->tail = req;
+  i2c->async->pending++;
+
+  pthread_cond_signal (&worker->queued);
+  pthread_mutex_unlock (&worker->lock);
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_i2c_submit_write (i2c * i2c, i2c_request * req, uint8_t * buffer,
+			 uint16_t len)
+{
+  libsoc_i2c_trace (__func__, i2c, "Submitting write of length %d", len);
+
+  return libsoc_i2c_submit (i2c, req, buffer, len, 0);
+}
+
+int
+libsoc_i2c_submit_read (i2c * i2c, i2c_request * req, uint8_t * buffer,
+			uint16_t len)
+{
+  libsoc_i2c_trace (__func__, i2c, "Submitting read of length %d", len);
+
+  return libsoc_i2c_submit (i2c, req, buffer, len, 1);
+}
+
+i2c_request *
+libsoc_i2c_complete (i2c * i2c)
+{
+  struct i2c_async *async;
+  i2c_request *done;
+  uint64_t count;
+
+  if (i2c == NULL || i2c->async == NULL)
+    {
+      libsoc_i2c_debug (__func__, i2c, "async was not enabled");
+      return NULL;
+    }
+
+  async = i2c->async;
+
+  // Clear the eventfd before taking the list so a completion racing with
+  // us leaves the fd readable rather than being lost
+  if (read (async->event_fd, &count, sizeof (count)) < 0)
+    count = 0;
+
+  pthread_mutex_lock (&async->worker->lock);
+
+  done = async->done_head;
+  async->done_head = NULL;
+  async->done_tail = NULL;
+
+  pthread_mutex_unlock (&async->worker->lock);
+
+  return done;
+}
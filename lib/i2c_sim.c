@@ -0,0 +1,497 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "libsoc_i2c.h"
+#include "libsoc_i2c_sim.h"
+#include "libsoc_debug.h"
+#include "libsoc_file.h"
+
+/*
+ * In process i2c backend emulating EEPROMs and register files, so the
+ * transfer paths in i2c.c can be tested and benchmarked without hardware.
+ */
+
+struct sim_device {
+  uint8_t bus;
+  uint8_t address;
+  i2c_sim_device desc;
+  uint8_t *memory;
+  uint32_t pointer;
+  int busy;
+  int fail;
+  struct sim_device *next;
+};
+
+struct sim_fd {
+  int fd;
+  uint8_t bus;
+  uint16_t slave;
+  struct sim_fd *next;
+};
+
+static struct sim_device *sim_devices;
+static struct sim_fd *sim_fds;
+static unsigned long sim_ioctls;
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct sim_device *
+sim_find_device (uint8_t bus, uint16_t address)
+{
+  struct sim_device *dev;
+
+  for (dev = sim_devices; dev; dev = dev->next)
+    {
+      if (dev->bus == bus && dev->address == address)
+	return dev;
+    }
+
+  return NULL;
+}
+
+static struct sim_fd *
+sim_find_fd (int fd)
+{
+  struct sim_fd *sfd;
+
+  for (sfd = sim_fds; sfd; sfd = sfd->next)
+    {
+      if (sfd->fd == fd)
+	return sfd;
+    }
+
+  return NULL;
+}
+
+/*
+ * Check a device is present and willing to ACK, consuming one pending
+ * failure or write cycle NAK if not
+ */
+static int
+sim_ack (struct sim_device *dev)
+{
+  if (dev == NULL)
+    {
+      errno = ENXIO;
+      return 0;
+    }
+
+  if (dev->fail > 0)
+    {
+      dev->fail--;
+      errno = EREMOTEIO;
+      return 0;
+    }
+
+  if (dev->busy > 0)
+    {
+      dev->busy--;
+      errno = ENXIO;
+      return 0;
+    }
+
+  return 1;
+}
+
+static void
+sim_write (struct sim_device *dev, uint8_t * buf, uint16_t len)
+{
+  uint32_t page = dev->desc.page_size;
+  uint16_t i;
+
+  if (len < dev->desc.addr_len)
+    return;
+
+  if (dev->desc.addr_len == 2)
+    dev->pointer = (buf[0] << 8) | buf[1];
+  else
+    dev->pointer = buf[0];
+
+  dev->pointer %= dev->desc.size;
+
+  buf += dev->desc.addr_len;
+  len -= dev->desc.addr_len;
+
+  for (i = 0; i < len; i++)
+    {
+      dev->memory[dev->pointer] = buf[i];
+
+      // EEPROMs roll over within the current page
+      if (dev->desc.type == I2C_SIM_EEPROM && page)
+	dev->pointer = (dev->pointer / page) * page +
+	  (dev->pointer + 1) % page;
+      else
+	dev->pointer = (dev->pointer + 1) % dev->desc.size;
+    }
+
+  if (dev->desc.type == I2C_SIM_EEPROM && len > 0)
+    dev->busy = dev->desc.write_cycle;
+}
+
+static void
+sim_read (struct sim_device *dev, uint8_t * buf, uint16_t len)
+{
+  uint16_t i;
+
+  for (i = 0; i < len; i++)
+    {
+      buf[i] = dev->memory[dev->pointer];
+      dev->pointer = (dev->pointer + 1) % dev->desc.size;
+    }
+}
+
+static int
+sim_rdwr (struct sim_fd *sfd, struct i2c_rdwr_ioctl_data *packets)
+{
+  struct sim_device *dev;
+  struct i2c_msg *msg;
+  int i;
+
+  if (packets->nmsgs > I2C_RDWR_IOCTL_MAX_MSGS)
+    {
+      errno = EINVAL;
+      return -1;
+    }
+
+  for (i = 0; i < packets->nmsgs; i++)
+    {
+      msg = &packets->msgs[i];
+      dev = sim_find_device (sfd->bus, msg->addr);
+
+      if (!sim_ack (dev))
+	return -1;
+
+      if (msg->flags & I2C_M_RD)
+	sim_read (dev, msg->buf, msg->len);
+      else
+	sim_write (dev, msg->buf, msg->len);
+    }
+
+  return packets->nmsgs;
+}
+
+static int
+sim_smbus (struct sim_fd *sfd, struct i2c_smbus_ioctl_data *args)
+{
+  struct sim_device *dev = sim_find_device (sfd->bus, sfd->slave);
+  uint8_t buf[4];
+
+  if (!sim_ack (dev))
+    return -1;
+
+  buf[0] = args->command;
+  buf[1] = 0;
+
+  switch (args->size)
+    {
+    case I2C_SMBUS_QUICK:
+      break;
+
+    case I2C_SMBUS_BYTE:
+      if (args->read_write == I2C_SMBUS_READ)
+	sim_read (dev, &args->data->byte, 1);
+      else
+	sim_write (dev, buf, dev->desc.addr_len);
+      break;
+
+    case I2C_SMBUS_BYTE_DATA:
+      if (args->read_write == I2C_SMBUS_READ)
+	{
+	  sim_write (dev, buf, dev->desc.addr_len);
+	  sim_read (dev, &args->data->byte, 1);
+	}
+      else
+	{
+	  buf[dev->desc.addr_len] = args->data->byte;
+	  sim_write (dev, buf, dev->desc.addr_len + 1);
+	}
+      break;
+
+    case I2C_SMBUS_WORD_DATA:
+      // SMBus words are sent low byte first
+      if (args->read_write == I2C_SMBUS_READ)
+	{
+	  sim_write (dev, buf, dev->desc.addr_len);
+	  sim_read (dev, &buf[2], 2);
+	  args->data->word = buf[2] | (buf[3] << 8);
+	}
+      else
+	{
+	  buf[dev->desc.addr_len] = args->data->word & 0xff;
+	  buf[dev->desc.addr_len + 1] = args->data->word >> 8;
+	  sim_write (dev, buf, dev->desc.addr_len + 2);
+	}
+      break;
+
+    default:
+      errno = EOPNOTSUPP;
+      return -1;
+    }
+
+  return 0;
+}
+
+static int
+sim_open (uint8_t bus)
+{
+  struct sim_device *dev;
+  struct sim_fd *sfd;
+
+  pthread_mutex_lock (&sim_lock);
+
+  // A bus only exists once a device has been added to it
+  for (dev = sim_devices; dev; dev = dev->next)
+    {
+      if (dev->bus == bus)
+	break;
+    }
+
+  if (dev == NULL)
+    {
+      pthread_mutex_unlock (&sim_lock);
+      libsoc_debug (__func__, "no simulated devices on i2c-%d", bus);
+      return -1;
+    }
+
+  sfd = calloc (1, sizeof (struct sim_fd));
+
+  if (sfd == NULL)
+    {
+      pthread_mutex_unlock (&sim_lock);
+      return -1;
+    }
+
+  // Back each bus with a real fd so it can't collide with other files
+  sfd->fd = file_open ("/dev/null", O_RDWR | O_CLOEXEC);
+
+  if (sfd->fd < 0)
+    {
+      pthread_mutex_unlock (&sim_lock);
+      free (sfd);
+      return -1;
+    }
+
+  sfd->bus = bus;
+  sfd->next = sim_fds;
+  sim_fds = sfd;
+
+  pthread_mutex_unlock (&sim_lock);
+
+  return sfd->fd;
+}
+
+static int
+sim_close (int fd)
+{
+  struct sim_fd **sfd, *tmp;
+
+  pthread_mutex_lock (&sim_lock);
+
+  for (sfd = &sim_fds; *sfd; sfd = &(*sfd)->next)
+    {
+      if ((*sfd)->fd == fd)
+	{
+	  tmp = *sfd;
+	  *sfd = tmp->next;
+	  free (tmp);
+	  break;
+	}
+    }
+
+  pthread_mutex_unlock (&sim_lock);
+
+  return file_close (fd);
+}
+
+static int
+sim_ioctl (int fd, unsigned long request, unsigned long arg)
+{
+  struct sim_fd *sfd;
+  int ret = 0;
+
+  pthread_mutex_lock (&sim_lock);
+
+  sfd = sim_find_fd (fd);
+
+  if (sfd == NULL)
+    {
+      pthread_mutex_unlock (&sim_lock);
+      errno = EBADF;
+      return -1;
+    }
+
+  switch (request)
+    {
+    case I2C_RDWR:
+      sim_ioctls++;
+      ret = sim_rdwr (sfd, (struct i2c_rdwr_ioctl_data *) arg);
+      break;
+
+    case I2C_SMBUS:
+      sim_ioctls++;
+      ret = sim_smbus (sfd, (struct i2c_smbus_ioctl_data *) arg);
+      break;
+
+    case I2C_SLAVE:
+    case I2C_SLAVE_FORCE:
+      sfd->slave = arg;
+      break;
+
+    case I2C_FUNCS:
+      *(unsigned long *) arg = I2C_FUNC_I2C | I2C_FUNC_SMBUS_QUICK |
+	I2C_FUNC_SMBUS_BYTE | I2C_FUNC_SMBUS_BYTE_DATA |
+	I2C_FUNC_SMBUS_WORD_DATA;
+      break;
+
+    case I2C_TIMEOUT:
+    case I2C_RETRIES:
+      break;
+
+    default:
+      errno = ENOTTY;
+      ret = -1;
+      break;
+    }
+
+  pthread_mutex_unlock (&sim_lock);
+
+  return ret;
+}
+
+static const i2c_backend sim_backend = {
+  .open = sim_open,
+  .close = sim_close,
+  .ioctl = sim_ioctl,
+};
+
+int
+libsoc_i2c_sim_enable ()
+{
+  libsoc_debug (__func__, "enabling i2c simulator");
+
+  pthread_mutex_lock (&sim_lock);
+  sim_ioctls = 0;
+  pthread_mutex_unlock (&sim_lock);
+
+  libsoc_i2c_set_backend (&sim_backend);
+
+  return EXIT_SUCCESS;
+}
+
+void
+libsoc_i2c_sim_disable ()
+{
+  struct sim_device *dev;
+
+  libsoc_debug (__func__, "disabling i2c simulator");
+
+  libsoc_i2c_set_backend (NULL);
+
+  pthread_mutex_lock (&sim_lock);
+
+  while (sim_devices)
+    {
+      dev = sim_devices;
+      sim_devices = dev->next;
+      free (dev->memory);
+      free (dev);
+    }
+
+  pthread_mutex_unlock (&sim_lock);
+}
+
+int
+libsoc_i2c_sim_add (uint8_t bus, uint8_t address, i2c_sim_device *device)
+{
+  struct sim_device *dev;
+
+  if (device == NULL || device->size == 0 || address > 127 ||
+      (device->addr_len != 1 && device->addr_len != 2))
+    {
+      libsoc_debug (__func__, "invalid simulated device");
+      return EXIT_FAILURE;
+    }
+
+  dev = calloc (1, sizeof (struct sim_device));
+
+  if (dev == NULL)
+    return EXIT_FAILURE;
+
+  dev->memory = calloc (1, device->size);
+
+  if (dev->memory == NULL)
+    {
+      free (dev);
+      return EXIT_FAILURE;
+    }
+
+  dev->bus = bus;
+  dev->address = address;
+  dev->desc = *device;
+
+  pthread_mutex_lock (&sim_lock);
+
+  if (sim_find_device (bus, address))
+    {
+      pthread_mutex_unlock (&sim_lock);
+      libsoc_debug (__func__, "i2c-%d address %d already simulated", bus,
+		    address);
+      free (dev->memory);
+      free (dev);
+      return EXIT_FAILURE;
+    }
+
+  dev->next = sim_devices;
+  sim_devices = dev;
+
+  pthread_mutex_unlock (&sim_lock);
+
+  return EXIT_SUCCESS;
+}
+
+uint8_t *
+libsoc_i2c_sim_memory (uint8_t bus, uint8_t address)
+{
+  struct sim_device *dev;
+
+  pthread_mutex_lock (&sim_lock);
+  dev = sim_find_device (bus, address);
+  pthread_mutex_unlock (&sim_lock);
+
+  return dev ? dev->memory : NULL;
+}
+
+int
+libsoc_i2c_sim_fail (uint8_t bus, uint8_t address, int count)
+{
+  struct sim_device *dev;
+
+  pthread_mutex_lock (&sim_lock);
+
+  dev = sim_find_device (bus, address);
+
+  if (dev)
+    dev->fail = count;
+
+  pthread_mutex_unlock (&sim_lock);
+
+  return dev ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+unsigned long
+libsoc_i2c_sim_ioctls ()
+{
+  unsigned long count;
+
+  pthread_mutex_lock (&sim_lock);
+  count = sim_ioctls;
+  pthread_mutex_unlock (&sim_lock);
+
+  return count;
+}
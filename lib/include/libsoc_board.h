@@ -7,16 +7,110 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "libsoc_conffile.h"
+#include "libsoc_spi.h"
+#include "libsoc_i2c.h"
+#include "libsoc_pwm.h"
+
+/**
+ * \def BOARD_NAME_MAX
+ * \brief size of the name of a board resource, longer names are ignored
+ */
+
+#define BOARD_NAME_MAX 32
+
+/**
+ * \struct board_spi
+ * \brief a named spidev device from the [SPI] section of the board config
+ * \param char name[] - the name of the device
+ * \param char path[] - the device path, like "/dev/spidev1.0"
+ * \param uint16_t device - the spidev device number
+ * \param uint8_t chip_select - the chip select number
+ * \param spi_mode mode - default mode, MODE_ERROR if not configured
+ * \param uint32_t speed - default speed in Hz, 0 if not configured
+ */
+
+typedef struct {
+  char name[BOARD_NAME_MAX];
+  char path[32];
+  uint16_t device;
+  uint8_t chip_select;
+  spi_mode mode;
+  uint32_t speed;
+} board_spi;
+
+/**
+ * \struct board_i2c
+ * \brief a named i2c bus or device from the [I2C] section of the board
+ *  config
+ * \param char name[] - the name of the bus or device
+ * \param char path[] - the bus device path, like "/dev/i2c-1"
+ * \param uint8_t bus - the bus number
+ * \param uint8_t address - the 7 bit device address, 0 if not configured
+ */
+
+typedef struct {
+  char name[BOARD_NAME_MAX];
+  char path[32];
+  uint8_t bus;
+  uint8_t address;
+} board_i2c;
+
+/**
+ * \struct board_pwm
+ * \brief a named pwm from the [PWM] section of the board config
+ * \param char name[] - the name of the pwm
+ * \param char path[] - the pwm sysfs directory, like
+ *  "/sys/class/pwm/pwmchip0/pwm1"
+ * \param unsigned int chip - the pwm chip number
+ * \param unsigned int num - the pwm number within the chip
+ * \param unsigned int period - default period in nanoseconds, 0 if not
+ *  configured
+ * \param pwm_polarity polarity - default polarity, POLARITY_ERROR if not
+ *  configured
+ */
+
+typedef struct {
+  char name[BOARD_NAME_MAX];
+  char path[64];
+  unsigned int chip;
+  unsigned int num;
+  unsigned int period;
+  pwm_polarity polarity;
+} board_pwm;
 
 /**
  * \struct board_config
  * \brief a struct to hold board specific information
- * \param conf* - the board config file
+ * \param const void *cache - the mapped binary cache of the board config
+ *  file, NULL when the config file was parsed
+ * \param size_t cache_len - length of the mapped cache
+ * \param board_spi* spi - the resolved [SPI] section sorted by name
+ * \param unsigned int num_spi - number of spi entries
+ * \param board_i2c* i2c - the resolved [I2C] section sorted by name
+ * \param unsigned int num_i2c - number of i2c entries
+ * \param board_pwm* pwm - the resolved [PWM] section sorted by name
+ * \param unsigned int num_pwm - number of pwm entries
+ * \param void *resources - holds the resolved sections of a parsed config
+ * \param conffile *parsed - private, use libsoc_board_conf
+ * \param char *path - private, the board config file path
  */
 
 typedef struct {
-  conffile *conf;
+  const void *cache;
+  size_t cache_len;
+  const board_spi *spi;
+  unsigned int num_spi;
+  const board_i2c *i2c;
+  unsigned int num_i2c;
+  const board_pwm *pwm;
+  unsigned int num_pwm;
+  void *resources;
+  conffile *parsed;
+  char *path;
 } board_config;
 
 /**
@@ -46,6 +140,95 @@ void libsoc_board_free(board_config *config);
 
 int libsoc_board_gpio_id(board_config *config, const char* pin);
 
+/**
+ * \fn const char* libsoc_board_get(board_config *config, const char *sectname, const char *key, const char *defval)
+ * \brief find a value in the board config, whether it was parsed or loaded
+ *  from the cache
+ * \param board_config* config - valid pointer to board_config
+ * \param char* sectname - the section name like "board"
+ * \param char* key - the key within the section
+ * \param char* defval - returned if the key is not found
+ * \return the value or defval
+ */
+
+const char *libsoc_board_get(board_config *config, const char *sectname,
+  const char *key, const char *defval);
+
+/**
+ * \fn conffile* libsoc_board_conf(board_config *config)
+ * \brief get the parsed board config file, a config loaded from the cache
+ *  is parsed on the first call
+ * \param board_config* config - valid pointer to board_config
+ * \return the parsed config, valid until the config is freed, or NULL
+ */
+
+conffile *libsoc_board_conf(board_config *config);
+
+/**
+ * \fn const board_spi* libsoc_board_spi(board_config *config, const char *name)
+ * \brief find a named spidev device in the [SPI] section, entries are
+ *  "device.chip_select [mode [speed]]"
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the device like "FLASH"
+ * \return the resolved device, valid until the config is freed, or NULL
+ */
+
+const board_spi *libsoc_board_spi(board_config *config, const char *name);
+
+/**
+ * \fn const board_i2c* libsoc_board_i2c(board_config *config, const char *name)
+ * \brief find a named i2c bus or device in the [I2C] section, entries are
+ *  "bus [address]"
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the bus or device like "EEPROM"
+ * \return the resolved bus, valid until the config is freed, or NULL
+ */
+
+const board_i2c *libsoc_board_i2c(board_config *config, const char *name);
+
+/**
+ * \fn const board_pwm* libsoc_board_pwm(board_config *config, const char *name)
+ * \brief find a named pwm in the [PWM] section, entries are
+ *  "chip.num [period [normal|inversed]]"
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the pwm like "BACKLIGHT"
+ * \return the resolved pwm, valid until the config is freed, or NULL
+ */
+
+const board_pwm *libsoc_board_pwm(board_config *config, const char *name);
+
+/**
+ * \fn spi* libsoc_board_spi_init(board_config *config, const char *name)
+ * \brief open a named spidev device and apply its default mode and speed
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the device
+ * \return pointer to spi* on success NULL on fail
+ */
+
+spi *libsoc_board_spi_init(board_config *config, const char *name);
+
+/**
+ * \fn i2c* libsoc_board_i2c_init(board_config *config, const char *name)
+ * \brief open a named i2c device at its configured address
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the device
+ * \return pointer to i2c* on success NULL on fail
+ */
+
+i2c *libsoc_board_i2c_init(board_config *config, const char *name);
+
+/**
+ * \fn pwm* libsoc_board_pwm_request(board_config *config, const char *name, shared_mode mode)
+ * \brief request a named pwm and apply its default polarity and period
+ * \param board_config* config - valid pointer to board_config
+ * \param char* name - the name of the pwm
+ * \param shared_mode mode - mode for opening the pwm
+ * \return pointer to pwm* on success NULL on fail
+ */
+
+pwm *libsoc_board_pwm_request(board_config *config, const char *name,
+  shared_mode mode);
+
 #ifdef __cplusplus
 }
 #endif
@@ -12,12 +12,14 @@ extern "C" {
  * \brief a linked list of key-value pairs
  * \param char *key - the name of the key
  * \param char *val - the value of the key
+ * \param unsigned int hash - hash of the key
  * \param keyval* - the next key-value pair
  */
 
 typedef struct keyval {
   char *key;
   char *val;
+  unsigned int hash;
   struct keyval *next;
 } keyval;
 
@@ -26,12 +28,17 @@ typedef struct keyval {
  * \brief Contains the key-value pairs in a given section
  * \param char *name - the section name
  * \param keyval *settings - the key-value pairs for the section
+ * \param keyval **table - open addressed hash table of the settings, built
+ *  when the file is loaded
+ * \param unsigned int table_mask - size of the table minus one
  * \param section* - the next section in the list
  */
 
 typedef struct section {
   char name[16];
   keyval *settings;
+  keyval **table;
+  unsigned int table_mask;
   struct section *next;
 } section;
 
@@ -54,7 +61,8 @@ conffile* conffile_load(const char *path);
 
 /**
  * \fn conffile *conffile_free(conffile*)
- * \brief Frees memory allocated in conffile struct
+ * \brief Frees a loaded conffile, the struct, its sections, settings and
+ *  strings are all one allocation
  */
 void conffile_free(conffile *conf);
 
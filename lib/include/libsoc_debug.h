@@ -7,9 +7,35 @@
 extern "C" {
 #endif
 
+/**
+ * \def LIBSOC_DEBUG_OFF
+ * \brief debug levels, INFO prints setup, teardown and failures, TRACE
+ *  also prints every transfer and level change
+ */
+
+#define LIBSOC_DEBUG_OFF 0
+#define LIBSOC_DEBUG_INFO 1
+#define LIBSOC_DEBUG_TRACE 2
+
 void libsoc_debug(const char *func, char *format, ...) __attribute__((format(printf, 2, 3)));
 void libsoc_warn(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * \fn int libsoc_get_debug()
+ * \brief get the debug level
+ * \return LIBSOC_DEBUG_OFF, LIBSOC_DEBUG_INFO or LIBSOC_DEBUG_TRACE
+ */
+
 int libsoc_get_debug();
+
+/**
+ * \fn void libsoc_set_debug(int level)
+ * \brief set the debug level, levels above the one the library was built
+ *  with print nothing
+ * \param int level - LIBSOC_DEBUG_OFF, LIBSOC_DEBUG_INFO or
+ *  LIBSOC_DEBUG_TRACE, any other non zero value enables all levels
+ */
+
 void libsoc_set_debug(int level);
 
 #ifdef __cplusplus
@@ -3,10 +3,31 @@
 #ifndef _LIBSOC_FILE_H_
 #define _LIBSOC_FILE_H_
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Enough for any int64_t in decimal, including sign and terminator
+#define FILE_INT_STR_BUF 21
+
+// Enough for any enumerated sysfs attribute such as direction or edge
+#define FILE_ATTR_BUF 32
+
+/*
+ * Maps an attribute's text to an enum value, tables are built at compile
+ * time with FILE_ENUM so string lengths aren't computed on every lookup
+ */
+typedef struct {
+  const char *str;
+  int len;
+  int value;
+} file_enum;
+
+#define FILE_ENUM(str, value) { str, sizeof(str) - 1, value }
+#define FILE_ENUM_NUM(table) ((int) (sizeof(table) / sizeof((table)[0])))
+
 int file_open(const char* path, int flags);
 int file_write(int fd, const char* str, int len);
 int file_read(int fd, void *buf, int count);
@@ -19,6 +40,17 @@ int file_read_int(char *path, int *tmp);
 int file_read_int_fd(int fd, int *tmp);
 int file_write_int_fd(int fd, int val);
 int file_write_int_path(char *path, int val);
+int file_read_int64_fd(int fd, int64_t *val);
+int file_write_int64_fd(int fd, int64_t val);
+int file_format_int(char *buf, int64_t val);
+int file_parse_int(const char *buf, int len, int64_t *val);
+int file_read_attr(const char *path, char *buf, int len);
+int file_read_attr_fd(int fd, char *buf, int len);
+int file_lookup_enum(const char *str, int len, const file_enum *table,
+  int num, int fallback);
+int file_read_enum_path(const char *path, const file_enum *table, int num,
+  int fallback);
+int file_read_enum_fd(int fd, const file_enum *table, int num, int fallback);
 char* file_read_contents(const char *path);
 
 #ifdef __cplusplus
@@ -37,6 +37,8 @@ struct gpio_callback {
  *  callback data
  * \param int shared - set if the request flag was shared and the GPIO was
  *  exported on request
+ * \param struct io_stats *stats - operation counters, NULL unless counting
+ *  was enabled when the gpio was requested
  */
 
 typedef struct {
@@ -45,6 +47,7 @@ typedef struct {
 	struct gpio_callback *callback;
 	struct pollfd pfd;
 	int shared;
+	struct io_stats *stats;
 } gpio;
 
 /**
@@ -115,7 +118,8 @@ typedef enum gpio_mode {
 
 /**
  * \fn gpio* libsoc_gpio_request(unsigned int gpio_id)
- * \brief request a gpio to use
+ * \brief request a gpio to use, requests for a gpio already requested in
+ *  this process return the same shared handle
  * \param unsigned int gpio_id - the id of the gpio you wish to request
  * \param unsigned int mode - mode for opening GPIO
  * \return pointer to gpio* on success NULL on fail
@@ -126,7 +130,8 @@ gpio *libsoc_gpio_request(unsigned int gpio_id, enum gpio_mode mode);
 
 /**
  * \fn int libsoc_gpio_free(gpio* gpio)
- * \brief free a previously requested gpio
+ * \brief free a previously requested gpio, the gpio is only closed and
+ *  unexported when its last reference is freed
  * \param gpio* gpio - valid pointer to a requested gpio
  * \return EXIT_SUCCESS or EXIT_FAILURE 
  */
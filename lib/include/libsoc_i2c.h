@@ -11,12 +11,60 @@
 extern "C" {
 #endif
 
+/**
+ * \struct i2c_backend
+ * \brief the operations used to reach i2c devices, by default the kernel
+ *  /dev/i2c-N interface. Replacing them allows devices to be simulated
+ * \param int (*open)(uint8_t bus) - open a bus, returning an fd or -1
+ * \param int (*close)(int fd) - close a bus opened with open
+ * \param int (*ioctl)(int fd, unsigned long request, unsigned long arg) -
+ *  i2c-dev ioctl, pointer arguments are passed cast to unsigned long
+ */
+
+typedef struct i2c_backend {
+  int (*open) (uint8_t bus);
+  int (*close) (int fd);
+  int (*ioctl) (int fd, unsigned long request, unsigned long arg);
+} i2c_backend;
+
+struct i2c_async;
+
+/**
+ * \struct i2c_policy
+ * \brief retry and timeout behaviour of an i2c device, set once with
+ *  libsoc_i2c_set_policy and applied to every transfer
+ * \param int timeout - adapter timeout in 10's of milliseconds, -1 to leave
+ *  unchanged
+ * \param int kernel_retries - number of times the adapter retries a NAKed
+ *  message (I2C_RETRIES), -1 to leave unchanged
+ * \param int retries - number of times libsoc resends a failed transfer
+ * \param int backoff - delay before the first resend in microseconds,
+ *  doubled for each following resend
+ * \param int retry_errno[8] - zero terminated list of errno values worth
+ *  resending on, all zero for ENXIO, EREMOTEIO, EAGAIN and ETIMEDOUT
+ */
+
+typedef struct {
+  int timeout;
+  int kernel_retries;
+  int retries;
+  int backoff;
+  int retry_errno[8];
+} i2c_policy;
+
 /**
  * \struct i2c
  * \brief representation of spi device and chipselect
  * \param int fd - file descriptor to open i2c device
  * \param uint8_t bus - i2c bus number
  * \param uint8_t address - address of i2c device on the bus
+ * \param i2c_policy policy - retry policy, no retries by default
+ * \param const i2c_backend *backend - operations used to reach the
+ *  device
+ * \param struct i2c_async *async - asynchronous transfer state, NULL until
+ *  libsoc_i2c_async_init is called
+ * \param struct io_stats *stats - operation counters, NULL unless counting
+ *  was enabled when the device was initialised
  */
 
 typedef struct {
@@ -25,8 +73,76 @@ typedef struct {
   uint8_t address;
   struct i2c_rdwr_ioctl_data packets;
   struct i2c_msg messages[2];
+  i2c_policy policy;
+  const i2c_backend *backend;
+  struct i2c_async *async;
+  struct io_stats *stats;
 } i2c;
 
+/**
+ * \struct i2c_request
+ * \brief an asynchronous transfer queued on the bus worker thread, the
+ *  memory is owned by the caller and must stay valid until the request
+ *  is returned by libsoc_i2c_complete
+ * \param i2c *i2c - the device the request was submitted on
+ * \param uint8_t *buffer - data to write or buffer to read into
+ * \param uint16_t len - length of buffer in bytes
+ * \param int read - set for a read transfer, clear for a write
+ * \param int result - EXIT_SUCCESS or EXIT_FAILURE once completed
+ * \param void *data - user data, untouched by libsoc
+ * \param struct i2c_request *next - next completed request
+ */
+
+typedef struct i2c_request {
+  i2c *i2c;
+  uint8_t *buffer;
+  uint16_t len;
+  int read;
+  int result;
+  void *data;
+  struct i2c_request *next;
+} i2c_request;
+
+/**
+ * \struct i2c_scan
+ * \brief per bus input and result of libsoc_i2c_scan, addresses are stored
+ *  as bitmaps with address n at bit (n % 8) of byte (n / 8)
+ * \param uint8_t bus - the linux enumerated bus number to scan
+ * \param uint8_t probe[16] - addresses to probe, all zero probes the
+ *  standard 0x03 to 0x77 range
+ * \param uint8_t present[16] - addresses which responded, or which are in
+ *  use by a kernel driver
+ * \param int result - EXIT_SUCCESS or EXIT_FAILURE if the bus could not be
+ *  opened
+ */
+
+typedef struct {
+  uint8_t bus;
+  uint8_t probe[16];
+  uint8_t present[16];
+  int result;
+} i2c_scan;
+
+/**
+ * \struct i2c_eeprom
+ * \brief layout of an i2c EEPROM for libsoc_i2c_eeprom_read/write
+ * \param uint16_t page_size - write page size in bytes, 0 for devices
+ *  without pages or a write cycle such as FRAM
+ * \param uint8_t addr_len - memory address length in bytes, 1 or 2. Devices
+ *  larger than the address range take the upper bits in the i2c address
+ * \param uint16_t max_transfer - largest message the adapter accepts in
+ *  bytes, 0 for the default of 8192
+ * \param int write_timeout - maximum write cycle time in milliseconds, 0 for
+ *  the default of 10ms
+ */
+
+typedef struct {
+  uint16_t page_size;
+  uint8_t addr_len;
+  uint16_t max_transfer;
+  int write_timeout;
+} i2c_eeprom;
+
 /**
  * \fn i2c * libsoc_i2c_init (uint8_t i2c_bus, uint8_t i2c_address)
  * \brief initialises new i2c instance at specified address
@@ -73,6 +189,126 @@ int libsoc_i2c_read (i2c * i2c, uint8_t * buffer, uint16_t len);
  */
 int libsoc_i2c_set_timeout(i2c * i2c, int timeout);
 
+/**
+ * \fn libsoc_i2c_set_policy(i2c *i2c, i2c_policy *policy)
+ * \brief set the retry and timeout policy used by every transfer on the
+ *  device. When a batch of transfers fails each transfer is resent on its
+ *  own so the ones that succeeded are not repeated on every retry
+ * \param i2c *i2c - valid i2c device struct
+ * \param i2c_policy *policy - the policy to copy into the device
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_set_policy(i2c * i2c, i2c_policy * policy);
+
+/**
+ * \fn libsoc_i2c_eeprom_read(i2c *i2c, i2c_eeprom *eeprom, uint32_t offset, uint8_t *buffer, uint32_t len)
+ * \brief read any amount of data from an EEPROM, split into transfers the
+ *  adapter accepts
+ * \param i2c *i2c - valid i2c device struct
+ * \param i2c_eeprom *eeprom - layout of the EEPROM
+ * \param uint32_t offset - memory address to start reading from
+ * \param uint8_t *buffer - pointer to input data buffer
+ * \param uint32_t len - length of buffer in bytes
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_eeprom_read(i2c * i2c, i2c_eeprom * eeprom, uint32_t offset,
+  uint8_t * buffer, uint32_t len);
+
+/**
+ * \fn libsoc_i2c_eeprom_write(i2c *i2c, i2c_eeprom *eeprom, uint32_t offset, uint8_t *buffer, uint32_t len)
+ * \brief write any amount of data to an EEPROM, split on page boundaries,
+ *  waiting for each write cycle to complete by ACK polling
+ * \param i2c *i2c - valid i2c device struct
+ * \param i2c_eeprom *eeprom - layout of the EEPROM
+ * \param uint32_t offset - memory address to start writing at
+ * \param uint8_t *buffer - pointer to output data buffer
+ * \param uint32_t len - length of buffer in bytes
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_eeprom_write(i2c * i2c, i2c_eeprom * eeprom, uint32_t offset,
+  uint8_t * buffer, uint32_t len);
+
+/**
+ * \fn libsoc_i2c_scan(i2c_scan *scans, int num_buses)
+ * \brief probe for devices on one or more buses, each bus is opened once
+ *  and scanned on its own thread
+ * \param i2c_scan *scans - array of num_buses scan structs with bus and
+ *  probe filled in
+ * \param int num_buses - number of entries in scans
+ * \return EXIT_SUCCESS if every bus was scanned or EXIT_FAILURE
+ */
+int libsoc_i2c_scan(i2c_scan * scans, int num_buses);
+
+/**
+ * \fn libsoc_i2c_scan_present(i2c_scan *scan, uint8_t address)
+ * \brief test whether an address was found by libsoc_i2c_scan
+ * \param i2c_scan *scan - a completed scan struct
+ * \param uint8_t address - 7 bit i2c address
+ * \return 1 if present, 0 otherwise
+ */
+int libsoc_i2c_scan_present(i2c_scan * scan, uint8_t address);
+
+/**
+ * \fn libsoc_i2c_set_backend(const i2c_backend *backend)
+ * \brief set the backend used by i2c devices initialised and buses scanned
+ *  afterwards, devices already initialised keep their backend
+ * \param const i2c_backend *backend - backend operations, NULL restores the
+ *  kernel backend
+ */
+void libsoc_i2c_set_backend(const i2c_backend * backend);
+
+/**
+ * \fn libsoc_i2c_async_init(i2c *i2c)
+ * \brief enable asynchronous transfers on the i2c device, transfers are
+ *  run in order by a worker thread shared by all devices on the same bus
+ * \param i2c *i2c - valid i2c device struct
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_async_init(i2c * i2c);
+
+/**
+ * \fn libsoc_i2c_async_get_fd(i2c *i2c)
+ * \brief get the eventfd that becomes readable when submitted requests
+ *  complete, suitable for adding to a poll/epoll loop
+ * \param i2c *i2c - i2c device struct with async enabled
+ * \return file descriptor or -1 on failure
+ */
+int libsoc_i2c_async_get_fd(i2c * i2c);
+
+/**
+ * \fn libsoc_i2c_submit_write(i2c *i2c, i2c_request *req, uint8_t *buffer, uint16_t len)
+ * \brief queue a write to the i2c slave and return without waiting
+ * \param i2c *i2c - i2c device struct with async enabled
+ * \param i2c_request *req - caller owned request struct
+ * \param uint8_t *buffer - pointer to output data buffer
+ * \param uint16_t len - length of buffer in bytes
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_submit_write(i2c * i2c, i2c_request * req, uint8_t * buffer,
+  uint16_t len);
+
+/**
+ * \fn libsoc_i2c_submit_read(i2c *i2c, i2c_request *req, uint8_t *buffer, uint16_t len)
+ * \brief queue a read from the i2c slave and return without waiting
+ * \param i2c *i2c - i2c device struct with async enabled
+ * \param i2c_request *req - caller owned request struct
+ * \param uint8_t *buffer - pointer to input data buffer
+ * \param uint16_t len - length of buffer in bytes
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_submit_read(i2c * i2c, i2c_request * req, uint8_t * buffer,
+  uint16_t len);
+
+/**
+ * \fn libsoc_i2c_complete(i2c *i2c)
+ * \brief collect the requests that have completed since the last call and
+ *  clear the eventfd
+ * \param i2c *i2c - i2c device struct with async enabled
+ * \return list of completed requests linked by next, in completion order,
+ *  or NULL if none have completed
+ */
+i2c_request * libsoc_i2c_complete(i2c * i2c);
+
 #ifdef __cplusplus
 }
 #endif
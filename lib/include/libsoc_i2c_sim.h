@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef _LIBSOC_I2C_SIM_H_
+#define _LIBSOC_I2C_SIM_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \enum i2c_sim_type
+ * \brief the kinds of device the i2c simulator can emulate
+ */
+
+typedef enum {
+  I2C_SIM_EEPROM,
+  I2C_SIM_REGISTERS,
+} i2c_sim_type;
+
+/**
+ * \struct i2c_sim_device
+ * \brief description of a simulated i2c slave. Both kinds of device take
+ *  a register or memory address at the start of each write and auto
+ *  increment it on every byte transferred
+ * \param i2c_sim_type type - I2C_SIM_EEPROM or I2C_SIM_REGISTERS
+ * \param uint32_t size - size of the memory or register file in bytes
+ * \param uint8_t addr_len - address length in bytes, 1 or 2
+ * \param uint16_t page_size - EEPROM write page size, writes wrap within a
+ *  page like real devices
+ * \param int write_cycle - EEPROM only, number of transfers NAKed after a
+ *  write to emulate the write cycle
+ */
+
+typedef struct {
+  i2c_sim_type type;
+  uint32_t size;
+  uint8_t addr_len;
+  uint16_t page_size;
+  int write_cycle;
+} i2c_sim_device;
+
+/**
+ * \fn libsoc_i2c_sim_enable()
+ * \brief route i2c devices initialised afterwards to the simulator instead
+ *  of the kernel, no hardware or i2c-dev module is required
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_sim_enable();
+
+/**
+ * \fn libsoc_i2c_sim_disable()
+ * \brief restore the kernel backend and remove all simulated devices, all
+ *  simulated i2c devices must be freed first
+ */
+void libsoc_i2c_sim_disable();
+
+/**
+ * \fn libsoc_i2c_sim_add(uint8_t bus, uint8_t address, i2c_sim_device *device)
+ * \brief add a simulated slave, the bus is created with its first device
+ * \param uint8_t bus - bus number the device is on
+ * \param uint8_t address - 7 bit address of the device
+ * \param i2c_sim_device *device - description of the device
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_sim_add(uint8_t bus, uint8_t address, i2c_sim_device *device);
+
+/**
+ * \fn libsoc_i2c_sim_memory(uint8_t bus, uint8_t address)
+ * \brief get the backing memory of a simulated slave to preload or inspect
+ * \param uint8_t bus - bus number the device is on
+ * \param uint8_t address - 7 bit address of the device
+ * \return pointer to the device memory or NULL if there is no such device
+ */
+uint8_t *libsoc_i2c_sim_memory(uint8_t bus, uint8_t address);
+
+/**
+ * \fn libsoc_i2c_sim_fail(uint8_t bus, uint8_t address, int count)
+ * \brief make a simulated slave NAK its next transfers with EREMOTEIO
+ * \param uint8_t bus - bus number the device is on
+ * \param uint8_t address - 7 bit address of the device
+ * \param int count - number of transfers to fail
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int libsoc_i2c_sim_fail(uint8_t bus, uint8_t address, int count);
+
+/**
+ * \fn libsoc_i2c_sim_ioctls()
+ * \brief get the number of transfer ioctls the simulator has handled, used
+ *  to measure how well transfers are batched
+ * \return number of I2C_RDWR and I2C_SMBUS ioctls since enabled
+ */
+unsigned long libsoc_i2c_sim_ioctls();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
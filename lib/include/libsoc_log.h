@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef _LIBSOC_LOG_H_
+#define _LIBSOC_LOG_H_
+
+#include <stdint.h>
+
+#include "libsoc_debug.h"
+#include "libsoc_stats.h"
+#include "libsoc_trace.h"
+
+/*
+ * Debug output from inside the library. Messages above LIBSOC_DEBUG_MAX are
+ * compiled out, the rest cost a single branch on the global level, predicted
+ * not taken, with the formatting kept in cold out of line printers.
+ */
+
+#ifndef LIBSOC_DEBUG_MAX
+#ifdef DEBUG
+#define LIBSOC_DEBUG_MAX LIBSOC_DEBUG_TRACE
+#else
+#define LIBSOC_DEBUG_MAX LIBSOC_DEBUG_OFF
+#endif
+#endif
+
+extern int libsoc_debug_level __attribute__ ((visibility ("hidden")));
+
+#define libsoc_debug_enabled(level) \
+  ((level) <= LIBSOC_DEBUG_MAX && \
+   __builtin_expect (libsoc_debug_level >= (level), 0))
+
+#define LIBSOC_LOG(level, print, ...) \
+  do \
+    { \
+      if (libsoc_debug_enabled (level)) \
+        print (__VA_ARGS__); \
+    } \
+  while (0)
+
+// Attributes of the printers, arg is the index of the format argument
+#define LIBSOC_PRINTER(arg) \
+  __attribute__ ((cold, noinline, format (printf, arg, arg + 1)))
+
+/*
+ * Measurement points around the system calls of the hardware paths, feeding
+ * the trace and the counters of the handle. While tracing is off and the
+ * handle has no counters they cost a single branch, predicted not taken. A
+ * start time of 0 means the operation is not being measured.
+ */
+
+extern int libsoc_trace_on __attribute__ ((visibility ("hidden")));
+
+uint64_t libsoc_io_now (void) __attribute__ ((visibility ("hidden")));
+
+void libsoc_io_record (uint64_t start, io_stats * stats, int op,
+		       uint32_t device, uint32_t length, int32_t result)
+  __attribute__ ((visibility ("hidden")));
+
+void libsoc_trace_record (uint64_t start, uint64_t end, int op,
+			  uint32_t device, uint32_t length, int32_t result,
+			  int error) __attribute__ ((visibility ("hidden")));
+
+io_stats *libsoc_stats_new (stats_type type, uint32_t device)
+  __attribute__ ((visibility ("hidden")));
+
+void libsoc_stats_free (io_stats * stats)
+  __attribute__ ((visibility ("hidden")));
+
+static inline uint64_t
+libsoc_io_begin (io_stats * stats)
+{
+  if (__builtin_expect (libsoc_trace_on || stats != NULL, 0))
+    return libsoc_io_now ();
+
+  return 0;
+}
+
+static inline void
+libsoc_io_end (uint64_t start, io_stats * stats, int op, uint32_t device,
+	       uint32_t length, int32_t result)
+{
+  if (__builtin_expect (start != 0, 0))
+    libsoc_io_record (start, stats, op, device, length, result);
+}
+
+#endif
@@ -3,6 +3,9 @@
 #ifndef _LIBSOC_PWM_H_
 #define _LIBSOC_PWM_H_
 
+#include <stdint.h>
+#include <pthread.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,8 +18,18 @@ extern "C" {
  * \param int enabled_fd - file descriptor to pwm enable file
  * \param int duty_fd - file descriptor to pwm duty_cycle file
  * \param int period_fd - file descriptor to pwm period file
+ * \param int polarity_fd - file descriptor to pwm polarity file, -1 if the
+ *  driver has no polarity support
+ * \param int capture_fd - file descriptor to pwm capture file, -1 if the
+ *  driver has no capture support
  * \param int shared - set if the request flag was shared and the pwm was
  *  exported on request
+ * \param int64_t period - last period written or read, -1 if unknown
+ * \param int64_t duty - last duty cycle written or read, -1 if unknown
+ * \param int polarity - last polarity written or read, -1 if unknown
+ * \param int enabled - last enabled state written or read, -1 if unknown
+ * \param struct io_stats *stats - operation counters, NULL unless counting
+ *  was enabled when the pwm was requested
  */
 
 typedef struct {
@@ -25,9 +38,143 @@ typedef struct {
 	int enable_fd;
 	int duty_fd;
 	int period_fd;
+	int polarity_fd;
+	int capture_fd;
 	int shared;
+	int64_t period;
+	int64_t duty;
+	int polarity;
+	int enabled;
+	struct io_stats *stats;
 } pwm;
 
+/**
+ * \struct pwm_group
+ * \brief a set of requested pwms, possibly on different chips, updated
+ *  together
+ * \param pwm **pwms - the pwms in the group, owned by the caller
+ * \param int num - number of pwms in the group
+ * \param char *bufs - preallocated formatting space for each pwm
+ * \param int *lens - formatted length for each pwm, 0 if not written
+ */
+
+typedef struct {
+	pwm **pwms;
+	int num;
+	char *bufs;
+	int *lens;
+} pwm_group;
+
+/**
+ * \struct pwm_step
+ * \brief one step of a sequence played by the pwm sequencer
+ * \param unsigned int duty - duty cycle in nanoseconds
+ * \param uint64_t hold_ns - time to hold the duty cycle in nanoseconds
+ */
+
+typedef struct {
+	unsigned int duty;
+	uint64_t hold_ns;
+} pwm_step;
+
+/**
+ * \struct pwm_sequencer_stats
+ * \brief playback statistics of a pwm sequencer
+ * \param unsigned long steps - number of steps played
+ * \param unsigned long underruns - steps which were written after their
+ *  hold time had already passed
+ * \param uint64_t max_late_ns - the latest a step has been written after
+ *  its deadline
+ */
+
+typedef struct {
+	unsigned long steps;
+	unsigned long underruns;
+	uint64_t max_late_ns;
+} pwm_sequencer_stats;
+
+/**
+ * \struct pwm_sequencer
+ * \brief playback of a sequence of duty cycles from a dedicated thread
+ * \param pwm *pwm - the pwm the sequence is played on
+ * \param pwm_step *steps - copy of the steps
+ * \param int num_steps - number of steps
+ * \param int loops - times to play the sequence, 0 to loop until freed
+ * \param char *bufs - preformatted duty cycle for each step
+ * \param int *lens - length of each preformatted duty cycle
+ * \param pthread_t thread - the playback thread
+ * \param int running - set while the sequence is playing, accessed
+ *  atomically as it is shared with the playback thread
+ * \param int joined - set once the playback thread has been joined
+ * \param pwm_sequencer_stats stats - playback statistics
+ */
+
+typedef struct {
+	pwm *pwm;
+	pwm_step *steps;
+	int num_steps;
+	int loops;
+	char *bufs;
+	int *lens;
+	pthread_t thread;
+	int running;
+	int joined;
+	pwm_sequencer_stats stats;
+} pwm_sequencer;
+
+/**
+ * \struct pwm_capture_stats
+ * \brief statistics over the window of a periodic pwm capture, all times in
+ *  nanoseconds
+ * \param int samples - number of captures in the window
+ * \param unsigned long errors - failed captures since started
+ * \param unsigned int period_min - shortest period in the window
+ * \param unsigned int period_max - longest period in the window
+ * \param unsigned int period_mean - mean period over the window
+ * \param unsigned int duty_min - shortest duty cycle in the window
+ * \param unsigned int duty_max - longest duty cycle in the window
+ * \param unsigned int duty_mean - mean duty cycle over the window
+ */
+
+typedef struct {
+	int samples;
+	unsigned long errors;
+	unsigned int period_min;
+	unsigned int period_max;
+	unsigned int period_mean;
+	unsigned int duty_min;
+	unsigned int duty_max;
+	unsigned int duty_mean;
+} pwm_capture_stats;
+
+/**
+ * \struct pwm_capturer
+ * \brief periodic capture of a pwm input from a dedicated thread
+ * \param pwm *pwm - the pwm being captured
+ * \param int interval_ms - time between captures
+ * \param int window - number of captures kept for the statistics
+ * \param unsigned int *periods - ring of captured periods
+ * \param unsigned int *duties - ring of captured duty cycles
+ * \param int head - next slot to fill in the rings
+ * \param int samples - number of filled slots
+ * \param unsigned long errors - failed captures
+ * \param pthread_t thread - the capture thread
+ * \param pthread_mutex_t lock - protects the rings
+ */
+
+typedef struct {
+	pwm *pwm;
+	int interval_ms;
+	int window;
+	unsigned int *periods;
+	unsigned int *duties;
+	int head;
+	int samples;
+	unsigned long errors;
+	pthread_t thread;
+	pthread_mutex_t lock;
+} pwm_capturer;
+
 /**
  * \enum pwm_enabled
  * \brief defined values for pwm enabled/disabled
@@ -72,7 +219,8 @@ typedef enum {
 
 /**
  * \fn pwm* libsoc_pwm_request(unsigned int pwm_chip, unsigned int pwm_num)
- * \brief request a pwm to use
+ * \brief request a pwm to use, requests for a pwm already requested in
+ *  this process return the same shared handle
  * \param unsigned int pwm_chip - the chip number that controls the pwm you
     wish to use
  * \param unsigned int pwm_num - the pwm number number within your pwm chip
@@ -86,7 +234,8 @@ pwm* libsoc_pwm_request(unsigned int pwm_chip, unsigned int pwm_num,
 
 /**
  * \fn int libsoc_pwm_free(pwm* pwm)
- * \brief free a previously requested pwm
+ * \brief free a previously requested pwm, the pwm is only closed and
+ *  unexported when its last reference is freed
  * \param pwm* pwm - valid pointer to a requested pwm
  * \return EXIT_SUCCESS or EXIT_FAILURE
  */
@@ -145,11 +294,21 @@ int libsoc_pwm_set_duty_cycle(pwm *pwm, unsigned int duty);
  * \fn libsoc_pwm_get_duty_cycle(pwm *pwm)
  * \brief gets the current pwm duty cycle
  * \param pwm *pwm - pointer to valid pwm struct
- * \return duty_cycle - integer, -1 on failure
+ * \return duty_cycle - integer, -1 on failure or if the duty cycle is
+ *  above INT_MAX, see libsoc_pwm_get_duty_cycle64
  */
 
 int libsoc_pwm_get_duty_cycle(pwm *pwm);
 
+/**
+ * \fn libsoc_pwm_get_duty_cycle64(pwm *pwm)
+ * \brief gets the current pwm duty cycle, including those above INT_MAX
+ * \param pwm *pwm - pointer to valid pwm struct
+ * \return duty_cycle - in nanoseconds, -1 on failure
+ */
+
+int64_t libsoc_pwm_get_duty_cycle64(pwm *pwm);
+
 /**
  * \fn libsoc_pwm_set_period(pwm *pwm, unsigned int period)
  * \brief set the PWM period (sum of the active and inactive
@@ -165,11 +324,178 @@ int libsoc_pwm_set_period(pwm *pwm, unsigned int period);
  * \fn libsoc_pwm_get_period(pwm *pwm)
  * \brief gets the current pwm period
  * \param pwm *pwm - pointer to valid pwm struct
- * \return period - integer, -1 on failure
+ * \return period - integer, -1 on failure or if the period is above
+ *  INT_MAX (about 2.147s), see libsoc_pwm_get_period64
  */
 
 int libsoc_pwm_get_period(pwm *pwm);
 
+/**
+ * \fn libsoc_pwm_get_period64(pwm *pwm)
+ * \brief gets the current pwm period, including those above INT_MAX
+ * \param pwm *pwm - pointer to valid pwm struct
+ * \return period - in nanoseconds, -1 on failure
+ */
+
+int64_t libsoc_pwm_get_period64(pwm *pwm);
+
+/**
+ * \fn libsoc_pwm_set_config(pwm *pwm, unsigned int period, unsigned int duty, pwm_polarity polarity, pwm_enabled enabled)
+ * \brief set the whole PWM state in one call, writes are ordered so the
+ *  duty never exceeds the period and polarity is only changed while
+ *  disabled, and values which have not changed are not written
+ * \param pwm *pwm - pointer to valid pwm struct
+ * \param unsigned int period - period value in nanoseconds
+ * \param unsigned int duty - duty value in nanoseconds, must not be greater
+ *  than period
+ * \param pwm_polarity polarity - NORMAL or INVERSED
+ * \param pwm_enabled enabled - ENABLED or DISABLED
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_set_config(pwm *pwm, unsigned int period, unsigned int duty,
+  pwm_polarity polarity, pwm_enabled enabled);
+
+/**
+ * \fn libsoc_pwm_group_new(pwm **pwms, int num)
+ * \brief create a group of requested pwms to update together
+ * \param pwm **pwms - array of num requested pwms, must stay valid for
+ *  the life of the group
+ * \param int num - number of pwms
+ * \return pointer to pwm_group on success NULL on fail
+ */
+
+pwm_group* libsoc_pwm_group_new(pwm **pwms, int num);
+
+/**
+ * \fn libsoc_pwm_group_free(pwm_group *group)
+ * \brief free a group, the pwms in it are not freed
+ * \param pwm_group *group - valid pointer to a pwm group
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_group_free(pwm_group *group);
+
+/**
+ * \fn libsoc_pwm_group_set_duty_cycles(pwm_group *group, const unsigned int *duties)
+ * \brief set the duty cycle of every pwm in the group, all values are
+ *  prepared before the first write so the writes go out back to back.
+ *  Unchanged duty cycles are not written
+ * \param pwm_group *group - valid pointer to a pwm group
+ * \param const unsigned int *duties - duty in nanoseconds for each pwm, in
+ *  the same order as the group
+ * \return EXIT_SUCCESS, or EXIT_FAILURE if any write failed
+ */
+
+int libsoc_pwm_group_set_duty_cycles(pwm_group *group,
+  const unsigned int *duties);
+
+/**
+ * \fn libsoc_pwm_sequencer_start(pwm *pwm, const pwm_step *steps, int num_steps, int loops, int priority)
+ * \brief start playing a sequence of duty cycles from a dedicated thread,
+ *  each step is written at an absolute deadline so timing errors do not
+ *  accumulate
+ * \param pwm *pwm - pointer to valid pwm struct, with the period set.
+ *  The pwm must not be written to until the sequencer is waited on or freed
+ * \param const pwm_step *steps - the steps to play, copied, with no duty
+ *  cycle longer than the period
+ * \param int num_steps - number of steps
+ * \param int loops - times to play the sequence, 0 to loop until freed
+ * \param int priority - SCHED_FIFO priority of the thread, 0 for the
+ *  default scheduler. Falls back to the default if not permitted
+ * \return pointer to pwm_sequencer on success NULL on fail
+ */
+
+pwm_sequencer* libsoc_pwm_sequencer_start(pwm *pwm, const pwm_step *steps,
+  int num_steps, int loops, int priority);
+
+/**
+ * \fn libsoc_pwm_sequencer_running(pwm_sequencer *seq)
+ * \brief check if a sequence is still playing
+ * \param pwm_sequencer *seq - valid pointer to a sequencer
+ * \return 1 if playing, 0 if finished
+ */
+
+int libsoc_pwm_sequencer_running(pwm_sequencer *seq);
+
+/**
+ * \fn libsoc_pwm_sequencer_wait(pwm_sequencer *seq)
+ * \brief block until the sequence has finished playing, must not be used
+ *  on a sequence started with loops set to 0
+ * \param pwm_sequencer *seq - valid pointer to a sequencer
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_sequencer_wait(pwm_sequencer *seq);
+
+/**
+ * \fn libsoc_pwm_sequencer_get_stats(pwm_sequencer *seq, pwm_sequencer_stats *stats)
+ * \brief copy the playback statistics of a sequencer
+ * \param pwm_sequencer *seq - valid pointer to a sequencer
+ * \param pwm_sequencer_stats *stats - filled with the statistics
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_sequencer_get_stats(pwm_sequencer *seq,
+  pwm_sequencer_stats *stats);
+
+/**
+ * \fn libsoc_pwm_sequencer_free(pwm_sequencer *seq)
+ * \brief cancel the sequence if it is still playing and free the
+ *  sequencer, the pwm is left at the last duty cycle written
+ * \param pwm_sequencer *seq - valid pointer to a sequencer
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_sequencer_free(pwm_sequencer *seq);
+
+/**
+ * \fn libsoc_pwm_capture(pwm *pwm, unsigned int *period, unsigned int *duty)
+ * \brief measure the period and duty cycle of the signal on a pwm input,
+ *  blocks while the controller captures
+ * \param pwm *pwm - pointer to valid pwm struct, on a controller with
+ *  capture support
+ * \param unsigned int *period - set to the captured period in nanoseconds
+ * \param unsigned int *duty - set to the captured duty cycle in nanoseconds
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_capture(pwm *pwm, unsigned int *period, unsigned int *duty);
+
+/**
+ * \fn libsoc_pwm_capture_start(pwm *pwm, int interval_ms, int window)
+ * \brief start capturing a pwm input periodically from a dedicated thread,
+ *  keeping the last window captures for statistics
+ * \param pwm *pwm - pointer to valid pwm struct, on a controller with
+ *  capture support
+ * \param int interval_ms - time between the start of each capture
+ * \param int window - number of captures the statistics cover
+ * \return pointer to pwm_capturer on success NULL on fail
+ */
+
+pwm_capturer* libsoc_pwm_capture_start(pwm *pwm, int interval_ms,
+  int window);
+
+/**
+ * \fn libsoc_pwm_capture_get_stats(pwm_capturer *cap, pwm_capture_stats *stats)
+ * \brief get the min, max and mean of the captures in the window
+ * \param pwm_capturer *cap - valid pointer to a capturer
+ * \param pwm_capture_stats *stats - filled with the statistics
+ * \return EXIT_SUCCESS, or EXIT_FAILURE if nothing has been captured yet
+ */
+
+int libsoc_pwm_capture_get_stats(pwm_capturer *cap,
+  pwm_capture_stats *stats);
+
+/**
+ * \fn libsoc_pwm_capture_stop(pwm_capturer *cap)
+ * \brief stop periodic capture and free the capturer
+ * \param pwm_capturer *cap - valid pointer to a capturer
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_pwm_capture_stop(pwm_capturer *cap);
+
 #ifdef __cplusplus
 }
 #endif
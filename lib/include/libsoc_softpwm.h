@@ -0,0 +1,241 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef _LIBSOC_SOFTPWM_H_
+#define _LIBSOC_SOFTPWM_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "libsoc_gpio.h"
+#include "libsoc_pwm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct softpwm_engine;
+
+/**
+ * \struct softpwm
+ * \brief a software pwm channel driven on a gpio by a softpwm engine
+ * \param struct softpwm_engine *engine - the engine driving the channel
+ * \param gpio *gpio - the gpio the channel drives, owned by the caller
+ * \param unsigned int period - period in nanoseconds
+ * \param unsigned int duty - duty cycle in nanoseconds
+ * \param int polarity - NORMAL or INVERSED
+ * \param int enabled - ENABLED or DISABLED
+ * \param unsigned int cur_period - period of the current cycle
+ * \param unsigned int cur_duty - duty cycle of the current cycle
+ * \param int active - set while in the active part of the cycle
+ * \param int level - last level written to the gpio, -1 if unknown
+ * \param uint64_t cycle_start - start time of the current cycle
+ * \param uint64_t next_edge - time of the next edge
+ */
+
+typedef struct softpwm {
+	struct softpwm_engine *engine;
+	gpio *gpio;
+	unsigned int period;
+	unsigned int duty;
+	int polarity;
+	int enabled;
+	unsigned int cur_period;
+	unsigned int cur_duty;
+	int active;
+	int level;
+	uint64_t cycle_start;
+	uint64_t next_edge;
+} softpwm;
+
+/**
+ * \struct softpwm_stats
+ * \brief timing statistics of a softpwm engine
+ * \param unsigned long edges - number of edges processed
+ * \param unsigned long writes - number of gpio writes issued
+ * \param uint64_t total_late_ns - sum of the lateness of all edges
+ * \param uint64_t max_late_ns - latest an edge has been written
+ */
+
+typedef struct {
+	unsigned long edges;
+	unsigned long writes;
+	uint64_t total_late_ns;
+	uint64_t max_late_ns;
+} softpwm_stats;
+
+/**
+ * \struct softpwm_engine
+ * \brief a single thread multiplexing every softpwm channel in one timing
+ *  loop
+ * \param softpwm **edges - enabled channels sorted by next edge
+ * \param int num_edges - number of enabled channels
+ * \param int num_channels - number of channels requested on the engine
+ * \param int stop - set to stop the engine thread
+ * \param pthread_t thread - the engine thread
+ * \param pthread_mutex_t lock - protects the channels and edge list
+ * \param pthread_cond_t cond - signalled when the edge list changes
+ * \param int writing - set while gpio levels are written without the lock
+ * \param pthread_cond_t idle - signalled when writing is cleared
+ * \param softpwm_stats stats - timing statistics
+ */
+
+typedef struct softpwm_engine {
+	softpwm **edges;
+	int num_edges;
+	int num_channels;
+	int stop;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int writing;
+	pthread_cond_t idle;
+	softpwm_stats stats;
+} softpwm_engine;
+
+/**
+ * \fn libsoc_softpwm_engine_new(int priority)
+ * \brief start a softpwm engine thread
+ * \param int priority - SCHED_FIFO priority of the thread, 0 for the
+ *  default scheduler. Falls back to the default if not permitted
+ * \return pointer to softpwm_engine on success NULL on fail
+ */
+
+softpwm_engine* libsoc_softpwm_engine_new(int priority);
+
+/**
+ * \fn libsoc_softpwm_engine_free(softpwm_engine *engine)
+ * \brief stop the engine thread and free the engine, all channels must be
+ *  freed first
+ * \param softpwm_engine *engine - valid pointer to an engine
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_engine_free(softpwm_engine *engine);
+
+/**
+ * \fn libsoc_softpwm_engine_get_stats(softpwm_engine *engine, softpwm_stats *stats)
+ * \brief copy the timing statistics of an engine
+ * \param softpwm_engine *engine - valid pointer to an engine
+ * \param softpwm_stats *stats - filled with the statistics
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_engine_get_stats(softpwm_engine *engine,
+  softpwm_stats *stats);
+
+/**
+ * \fn libsoc_softpwm_request(softpwm_engine *engine, gpio *gpio)
+ * \brief add a disabled softpwm channel driving a gpio to an engine
+ * \param softpwm_engine *engine - valid pointer to an engine
+ * \param gpio *gpio - requested gpio set as an output, not freed with the
+ *  channel
+ * \return pointer to softpwm on success NULL on fail
+ */
+
+softpwm* libsoc_softpwm_request(softpwm_engine *engine, gpio *gpio);
+
+/**
+ * \fn libsoc_softpwm_free(softpwm *pwm)
+ * \brief disable and remove a softpwm channel from its engine
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_free(softpwm *pwm);
+
+/**
+ * \fn libsoc_softpwm_set_enabled(softpwm *pwm, pwm_enabled enabled)
+ * \brief start or stop a channel, a stopped channel drives its inactive
+ *  level
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \param pwm_enabled enabled - ENABLED or DISABLED
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_set_enabled(softpwm *pwm, pwm_enabled enabled);
+
+/**
+ * \fn libsoc_softpwm_get_enabled(softpwm *pwm)
+ * \brief get the enabled state of a channel
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \return ENABLED, DISABLED or ENABLED_ERROR
+ */
+
+pwm_enabled libsoc_softpwm_get_enabled(softpwm *pwm);
+
+/**
+ * \fn libsoc_softpwm_set_period(softpwm *pwm, unsigned int period)
+ * \brief set the period of a channel, applied from the next cycle
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \param unsigned int period - period in nanoseconds
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_set_period(softpwm *pwm, unsigned int period);
+
+/**
+ * \fn libsoc_softpwm_get_period(softpwm *pwm)
+ * \brief get the period of a channel
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \return period in nanoseconds, -1 on failure
+ */
+
+int libsoc_softpwm_get_period(softpwm *pwm);
+
+/**
+ * \fn libsoc_softpwm_set_duty_cycle(softpwm *pwm, unsigned int duty)
+ * \brief set the duty cycle of a channel, applied from the next cycle
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \param unsigned int duty - duty cycle in nanoseconds, no longer than the
+ *  period
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_set_duty_cycle(softpwm *pwm, unsigned int duty);
+
+/**
+ * \fn libsoc_softpwm_get_duty_cycle(softpwm *pwm)
+ * \brief get the duty cycle of a channel
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \return duty cycle in nanoseconds, -1 on failure
+ */
+
+int libsoc_softpwm_get_duty_cycle(softpwm *pwm);
+
+/**
+ * \fn libsoc_softpwm_set_polarity(softpwm *pwm, pwm_polarity polarity)
+ * \brief set whether the active part of the cycle is driven high or low
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \param pwm_polarity polarity - NORMAL or INVERSED
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_softpwm_set_polarity(softpwm *pwm, pwm_polarity polarity);
+
+/**
+ * \fn libsoc_softpwm_get_polarity(softpwm *pwm)
+ * \brief get the polarity of a channel
+ * \param softpwm *pwm - valid pointer to a softpwm channel
+ * \return NORMAL, INVERSED or POLARITY_ERROR
+ */
+
+pwm_polarity libsoc_softpwm_get_polarity(softpwm *pwm);
+
+/**
+ * \fn libsoc_softpwm_set_duty_cycles(softpwm **pwms, const unsigned int *duties, int num)
+ * \brief set the duty cycle of several channels on one engine at once, all
+ *  values are checked first and applied under a single lock so every
+ *  channel changes at its next cycle
+ * \param softpwm **pwms - array of channels on the same engine
+ * \param const unsigned int *duties - duty cycle in nanoseconds for each
+ * \param int num - number of channels
+ * \return EXIT_SUCCESS or EXIT_FAILURE, in which case nothing is changed
+ */
+
+int libsoc_softpwm_set_duty_cycles(softpwm **pwms, const unsigned int *duties,
+  int num);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -17,12 +17,15 @@ extern "C" {
  *  callback data
  * \param uint16_t spi_dev - major number of spi device
  * \param uint8_t spi_dev - minor number of spi device
+ * \param struct io_stats *stats - operation counters, NULL unless counting
+ *  was enabled when the device was initialised
  */
 
 typedef struct {
   int fd;
   uint16_t spi_dev;
   uint8_t chip_select;
+  struct io_stats *stats;
 } spi;
 
 /**
@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef _LIBSOC_STATS_H_
+#define _LIBSOC_STATS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \enum stats_type
+ * \brief the kind of handle a set of counters belongs to
+ */
+
+typedef enum {
+  LS_STATS_GPIO,
+  LS_STATS_SPI,
+  LS_STATS_I2C,
+  LS_STATS_PWM,
+} stats_type;
+
+/**
+ * \def LIBSOC_STATS_BUCKETS
+ * \brief number of latency histogram buckets, bucket 0 counts operations
+ *  which took 0ns and bucket n those which took 2^(n-1) to 2^n - 1ns, the
+ *  last bucket also counts everything slower
+ */
+
+#define LIBSOC_STATS_BUCKETS 32
+
+/**
+ * \struct io_stats
+ * \brief counters of the system calls issued through a handle, latencies
+ *  are measured with CLOCK_MONOTONIC_RAW
+ * \param stats_type type - kind of handle
+ * \param uint32_t device - gpio id, or the device id used by the trace,
+ *  see LIBSOC_TRACE_SPI_ID, LIBSOC_TRACE_I2C_ID and LIBSOC_TRACE_PWM_ID
+ * \param uint64_t ops - number of operations
+ * \param uint64_t bytes - bytes transferred, SPI and I2C only
+ * \param uint64_t errors - number of failed operations
+ * \param uint64_t total_ns - sum of the latency of all operations
+ * \param uint64_t max_ns - slowest operation
+ * \param uint64_t latency[LIBSOC_STATS_BUCKETS] - latency histogram
+ */
+
+typedef struct io_stats {
+  stats_type type;
+  uint32_t device;
+  uint64_t ops;
+  uint64_t bytes;
+  uint64_t errors;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t latency[LIBSOC_STATS_BUCKETS];
+} io_stats;
+
+/**
+ * \fn void libsoc_stats_enable(int enable)
+ * \brief count the operations of handles requested or initialised
+ *  afterwards, handles without counters cost nothing extra
+ * \param int enable - non zero to enable, 0 to disable
+ */
+
+void libsoc_stats_enable(int enable);
+
+/**
+ * \fn int libsoc_stats_snapshot(io_stats *stats, int max)
+ * \brief copy the counters of every open handle which has them, the
+ *  counters are updated without locks so operations in flight may be
+ *  partly counted
+ * \param io_stats *stats - filled with the counters
+ * \param int max - size of stats
+ * \return number of handles with counters, which may be more than max
+ */
+
+int libsoc_stats_snapshot(io_stats *stats, int max);
+
+/**
+ * \fn uint64_t libsoc_stats_percentile(const io_stats *stats, double percentile)
+ * \brief estimate a latency percentile from the histogram
+ * \param const io_stats *stats - counters of a handle
+ * \param double percentile - percentile between 0 and 100
+ * \return upper bound of the bucket holding the percentile in nanoseconds,
+ *  0 if there are no operations
+ */
+
+uint64_t libsoc_stats_percentile(const io_stats *stats, double percentile);
+
+/**
+ * \fn int libsoc_stats_format(char *buf, size_t len)
+ * \brief format the counters as OpenMetrics text, handles on the same
+ *  device are summed into one series
+ * \param char *buf - filled with the text, may be NULL if len is 0
+ * \param size_t len - size of buf
+ * \return length of the whole text, which is truncated if it is len or
+ *  more, -1 on failure
+ */
+
+int libsoc_stats_format(char *buf, size_t len);
+
+/**
+ * \fn int libsoc_stats_export_start(const char *address)
+ * \brief start a thread serving the counters as OpenMetrics text, over
+ *  HTTP to GET requests and as the bare text to clients sending nothing
+ * \param const char *address - path of a Unix socket, or a TCP port number
+ *  which is only listened on at 127.0.0.1
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_stats_export_start(const char *address);
+
+/**
+ * \fn int libsoc_stats_export_stop()
+ * \brief stop the exporter thread and remove its Unix socket
+ * \return EXIT_SUCCESS or EXIT_FAILURE if it was not running
+ */
+
+int libsoc_stats_export_stop();
+
+#ifdef __cplusplus
+}
+#endif
+#endif
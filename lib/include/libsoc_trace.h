@@ -0,0 +1,167 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#ifndef _LIBSOC_TRACE_H_
+#define _LIBSOC_TRACE_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * \enum trace_op
+ * \brief the hardware operations recorded in the trace
+ */
+
+typedef enum {
+  LS_TRACE_NONE = 0,
+  LS_TRACE_GPIO_SET_LEVEL,
+  LS_TRACE_GPIO_GET_LEVEL,
+  LS_TRACE_GPIO_POLL,
+  LS_TRACE_SPI_WRITE,
+  LS_TRACE_SPI_READ,
+  LS_TRACE_SPI_RW,
+  LS_TRACE_I2C_WRITE,
+  LS_TRACE_I2C_READ,
+  LS_TRACE_PWM_SET_ENABLED,
+  LS_TRACE_PWM_SET_PERIOD,
+  LS_TRACE_PWM_SET_DUTY,
+  LS_TRACE_NUM_OPS,
+} trace_op;
+
+/**
+ * \def LIBSOC_TRACE_SPI_ID
+ * \brief device ids of the records, a GPIO is recorded by its gpio id
+ */
+
+#define LIBSOC_TRACE_SPI_ID(device, chip_select) \
+  ((uint32_t) (device) << 8 | (chip_select))
+#define LIBSOC_TRACE_I2C_ID(bus, address) \
+  ((uint32_t) (bus) << 8 | (address))
+#define LIBSOC_TRACE_PWM_ID(chip, num) \
+  ((uint32_t) (chip) << 16 | (num))
+
+/**
+ * \struct trace_record
+ * \brief a single traced hardware operation
+ * \param uint64_t timestamp - CLOCK_MONOTONIC_RAW time the operation
+ *  started in nanoseconds
+ * \param uint32_t duration - time the operation took in nanoseconds
+ * \param uint32_t tid - kernel id of the thread that issued it
+ * \param uint16_t op - one of trace_op
+ * \param uint16_t error - errno if the operation failed, 0 otherwise
+ * \param uint32_t device - gpio id or one of the LIBSOC_TRACE_*_ID values
+ * \param uint32_t length - bytes transferred, the level for GPIO levels,
+ *  the timeout for polls and the value written for PWMs
+ * \param int32_t result - value returned by the system call, 0 or -1 for
+ *  PWMs
+ */
+
+typedef struct {
+  uint64_t timestamp;
+  uint32_t duration;
+  uint32_t tid;
+  uint16_t op;
+  uint16_t error;
+  uint32_t device;
+  uint32_t length;
+  int32_t result;
+} trace_record;
+
+/**
+ * \struct trace_file_header
+ * \brief start of a trace file, followed by trace_record structs in host
+ *  byte order
+ * \param char magic[8] - "LSOCTRC"
+ * \param uint32_t version - LIBSOC_TRACE_VERSION
+ * \param uint32_t record_size - size of each record
+ */
+
+#define LIBSOC_TRACE_MAGIC "LSOCTRC"
+#define LIBSOC_TRACE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} trace_file_header;
+
+/**
+ * \fn int libsoc_trace_enable(unsigned int records)
+ * \brief start recording hardware operations, each thread records into
+ *  its own ring which keeps its most recent operations
+ * \param unsigned int records - records per thread ring, rounded up to a
+ *  power of two, 0 for the default of 4096. Only applies to rings created
+ *  afterwards
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_trace_enable(unsigned int records);
+
+/**
+ * \fn void libsoc_trace_disable()
+ * \brief stop recording, the rings keep their records
+ */
+
+void libsoc_trace_disable();
+
+/**
+ * \fn int libsoc_trace_snapshot(trace_record *records, int max)
+ * \brief copy the records of every thread, oldest first
+ * \param trace_record *records - filled with the records
+ * \param int max - size of records, the newest are kept if there are more
+ * \return number of records copied, -1 on failure
+ */
+
+int libsoc_trace_snapshot(trace_record *records, int max);
+
+/**
+ * \fn int libsoc_trace_dump(const char *path)
+ * \brief write the records of every thread to a trace file
+ * \param const char *path - file to create
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_trace_dump(const char *path);
+
+/**
+ * \fn int libsoc_trace_stream_start(const char *path, int interval)
+ * \brief start a thread draining the rings into a trace file, records
+ *  overwritten before they are drained are counted as lost
+ * \param const char *path - file to create
+ * \param int interval - time between drains in milliseconds, 0 for 100
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_trace_stream_start(const char *path, int interval);
+
+/**
+ * \fn int libsoc_trace_stream_stop()
+ * \brief drain the rings a final time, stop the thread and close the file
+ * \return EXIT_SUCCESS or EXIT_FAILURE
+ */
+
+int libsoc_trace_stream_stop();
+
+/**
+ * \fn unsigned long libsoc_trace_lost()
+ * \brief get the number of records overwritten before they were streamed
+ * \return number of records lost since the stream started
+ */
+
+unsigned long libsoc_trace_lost();
+
+/**
+ * \fn const char *libsoc_trace_op_name(int op)
+ * \brief get the name of a traced operation
+ * \param int op - one of trace_op
+ * \return name of the operation, "unknown" if not valid
+ */
+
+const char *libsoc_trace_op_name(int op);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
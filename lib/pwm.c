@@ -7,38 +7,84 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
 
 #include "libsoc_file.h"
-#include "libsoc_debug.h"
+#include "libsoc_log.h"
 #include "libsoc_pwm.h"
 
 #define STR_BUF 256
+#define GROUP_STR_BUF FILE_INT_STR_BUF
 
 static char pwm_polarity_strings[2][STR_BUF] = { "normal", "inversed" };
 static char pwm_enabled_strings[2][STR_BUF] = { "0", "1" };
 
-void libsoc_pwm_debug (const char *func, unsigned int chip,
-  unsigned int pwm, char *format, ...)
+static const file_enum pwm_polarity_table[] = {
+  FILE_ENUM("normal", NORMAL),
+  FILE_ENUM("inversed", INVERSED),
+};
+
+static void LIBSOC_PRINTER (4) libsoc_pwm_debug_print (const char *func,
+  unsigned int chip, unsigned int pwm, char *format, ...)
 {
-#ifdef DEBUG
-  if (libsoc_get_debug ())
-  {
-    va_list args;
+  va_list args;
+
+  fprintf (stderr, "libsoc-pwm-debug: ");
+
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
 
-    fprintf (stderr, "libsoc-pwm-debug: ");
+  fprintf (stderr, " ((%d,%d), %s)", chip, pwm, func);
 
-    va_start (args, format);
-    vfprintf (stderr, format, args);
-    va_end (args);
+  fprintf (stderr, "\n");
+}
 
-	  fprintf (stderr, " ((%d,%d), %s)", chip, pwm, func);
+#define libsoc_pwm_debug(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_INFO, libsoc_pwm_debug_print, __VA_ARGS__)
+#define libsoc_pwm_trace(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_TRACE, libsoc_pwm_debug_print, __VA_ARGS__)
+
+/*
+ * Requested pwms are shared within the process, the channel stays exported
+ * and its fds open until the last reference is freed. Exporting and
+ * unexporting happen outside the lock with the entry marked busy, other
+ * requests for the channel wait on the condition until it is settled.
+ */
+struct pwm_registry_entry {
+  unsigned int chip;
+  unsigned int pwm_num;
+  pwm *pwm;
+  int refs;
+  int busy;
+  struct pwm_registry_entry *next;
+};
+
+static struct pwm_registry_entry *pwm_registry;
+static pthread_mutex_t pwm_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pwm_registry_cond = PTHREAD_COND_INITIALIZER;
+
+// Unlink and free an entry, waking its waiters, with the lock held
+static void libsoc_pwm_registry_remove(struct pwm_registry_entry *entry)
+{
+  struct pwm_registry_entry **prev;
 
-    fprintf (stderr, "\n");
+  for (prev = &pwm_registry; *prev; prev = &(*prev)->next)
+  {
+    if (*prev == entry)
+    {
+      *prev = entry->next;
+      break;
+    }
   }
-#endif
+
+  free(entry);
+  pthread_cond_broadcast(&pwm_registry_cond);
 }
 
-pwm* libsoc_pwm_request (unsigned int chip, unsigned int pwm_num,
+static pwm* libsoc_pwm_open (unsigned int chip, unsigned int pwm_num,
   shared_mode mode)
 {
   pwm *new_pwm;
@@ -104,6 +150,11 @@ pwm* libsoc_pwm_request (unsigned int chip, unsigned int pwm_num,
 
   new_pwm = malloc(sizeof(pwm));
 
+  if (new_pwm == NULL)
+  {
+    return NULL;
+  }
+
   sprintf(tmp_str, "/sys/class/pwm/pwmchip%d/pwm%d/enable", chip, pwm_num);
   new_pwm->enable_fd = file_open(tmp_str, O_SYNC | O_RDWR);
 
@@ -113,10 +164,44 @@ pwm* libsoc_pwm_request (unsigned int chip, unsigned int pwm_num,
   sprintf(tmp_str, "/sys/class/pwm/pwmchip%d/pwm%d/duty_cycle", chip, pwm_num);
   new_pwm->duty_fd = file_open(tmp_str, O_SYNC | O_RDWR);
 
+  // Polarity support is optional, so a missing file is not an error
+  sprintf(tmp_str, "/sys/class/pwm/pwmchip%d/pwm%d/polarity", chip, pwm_num);
+  new_pwm->polarity_fd = -1;
+
+  if (file_valid(tmp_str))
+  {
+    new_pwm->polarity_fd = file_open(tmp_str, O_SYNC | O_RDWR);
+  }
+
+  // As is capture, which few controllers implement
+  sprintf(tmp_str, "/sys/class/pwm/pwmchip%d/pwm%d/capture", chip, pwm_num);
+  new_pwm->capture_fd = -1;
+
+  if (file_valid(tmp_str))
+  {
+    new_pwm->capture_fd = file_open(tmp_str, O_SYNC | O_RDONLY);
+  }
+
   if (new_pwm->enable_fd < 0 || new_pwm->period_fd < 0 || new_pwm->duty_fd < 0)
   {
-    free(new_pwm);
 	  libsoc_pwm_debug(__func__, chip, pwm_num, "Failed to open pwm sysfs file: %d", new_pwm->enable_fd);
+
+    if (new_pwm->enable_fd >= 0)
+      file_close(new_pwm->enable_fd);
+
+    if (new_pwm->period_fd >= 0)
+      file_close(new_pwm->period_fd);
+
+    if (new_pwm->duty_fd >= 0)
+      file_close(new_pwm->duty_fd);
+
+    if (new_pwm->polarity_fd >= 0)
+      file_close(new_pwm->polarity_fd);
+
+    if (new_pwm->capture_fd >= 0)
+      file_close(new_pwm->capture_fd);
+
+    free(new_pwm);
     return NULL;
   }
 
@@ -124,19 +209,22 @@ pwm* libsoc_pwm_request (unsigned int chip, unsigned int pwm_num,
   new_pwm->pwm = pwm_num;
   new_pwm->shared = shared;
 
+  // State is read on first use by libsoc_pwm_set_config
+  new_pwm->period = -1;
+  new_pwm->duty = -1;
+  new_pwm->polarity = POLARITY_ERROR;
+  new_pwm->enabled = ENABLED_ERROR;
+
+  new_pwm->stats = libsoc_stats_new(LS_STATS_PWM,
+    LIBSOC_TRACE_PWM_ID(chip, pwm_num));
+
   return new_pwm;
 }
 
-int libsoc_pwm_free(pwm *pwm)
+static int libsoc_pwm_close(pwm *pwm)
 {
   char path[STR_BUF];
 
-  if (pwm == NULL)
-  {
-    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
-    return EXIT_FAILURE;
-  }
-
   libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "freeing pwm");
 
   if (file_close(pwm->enable_fd) < 0)
@@ -154,6 +242,19 @@ int libsoc_pwm_free(pwm *pwm)
     return EXIT_FAILURE;
   }
 
+  if (pwm->polarity_fd >= 0 && file_close(pwm->polarity_fd) < 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (pwm->capture_fd >= 0 && file_close(pwm->capture_fd) < 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  libsoc_stats_free(pwm->stats);
+  pwm->stats = NULL;
+
   if (pwm->shared == 1)
   {
     free(pwm);
@@ -177,9 +278,144 @@ int libsoc_pwm_free(pwm *pwm)
   return EXIT_SUCCESS;
 }
 
+pwm* libsoc_pwm_request (unsigned int chip, unsigned int pwm_num,
+  shared_mode mode)
+{
+  struct pwm_registry_entry *entry;
+  pwm *new_pwm;
+
+  pthread_mutex_lock(&pwm_registry_lock);
+
+  while (1)
+  {
+    for (entry = pwm_registry; entry; entry = entry->next)
+    {
+      if (entry->chip == chip && entry->pwm_num == pwm_num)
+      {
+        break;
+      }
+    }
+
+    if (entry == NULL || !entry->busy)
+    {
+      break;
+    }
+
+    // Being exported or unexported by another thread
+    pthread_cond_wait(&pwm_registry_cond, &pwm_registry_lock);
+  }
+
+  if (entry)
+  {
+    // Weak requests fail on exported channels, including our own
+    if (mode == LS_PWM_WEAK)
+    {
+      pthread_mutex_unlock(&pwm_registry_lock);
+      libsoc_pwm_debug(__func__, chip, pwm_num, "PWM already requested");
+      return NULL;
+    }
+
+    entry->refs++;
+    pthread_mutex_unlock(&pwm_registry_lock);
+
+    libsoc_pwm_debug(__func__, chip, pwm_num, "sharing PWM, %d references",
+      entry->refs);
+
+    return entry->pwm;
+  }
+
+  entry = malloc(sizeof(struct pwm_registry_entry));
+
+  if (entry == NULL)
+  {
+    pthread_mutex_unlock(&pwm_registry_lock);
+    return NULL;
+  }
+
+  entry->chip = chip;
+  entry->pwm_num = pwm_num;
+  entry->pwm = NULL;
+  entry->refs = 1;
+  entry->busy = 1;
+  entry->next = pwm_registry;
+  pwm_registry = entry;
+
+  pthread_mutex_unlock(&pwm_registry_lock);
+
+  new_pwm = libsoc_pwm_open(chip, pwm_num, mode);
+
+  pthread_mutex_lock(&pwm_registry_lock);
+
+  if (new_pwm)
+  {
+    entry->pwm = new_pwm;
+    entry->busy = 0;
+    pthread_cond_broadcast(&pwm_registry_cond);
+  }
+  else
+  {
+    libsoc_pwm_registry_remove(entry);
+  }
+
+  pthread_mutex_unlock(&pwm_registry_lock);
+
+  return new_pwm;
+}
+
+int libsoc_pwm_free(pwm *pwm)
+{
+  struct pwm_registry_entry *entry;
+  int ret;
+
+  if (pwm == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&pwm_registry_lock);
+
+  for (entry = pwm_registry; entry; entry = entry->next)
+  {
+    if (entry->pwm == pwm)
+    {
+      break;
+    }
+  }
+
+  if (entry && --entry->refs > 0)
+  {
+    pthread_mutex_unlock(&pwm_registry_lock);
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "dropped reference, PWM still in use");
+    return EXIT_SUCCESS;
+  }
+
+  // Held busy until unexported so a new request cannot race the unexport
+  if (entry)
+  {
+    entry->busy = 1;
+  }
+
+  pthread_mutex_unlock(&pwm_registry_lock);
+
+  ret = libsoc_pwm_close(pwm);
+
+  if (entry)
+  {
+    pthread_mutex_lock(&pwm_registry_lock);
+    libsoc_pwm_registry_remove(entry);
+    pthread_mutex_unlock(&pwm_registry_lock);
+  }
+
+  return ret;
+}
+
+
 int libsoc_pwm_set_enabled(pwm *pwm, pwm_enabled enabled)
 {
-  char path[STR_BUF];
+  uint64_t start;
+  int ret;
 
   if (pwm == NULL)
   {
@@ -195,9 +431,22 @@ int libsoc_pwm_set_enabled(pwm *pwm, pwm_enabled enabled)
   libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
     "setting enabled to %s", pwm_enabled_strings[enabled]);
 
-  sprintf(path, "/sys/class/pwm/pwmchip%d/pwm%d/enable", pwm->chip, pwm->pwm);
+  start = libsoc_io_begin(pwm->stats);
+
+  ret = file_write(pwm->enable_fd, pwm_enabled_strings[enabled], 1);
+
+  libsoc_io_end(start, pwm->stats, LS_TRACE_PWM_SET_ENABLED,
+    LIBSOC_TRACE_PWM_ID(pwm->chip, pwm->pwm), enabled, ret < 0 ? -1 : 0);
+
+  if (ret < 0)
+  {
+    pwm->enabled = ENABLED_ERROR;
+    return EXIT_FAILURE;
+  }
+
+  pwm->enabled = enabled;
 
-  return file_write_str(path, pwm_enabled_strings[enabled], 1);
+  return EXIT_SUCCESS;
 }
 
 pwm_enabled libsoc_pwm_get_enabled(pwm *pwm)
@@ -219,51 +468,91 @@ pwm_enabled libsoc_pwm_get_enabled(pwm *pwm)
   {
     libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
 		  "read as enabled");
-    return ENABLED;
+    pwm->enabled = ENABLED;
   }
   else if (val == 0)
   {
     libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
       "read as disabled");
-    return DISABLED;
+    pwm->enabled = DISABLED;
   }
   else
   {
-    return ENABLED_ERROR;
+    pwm->enabled = ENABLED_ERROR;
   }
+
+  return pwm->enabled;
 }
 
 int libsoc_pwm_set_period(pwm *pwm, unsigned int period)
 {
+  uint64_t start;
+  int ret;
+
   if (pwm == NULL)
   {
     libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
     return EXIT_FAILURE;
   }
 
-  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+  libsoc_pwm_trace(__func__, pwm->chip, pwm->pwm,
     "setting period to %d", period);
 
-  return file_write_int_fd(pwm->period_fd, period);
+  start = libsoc_io_begin(pwm->stats);
+
+  ret = file_write_int64_fd(pwm->period_fd, period);
+
+  libsoc_io_end(start, pwm->stats, LS_TRACE_PWM_SET_PERIOD,
+    LIBSOC_TRACE_PWM_ID(pwm->chip, pwm->pwm), period,
+    ret == EXIT_SUCCESS ? 0 : -1);
+
+  if (ret == EXIT_FAILURE)
+  {
+    pwm->period = -1;
+    return EXIT_FAILURE;
+  }
+
+  pwm->period = period;
+
+  return EXIT_SUCCESS;
 }
 
 int libsoc_pwm_set_duty_cycle(pwm *pwm, unsigned int duty)
 {
+  uint64_t start;
+  int ret;
+
   if (pwm == NULL)
   {
     libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
     return EXIT_FAILURE;
   }
 
-  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+  libsoc_pwm_trace(__func__, pwm->chip, pwm->pwm,
     "setting duty to %d", duty);
 
-  return file_write_int_fd(pwm->duty_fd, duty);
+  start = libsoc_io_begin(pwm->stats);
+
+  ret = file_write_int64_fd(pwm->duty_fd, duty);
+
+  libsoc_io_end(start, pwm->stats, LS_TRACE_PWM_SET_DUTY,
+    LIBSOC_TRACE_PWM_ID(pwm->chip, pwm->pwm), duty,
+    ret == EXIT_SUCCESS ? 0 : -1);
+
+  if (ret == EXIT_FAILURE)
+  {
+    pwm->duty = -1;
+    return EXIT_FAILURE;
+  }
+
+  pwm->duty = duty;
+
+  return EXIT_SUCCESS;
 }
 
-int libsoc_pwm_get_period(pwm *pwm)
+int64_t libsoc_pwm_get_period64(pwm *pwm)
 {
-  int period = -1;
+  int64_t period;
 
   if (pwm == NULL)
   {
@@ -271,16 +560,36 @@ int libsoc_pwm_get_period(pwm *pwm)
     return -1;
   }
 
-  file_read_int_fd(pwm->period_fd, &period);
+  if (file_read_int64_fd(pwm->period_fd, &period) == EXIT_FAILURE)
+  {
+    period = -1;
+  }
+
+  libsoc_pwm_trace(__func__, pwm->chip, pwm->pwm, "got period as %lld",
+    (long long) period);
 
-  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "got period as %d", period);
+  pwm->period = period;
 
   return period;
 }
 
-int libsoc_pwm_get_duty_cycle(pwm *pwm)
+int libsoc_pwm_get_period(pwm *pwm)
+{
+  int64_t period = libsoc_pwm_get_period64(pwm);
+
+  if (period > INT_MAX)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "period %lld does not fit an int", (long long) period);
+    return -1;
+  }
+
+  return period;
+}
+
+int64_t libsoc_pwm_get_duty_cycle64(pwm *pwm)
 {
-  int duty = -1;
+  int64_t duty;
 
   if (pwm == NULL)
   {
@@ -288,17 +597,35 @@ int libsoc_pwm_get_duty_cycle(pwm *pwm)
     return -1;
   }
 
-  file_read_int_fd(pwm->duty_fd, &duty);
+  if (file_read_int64_fd(pwm->duty_fd, &duty) == EXIT_FAILURE)
+  {
+    duty = -1;
+  }
 
-  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "got duty as %d", duty);
+  libsoc_pwm_trace(__func__, pwm->chip, pwm->pwm, "got duty as %lld",
+    (long long) duty);
+
+  pwm->duty = duty;
 
   return duty;
 }
 
-int libsoc_pwm_set_polarity(pwm *pwm, pwm_polarity polarity)
+int libsoc_pwm_get_duty_cycle(pwm *pwm)
 {
-  char path[STR_BUF];
+  int64_t duty = libsoc_pwm_get_duty_cycle64(pwm);
+
+  if (duty > INT_MAX)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "duty %lld does not fit an int", (long long) duty);
+    return -1;
+  }
+
+  return duty;
+}
 
+int libsoc_pwm_set_polarity(pwm *pwm, pwm_polarity polarity)
+{
   if (pwm == NULL)
   {
     libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
@@ -313,16 +640,27 @@ int libsoc_pwm_set_polarity(pwm *pwm, pwm_polarity polarity)
   libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
     "setting polarity to %s", pwm_polarity_strings[polarity]);
 
-  sprintf(path, "/sys/class/pwm/pwmchip%d/pwm%d/polarity", pwm->chip, pwm->pwm);
+  if (pwm->polarity_fd < 0)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "polarity not supported");
+    return EXIT_FAILURE;
+  }
+
+  if (file_write(pwm->polarity_fd, pwm_polarity_strings[polarity],
+    strlen(pwm_polarity_strings[polarity])) < 0)
+  {
+    pwm->polarity = POLARITY_ERROR;
+    return EXIT_FAILURE;
+  }
+
+  pwm->polarity = polarity;
 
-  return file_write_str(path, pwm_polarity_strings[polarity], STR_BUF);
+  return EXIT_SUCCESS;
 }
 
 int libsoc_pwm_get_polarity(pwm *pwm)
 {
   int polarity;
-  char path[STR_BUF];
-  char tmp_str[1];
 
   if (pwm == NULL)
   {
@@ -330,25 +668,13 @@ int libsoc_pwm_get_polarity(pwm *pwm)
     return EXIT_FAILURE;
   }
 
-  sprintf(path, "/sys/class/pwm/pwmchip%d/pwm%d/polarity", pwm->chip, pwm->pwm);
-
-  if (file_read_str(path, tmp_str, 1) == EXIT_FAILURE)
+  if (pwm->polarity_fd < 0)
   {
     return POLARITY_ERROR;
   }
 
-  if (strncmp(tmp_str, "i", 1) == 0)
-  {
-    polarity = INVERSED;
-  }
-  else if (strncmp(tmp_str, "n", 1) == 0)
-  {
-    polarity = NORMAL;
-  }
-  else
-  {
-    polarity = POLARITY_ERROR;
-  }
+  polarity = file_read_enum_fd(pwm->polarity_fd, pwm_polarity_table,
+    FILE_ENUM_NUM(pwm_polarity_table), POLARITY_ERROR);
 
   if (polarity >= 0)
   {
@@ -359,6 +685,754 @@ int libsoc_pwm_get_polarity(pwm *pwm)
     libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "getting polarity failed");
   }
 
+  pwm->polarity = polarity;
+
   return polarity;
 }
 
+int libsoc_pwm_set_config(pwm *pwm, unsigned int period, unsigned int duty,
+  pwm_polarity polarity, pwm_enabled enabled)
+{
+  if (pwm == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
+    return EXIT_FAILURE;
+  }
+
+  if (duty > period || (polarity != NORMAL && polarity != INVERSED) ||
+    (enabled != ENABLED && enabled != DISABLED))
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "invalid config");
+    return EXIT_FAILURE;
+  }
+
+  // Refuse before anything is written, so a running pwm is left running
+  if (polarity == INVERSED && pwm->polarity_fd < 0)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "polarity not supported");
+    return EXIT_FAILURE;
+  }
+
+  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+    "setting config to period %u, duty %u, polarity %s, enabled %s",
+    period, duty, pwm_polarity_strings[polarity],
+    pwm_enabled_strings[enabled]);
+
+  // Read back anything not known from a previous read or write
+  if (pwm->enabled == ENABLED_ERROR && libsoc_pwm_get_enabled(pwm) == ENABLED_ERROR)
+  {
+    return EXIT_FAILURE;
+  }
+
+  // Drivers without polarity support have no polarity file to read, and
+  // only run with normal polarity
+  if (pwm->polarity == POLARITY_ERROR &&
+    libsoc_pwm_get_polarity(pwm) == POLARITY_ERROR)
+  {
+    pwm->polarity = NORMAL;
+  }
+
+  if (pwm->period < 0 && libsoc_pwm_get_period64(pwm) < 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (pwm->duty < 0 && libsoc_pwm_get_duty_cycle64(pwm) < 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  // Most drivers refuse a polarity change while running
+  if (pwm->enabled != DISABLED &&
+    (enabled == DISABLED || polarity != pwm->polarity))
+  {
+    if (libsoc_pwm_set_enabled(pwm, DISABLED) == EXIT_FAILURE)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  // The duty may never exceed the period, so shrink the duty first when
+  // the new period is below the current duty
+  if ((int64_t) period < pwm->duty)
+  {
+    if (libsoc_pwm_set_duty_cycle(pwm, duty) == EXIT_FAILURE)
+    {
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ((int64_t) period != pwm->period &&
+    libsoc_pwm_set_period(pwm, period) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if ((int64_t) duty != pwm->duty &&
+    libsoc_pwm_set_duty_cycle(pwm, duty) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (polarity != pwm->polarity &&
+    libsoc_pwm_set_polarity(pwm, polarity) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+
+  if (enabled != pwm->enabled &&
+    libsoc_pwm_set_enabled(pwm, enabled) == EXIT_FAILURE)
+  {
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+
+pwm_group* libsoc_pwm_group_new(pwm **pwms, int num)
+{
+  pwm_group *group;
+  int i;
+
+  if (pwms == NULL || num <= 0)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm array");
+    return NULL;
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    if (pwms[i] == NULL)
+    {
+      libsoc_pwm_debug(__func__, -1, -1, "invalid pwm pointer");
+      return NULL;
+    }
+  }
+
+  group = calloc(1, sizeof(pwm_group));
+
+  if (group == NULL)
+  {
+    return NULL;
+  }
+
+  // Allocate everything up front so updates do no allocation
+  group->pwms = malloc(num * sizeof(pwm *));
+  group->bufs = malloc(num * GROUP_STR_BUF);
+  group->lens = malloc(num * sizeof(int));
+
+  if (group->pwms == NULL || group->bufs == NULL || group->lens == NULL)
+  {
+    libsoc_pwm_group_free(group);
+    return NULL;
+  }
+
+  memcpy(group->pwms, pwms, num * sizeof(pwm *));
+  group->num = num;
+
+  return group;
+}
+
+int libsoc_pwm_group_free(pwm_group *group)
+{
+  if (group == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm group pointer");
+    return EXIT_FAILURE;
+  }
+
+  free(group->pwms);
+  free(group->bufs);
+  free(group->lens);
+  free(group);
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_pwm_group_set_duty_cycles(pwm_group *group,
+  const unsigned int *duties)
+{
+  int i, ok, ret = EXIT_SUCCESS;
+  uint64_t start;
+  char *buf;
+  pwm *pwm;
+
+  if (group == NULL || duties == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm group or duties");
+    return EXIT_FAILURE;
+  }
+
+  // Format every value first, keeping the write loop as tight as possible
+  for (i = 0; i < group->num; i++)
+  {
+    pwm = group->pwms[i];
+    group->lens[i] = 0;
+
+    if (pwm->duty == (int64_t) duties[i])
+    {
+      continue;
+    }
+
+    if (pwm->period >= 0 && (int64_t) duties[i] > pwm->period)
+    {
+      libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+        "duty %u greater than period %lld", duties[i],
+        (long long) pwm->period);
+      ret = EXIT_FAILURE;
+      continue;
+    }
+
+    group->lens[i] = file_format_int(&group->bufs[i * GROUP_STR_BUF],
+      duties[i]);
+  }
+
+  for (i = 0; i < group->num; i++)
+  {
+    if (group->lens[i] == 0)
+    {
+      continue;
+    }
+
+    pwm = group->pwms[i];
+    buf = &group->bufs[i * GROUP_STR_BUF];
+
+    start = libsoc_io_begin(pwm->stats);
+
+    ok = write(pwm->duty_fd, buf, group->lens[i]) == group->lens[i];
+
+    libsoc_io_end(start, pwm->stats, LS_TRACE_PWM_SET_DUTY,
+      LIBSOC_TRACE_PWM_ID(pwm->chip, pwm->pwm), duties[i], ok ? 0 : -1);
+
+    if (ok)
+    {
+      pwm->duty = duties[i];
+    }
+    else
+    {
+      pwm->duty = -1;
+      ret = EXIT_FAILURE;
+    }
+  }
+
+  // Report failures only once every write has been issued
+  for (i = 0; i < group->num; i++)
+  {
+    if (group->lens[i] && group->pwms[i]->duty < 0)
+    {
+      libsoc_pwm_debug(__func__, group->pwms[i]->chip, group->pwms[i]->pwm,
+        "setting duty to %u failed", duties[i]);
+    }
+  }
+
+  return ret;
+}
+
+static void timespec_add_ns(struct timespec *ts, uint64_t ns)
+{
+  ns += ts->tv_nsec;
+  ts->tv_sec += ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+}
+
+static int64_t timespec_diff_ns(struct timespec *a, struct timespec *b)
+{
+  return (int64_t) (a->tv_sec - b->tv_sec) * 1000000000 +
+    (a->tv_nsec - b->tv_nsec);
+}
+
+static void *__libsoc_pwm_sequencer_thread(void *void_seq)
+{
+  pwm_sequencer *seq = void_seq;
+  pwm *pwm = seq->pwm;
+  struct timespec deadline, now;
+  uint64_t start;
+  int64_t late;
+  int i, loop, ok;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  for (loop = 0; seq->loops == 0 || loop < seq->loops; loop++)
+  {
+    for (i = 0; i < seq->num_steps; i++)
+    {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+
+      start = libsoc_io_begin(pwm->stats);
+
+      ok = write(pwm->duty_fd, &seq->bufs[i * GROUP_STR_BUF], seq->lens[i])
+        == seq->lens[i];
+
+      libsoc_io_end(start, pwm->stats, LS_TRACE_PWM_SET_DUTY,
+        LIBSOC_TRACE_PWM_ID(pwm->chip, pwm->pwm), seq->steps[i].duty,
+        ok ? 0 : -1);
+
+      if (!ok)
+      {
+        libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+          "writing step %d failed", i);
+      }
+
+      late = timespec_diff_ns(&now, &deadline);
+
+      if (late > 0 && (uint64_t) late > seq->stats.max_late_ns)
+      {
+        __atomic_store_n(&seq->stats.max_late_ns, late, __ATOMIC_RELAXED);
+      }
+
+      // Deadlines are absolute, so a late step shortens its own hold
+      // rather than delaying every step after it
+      timespec_add_ns(&deadline, seq->steps[i].hold_ns);
+
+      if (late > 0 && (uint64_t) late >= seq->steps[i].hold_ns)
+      {
+        __atomic_store_n(&seq->stats.underruns, seq->stats.underruns + 1,
+          __ATOMIC_RELAXED);
+      }
+
+      __atomic_store_n(&seq->stats.steps, seq->stats.steps + 1,
+        __ATOMIC_RELAXED);
+
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+        == EINTR);
+    }
+  }
+
+  // The pwm's cache belongs to its owner, who updates it once joined
+  __atomic_store_n(&seq->running, 0, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+static void libsoc_pwm_sequencer_join(pwm_sequencer *seq)
+{
+  pthread_join(seq->thread, NULL);
+  seq->joined = 1;
+
+  // A cancelled sequence leaves the last duty written unknown
+  if (__atomic_load_n(&seq->running, __ATOMIC_ACQUIRE))
+  {
+    seq->pwm->duty = -1;
+  }
+  else
+  {
+    seq->pwm->duty = seq->steps[seq->num_steps - 1].duty;
+  }
+}
+
+pwm_sequencer* libsoc_pwm_sequencer_start(pwm *pwm, const pwm_step *steps,
+  int num_steps, int loops, int priority)
+{
+  pwm_sequencer *seq;
+  pthread_attr_t attr;
+  struct sched_param param;
+  int64_t period;
+  int i, ret;
+
+  if (pwm == NULL || steps == NULL || num_steps <= 0 || loops < 0)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm or steps");
+    return NULL;
+  }
+
+  period = pwm->period >= 0 ? pwm->period : libsoc_pwm_get_period64(pwm);
+
+  if (period < 0)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm, "period is not set");
+    return NULL;
+  }
+
+  // The driver would refuse these mid sequence, refuse them up front
+  for (i = 0; i < num_steps; i++)
+  {
+    if ((int64_t) steps[i].duty > period)
+    {
+      libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+        "step %d duty %u is longer than the period %lld", i, steps[i].duty,
+        (long long) period);
+      return NULL;
+    }
+  }
+
+  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+    "starting sequence of %d steps", num_steps);
+
+  seq = calloc(1, sizeof(pwm_sequencer));
+
+  if (seq == NULL)
+  {
+    return NULL;
+  }
+
+  seq->pwm = pwm;
+  seq->num_steps = num_steps;
+  seq->loops = loops;
+  seq->steps = malloc(num_steps * sizeof(pwm_step));
+  seq->bufs = malloc(num_steps * GROUP_STR_BUF);
+  seq->lens = malloc(num_steps * sizeof(int));
+
+  if (seq->steps == NULL || seq->bufs == NULL || seq->lens == NULL)
+  {
+    goto error;
+  }
+
+  memcpy(seq->steps, steps, num_steps * sizeof(pwm_step));
+
+  // Format every step up front so the playback loop only writes
+  for (i = 0; i < num_steps; i++)
+  {
+    seq->lens[i] = file_format_int(&seq->bufs[i * GROUP_STR_BUF],
+      steps[i].duty);
+  }
+
+  seq->running = 1;
+
+  // The thread writes the duty cycle behind the cache's back
+  pwm->duty = -1;
+
+  pthread_attr_init(&attr);
+
+  if (priority > 0)
+  {
+    param.sched_priority = priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+
+  ret = pthread_create(&seq->thread, &attr, __libsoc_pwm_sequencer_thread, seq);
+
+  if (ret == EPERM)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "not permitted to use SCHED_FIFO, using default scheduler");
+
+    ret = pthread_create(&seq->thread, NULL, __libsoc_pwm_sequencer_thread,
+      seq);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0)
+  {
+    goto error;
+  }
+
+  return seq;
+
+error:
+
+  free(seq->steps);
+  free(seq->bufs);
+  free(seq->lens);
+  free(seq);
+
+  return NULL;
+}
+
+int libsoc_pwm_sequencer_running(pwm_sequencer *seq)
+{
+  if (seq == NULL)
+  {
+    return 0;
+  }
+
+  return __atomic_load_n(&seq->running, __ATOMIC_ACQUIRE);
+}
+
+int libsoc_pwm_sequencer_wait(pwm_sequencer *seq)
+{
+  if (seq == NULL || seq->loops == 0)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "sequencer invalid or loops forever");
+    return EXIT_FAILURE;
+  }
+
+  if (!seq->joined)
+  {
+    libsoc_pwm_sequencer_join(seq);
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_pwm_sequencer_get_stats(pwm_sequencer *seq,
+  pwm_sequencer_stats *stats)
+{
+  if (seq == NULL || stats == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+
+  stats->steps = __atomic_load_n(&seq->stats.steps, __ATOMIC_RELAXED);
+  stats->underruns = __atomic_load_n(&seq->stats.underruns, __ATOMIC_RELAXED);
+  stats->max_late_ns = __atomic_load_n(&seq->stats.max_late_ns,
+    __ATOMIC_RELAXED);
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_pwm_sequencer_free(pwm_sequencer *seq)
+{
+  if (seq == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid sequencer pointer");
+    return EXIT_FAILURE;
+  }
+
+  if (!seq->joined)
+  {
+    if (__atomic_load_n(&seq->running, __ATOMIC_ACQUIRE))
+    {
+      pthread_cancel(seq->thread);
+    }
+
+    libsoc_pwm_sequencer_join(seq);
+  }
+
+  libsoc_pwm_debug(__func__, seq->pwm->chip, seq->pwm->pwm,
+    "sequencer stopped after %lu steps, %lu underruns", seq->stats.steps,
+    seq->stats.underruns);
+
+  free(seq->steps);
+  free(seq->bufs);
+  free(seq->lens);
+  free(seq);
+
+  return EXIT_SUCCESS;
+}
+
+// Captures are "<period> <duty>\n", both in nanoseconds
+#define CAPTURE_STR_BUF 48
+
+int libsoc_pwm_capture(pwm *pwm, unsigned int *period, unsigned int *duty)
+{
+  char buf[CAPTURE_STR_BUF];
+  int64_t p, d;
+  char *space;
+  int len;
+
+  if (pwm == NULL || period == NULL || duty == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm or result pointer");
+    return EXIT_FAILURE;
+  }
+
+  if (pwm->capture_fd < 0)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "capture not supported by driver");
+    return EXIT_FAILURE;
+  }
+
+  len = file_read(pwm->capture_fd, buf, CAPTURE_STR_BUF - 1);
+
+  if (len <= 0)
+  {
+    return EXIT_FAILURE;
+  }
+
+  buf[len] = '\0';
+  space = strchr(buf, ' ');
+
+  if (space == NULL ||
+    file_parse_int(buf, space - buf, &p) == EXIT_FAILURE ||
+    file_parse_int(space + 1, len - (space + 1 - buf), &d) == EXIT_FAILURE ||
+    p < 0 || p > UINT_MAX || d < 0 || d > UINT_MAX)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "could not parse capture \"%s\"", buf);
+    return EXIT_FAILURE;
+  }
+
+  *period = p;
+  *duty = d;
+
+  return EXIT_SUCCESS;
+}
+
+static void *__libsoc_pwm_capture_thread(void *void_cap)
+{
+  pwm_capturer *cap = void_cap;
+  struct timespec deadline, now;
+  unsigned int period, duty;
+  int ret;
+
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (1)
+  {
+    ret = libsoc_pwm_capture(cap->pwm, &period, &duty);
+
+    pthread_mutex_lock(&cap->lock);
+
+    if (ret == EXIT_SUCCESS)
+    {
+      cap->periods[cap->head] = period;
+      cap->duties[cap->head] = duty;
+      cap->head = (cap->head + 1) % cap->window;
+
+      if (cap->samples < cap->window)
+      {
+        cap->samples++;
+      }
+    }
+    else
+    {
+      cap->errors++;
+    }
+
+    pthread_mutex_unlock(&cap->lock);
+
+    timespec_add_ns(&deadline, (uint64_t) cap->interval_ms * 1000000);
+
+    // A capture slower than the interval restarts the schedule from now
+    // rather than firing a burst of back to back captures
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (timespec_diff_ns(&now, &deadline) > 0)
+    {
+      deadline = now;
+    }
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL)
+      == EINTR);
+  }
+
+  return NULL;
+}
+
+pwm_capturer* libsoc_pwm_capture_start(pwm *pwm, int interval_ms,
+  int window)
+{
+  pwm_capturer *cap;
+
+  if (pwm == NULL || interval_ms <= 0 || window <= 0)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid pwm, interval or window");
+    return NULL;
+  }
+
+  if (pwm->capture_fd < 0)
+  {
+    libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+      "capture not supported by driver");
+    return NULL;
+  }
+
+  libsoc_pwm_debug(__func__, pwm->chip, pwm->pwm,
+    "capturing every %dms over a window of %d", interval_ms, window);
+
+  cap = calloc(1, sizeof(pwm_capturer));
+
+  if (cap == NULL)
+  {
+    return NULL;
+  }
+
+  cap->pwm = pwm;
+  cap->interval_ms = interval_ms;
+  cap->window = window;
+  cap->periods = malloc(window * sizeof(unsigned int));
+  cap->duties = malloc(window * sizeof(unsigned int));
+
+  if (cap->periods == NULL || cap->duties == NULL)
+  {
+    goto error;
+  }
+
+  pthread_mutex_init(&cap->lock, NULL);
+
+  if (pthread_create(&cap->thread, NULL, __libsoc_pwm_capture_thread, cap))
+  {
+    pthread_mutex_destroy(&cap->lock);
+    goto error;
+  }
+
+  return cap;
+
+error:
+
+  free(cap->periods);
+  free(cap->duties);
+  free(cap);
+
+  return NULL;
+}
+
+int libsoc_pwm_capture_get_stats(pwm_capturer *cap,
+  pwm_capture_stats *stats)
+{
+  uint64_t period_sum = 0, duty_sum = 0;
+  int i;
+
+  if (cap == NULL || stats == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid capturer or stats pointer");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&cap->lock);
+
+  stats->samples = cap->samples;
+  stats->errors = cap->errors;
+  stats->period_min = stats->duty_min = UINT_MAX;
+  stats->period_max = stats->duty_max = 0;
+
+  for (i = 0; i < cap->samples; i++)
+  {
+    if (cap->periods[i] < stats->period_min)
+      stats->period_min = cap->periods[i];
+
+    if (cap->periods[i] > stats->period_max)
+      stats->period_max = cap->periods[i];
+
+    if (cap->duties[i] < stats->duty_min)
+      stats->duty_min = cap->duties[i];
+
+    if (cap->duties[i] > stats->duty_max)
+      stats->duty_max = cap->duties[i];
+
+    period_sum += cap->periods[i];
+    duty_sum += cap->duties[i];
+  }
+
+  pthread_mutex_unlock(&cap->lock);
+
+  if (stats->samples == 0)
+  {
+    stats->period_min = stats->duty_min = 0;
+    stats->period_mean = stats->duty_mean = 0;
+    return EXIT_FAILURE;
+  }
+
+  stats->period_mean = period_sum / stats->samples;
+  stats->duty_mean = duty_sum / stats->samples;
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_pwm_capture_stop(pwm_capturer *cap)
+{
+  if (cap == NULL)
+  {
+    libsoc_pwm_debug(__func__, -1, -1, "invalid capturer pointer");
+    return EXIT_FAILURE;
+  }
+
+  libsoc_pwm_debug(__func__, cap->pwm->chip, cap->pwm->pwm,
+    "stopping capture");
+
+  // The lock is only held outside cancellation points, so it is free here
+  pthread_cancel(cap->thread);
+  pthread_join(cap->thread, NULL);
+
+  pthread_mutex_destroy(&cap->lock);
+  free(cap->periods);
+  free(cap->duties);
+  free(cap);
+
+  return EXIT_SUCCESS;
+}
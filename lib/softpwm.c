@@ -0,0 +1,647 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libsoc_log.h"
+#include "libsoc_softpwm.h"
+
+/*
+ * Software PWM on gpios. One thread per engine keeps the enabled channels
+ * sorted by their next edge, sleeps until the earliest one and then handles
+ * every edge due within SOFTPWM_BATCH_NS in a single pass, so channels with
+ * coincident edges are written back to back. The levels are worked out
+ * under the engine lock and written without it, with the engine marked as
+ * writing. Callers writing a level themselves do the same, and anything
+ * else waiting on the engine to be idle first, so a channel is never
+ * disabled or freed under a write.
+ */
+
+#define SOFTPWM_BATCH_NS 2000
+#define SOFTPWM_MAX_WRITES 64
+
+static void LIBSOC_PRINTER (3) libsoc_softpwm_debug_print (const char *func,
+  int gpio, char *format, ...)
+{
+  va_list args;
+
+  fprintf (stderr, "libsoc-softpwm-debug: ");
+
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+
+  if (gpio >= 0)
+  {
+    fprintf (stderr, " (%d, %s)", gpio, func);
+  }
+  else
+  {
+    fprintf (stderr, " (NULL, %s)", func);
+  }
+
+  fprintf (stderr, "\n");
+}
+
+#define libsoc_softpwm_debug(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_INFO, libsoc_softpwm_debug_print, __VA_ARGS__)
+
+static uint64_t softpwm_now()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int softpwm_active_level(softpwm *pwm)
+{
+  return pwm->polarity == INVERSED ? 0 : 1;
+}
+
+// Called without the engine lock, returns the level to record for the gpio
+static int softpwm_write(softpwm *pwm, int level)
+{
+  if (libsoc_gpio_set_level(pwm->gpio, level ? HIGH : LOW) == EXIT_FAILURE)
+  {
+    return -1;
+  }
+
+  return level;
+}
+
+static void softpwm_wait_idle(softpwm_engine *engine)
+{
+  while (engine->writing)
+  {
+    pthread_cond_wait(&engine->idle, &engine->lock);
+  }
+}
+
+// Write a level from a caller, entered and left with the engine lock held
+static void softpwm_set_level(softpwm_engine *engine, softpwm *pwm, int level)
+{
+  softpwm_wait_idle(engine);
+
+  if (pwm->level == level)
+  {
+    return;
+  }
+
+  engine->writing = 1;
+  pthread_mutex_unlock(&engine->lock);
+
+  level = softpwm_write(pwm, level);
+
+  pthread_mutex_lock(&engine->lock);
+
+  pwm->level = level;
+  engine->stats.writes++;
+  engine->writing = 0;
+  pthread_cond_broadcast(&engine->idle);
+}
+
+// Advance a channel past its due edge and return the level to drive
+static int softpwm_edge(softpwm_engine *engine, softpwm *pwm, uint64_t now)
+{
+  uint64_t edge = pwm->next_edge;
+
+  engine->stats.edges++;
+
+  if (now > edge)
+  {
+    engine->stats.total_late_ns += now - edge;
+
+    if (now - edge > engine->stats.max_late_ns)
+    {
+      engine->stats.max_late_ns = now - edge;
+    }
+  }
+
+  if (pwm->active)
+  {
+    pwm->active = 0;
+    pwm->next_edge = pwm->cycle_start + pwm->cur_period;
+
+    return !softpwm_active_level(pwm);
+  }
+
+  // New settings are only picked up at the start of a cycle
+  pwm->cur_period = pwm->period;
+  pwm->cur_duty = pwm->duty;
+  pwm->cycle_start = edge;
+
+  // Resynchronise rather than replay cycles missed by a long stall
+  if (now > edge + pwm->cur_period)
+  {
+    pwm->cycle_start = now;
+  }
+
+  pwm->next_edge = pwm->cycle_start + pwm->cur_period;
+
+  if (pwm->cur_duty == 0)
+  {
+    return !softpwm_active_level(pwm);
+  }
+
+  if (pwm->cur_duty < pwm->cur_period)
+  {
+    pwm->active = 1;
+    pwm->next_edge = pwm->cycle_start + pwm->cur_duty;
+  }
+
+  return softpwm_active_level(pwm);
+}
+
+// The list is nearly sorted after each pass, so insertion sort is linear
+static void softpwm_sort(softpwm_engine *engine)
+{
+  softpwm *tmp;
+  int i, j;
+
+  for (i = 1; i < engine->num_edges; i++)
+  {
+    tmp = engine->edges[i];
+
+    for (j = i; j > 0 && engine->edges[j - 1]->next_edge > tmp->next_edge; j--)
+    {
+      engine->edges[j] = engine->edges[j - 1];
+    }
+
+    engine->edges[j] = tmp;
+  }
+}
+
+static void *__libsoc_softpwm_thread(void *void_engine)
+{
+  softpwm_engine *engine = void_engine;
+  softpwm *due[SOFTPWM_MAX_WRITES];
+  int levels[SOFTPWM_MAX_WRITES];
+  struct timespec ts;
+  uint64_t now, deadline;
+  int i, n, level;
+
+  pthread_mutex_lock(&engine->lock);
+
+  while (!engine->stop)
+  {
+    // A caller is writing a level with the lock dropped
+    if (engine->writing)
+    {
+      pthread_cond_wait(&engine->idle, &engine->lock);
+      continue;
+    }
+
+    if (engine->num_edges == 0)
+    {
+      pthread_cond_wait(&engine->cond, &engine->lock);
+      continue;
+    }
+
+    deadline = engine->edges[0]->next_edge;
+    now = softpwm_now();
+
+    // Wait for the earliest edge, or for the edge list to change
+    if (deadline > now + SOFTPWM_BATCH_NS)
+    {
+      ts.tv_sec = deadline / 1000000000;
+      ts.tv_nsec = deadline % 1000000000;
+
+      pthread_cond_timedwait(&engine->cond, &engine->lock, &ts);
+      continue;
+    }
+
+    // Work out every due level first, any left over are due on the next pass
+    for (i = 0, n = 0; i < engine->num_edges && n < SOFTPWM_MAX_WRITES; i++)
+    {
+      if (engine->edges[i]->next_edge > now + SOFTPWM_BATCH_NS)
+      {
+        break;
+      }
+
+      level = softpwm_edge(engine, engine->edges[i], now);
+
+      if (engine->edges[i]->level != level)
+      {
+        due[n] = engine->edges[i];
+        levels[n++] = level;
+      }
+    }
+
+    softpwm_sort(engine);
+
+    if (n == 0)
+    {
+      continue;
+    }
+
+    // Then issue the writes back to back without the lock
+    engine->writing = 1;
+    pthread_mutex_unlock(&engine->lock);
+
+    for (i = 0; i < n; i++)
+    {
+      levels[i] = softpwm_write(due[i], levels[i]);
+    }
+
+    pthread_mutex_lock(&engine->lock);
+
+    for (i = 0; i < n; i++)
+    {
+      due[i]->level = levels[i];
+    }
+
+    engine->stats.writes += n;
+    engine->writing = 0;
+    pthread_cond_broadcast(&engine->idle);
+  }
+
+  pthread_mutex_unlock(&engine->lock);
+
+  return NULL;
+}
+
+softpwm_engine* libsoc_softpwm_engine_new(int priority)
+{
+  softpwm_engine *engine;
+  pthread_condattr_t cond_attr;
+  pthread_attr_t attr;
+  struct sched_param param;
+  int ret;
+
+  libsoc_softpwm_debug(__func__, -1, "starting softpwm engine");
+
+  engine = calloc(1, sizeof(softpwm_engine));
+
+  if (engine == NULL)
+  {
+    return NULL;
+  }
+
+  pthread_mutex_init(&engine->lock, NULL);
+
+  // Edge deadlines are on CLOCK_MONOTONIC
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&engine->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  pthread_cond_init(&engine->idle, NULL);
+
+  pthread_attr_init(&attr);
+
+  if (priority > 0)
+  {
+    param.sched_priority = priority;
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+    pthread_attr_setschedparam(&attr, &param);
+  }
+
+  ret = pthread_create(&engine->thread, &attr, __libsoc_softpwm_thread, engine);
+
+  if (ret == EPERM)
+  {
+    libsoc_softpwm_debug(__func__, -1,
+      "not permitted to use SCHED_FIFO, using default scheduler");
+
+    ret = pthread_create(&engine->thread, NULL, __libsoc_softpwm_thread,
+      engine);
+  }
+
+  pthread_attr_destroy(&attr);
+
+  if (ret != 0)
+  {
+    pthread_cond_destroy(&engine->idle);
+    pthread_cond_destroy(&engine->cond);
+    pthread_mutex_destroy(&engine->lock);
+    free(engine);
+    return NULL;
+  }
+
+  return engine;
+}
+
+int libsoc_softpwm_engine_free(softpwm_engine *engine)
+{
+  if (engine == NULL)
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid engine pointer");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&engine->lock);
+
+  if (engine->num_channels > 0)
+  {
+    pthread_mutex_unlock(&engine->lock);
+    libsoc_softpwm_debug(__func__, -1, "engine still has %d channels",
+      engine->num_channels);
+    return EXIT_FAILURE;
+  }
+
+  engine->stop = 1;
+  pthread_cond_signal(&engine->cond);
+  pthread_mutex_unlock(&engine->lock);
+
+  pthread_join(engine->thread, NULL);
+
+  libsoc_softpwm_debug(__func__, -1, "softpwm engine stopped after %lu edges",
+    engine->stats.edges);
+
+  pthread_cond_destroy(&engine->idle);
+  pthread_cond_destroy(&engine->cond);
+  pthread_mutex_destroy(&engine->lock);
+  free(engine->edges);
+  free(engine);
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_softpwm_engine_get_stats(softpwm_engine *engine,
+  softpwm_stats *stats)
+{
+  if (engine == NULL || stats == NULL)
+  {
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&engine->lock);
+  *stats = engine->stats;
+  pthread_mutex_unlock(&engine->lock);
+
+  return EXIT_SUCCESS;
+}
+
+softpwm* libsoc_softpwm_request(softpwm_engine *engine, gpio *gpio)
+{
+  softpwm *pwm, **edges;
+
+  if (engine == NULL || gpio == NULL)
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid engine or gpio pointer");
+    return NULL;
+  }
+
+  pwm = calloc(1, sizeof(softpwm));
+
+  if (pwm == NULL)
+  {
+    return NULL;
+  }
+
+  pwm->engine = engine;
+  pwm->gpio = gpio;
+  pwm->polarity = NORMAL;
+  pwm->enabled = DISABLED;
+  pwm->level = -1;
+
+  pthread_mutex_lock(&engine->lock);
+
+  // Size the edge list here so enabling a channel never allocates
+  edges = realloc(engine->edges, (engine->num_channels + 1) * sizeof(softpwm *));
+
+  if (edges == NULL)
+  {
+    pthread_mutex_unlock(&engine->lock);
+    free(pwm);
+    return NULL;
+  }
+
+  engine->edges = edges;
+  engine->num_channels++;
+
+  pthread_mutex_unlock(&engine->lock);
+
+  libsoc_softpwm_debug(__func__, gpio->gpio, "softpwm requested");
+
+  return pwm;
+}
+
+int libsoc_softpwm_free(softpwm *pwm)
+{
+  softpwm_engine *engine;
+
+  if (pwm == NULL)
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid softpwm pointer");
+    return EXIT_FAILURE;
+  }
+
+  engine = pwm->engine;
+
+  libsoc_softpwm_set_enabled(pwm, DISABLED);
+
+  pthread_mutex_lock(&engine->lock);
+  engine->num_channels--;
+  pthread_mutex_unlock(&engine->lock);
+
+  free(pwm);
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_softpwm_set_enabled(softpwm *pwm, pwm_enabled enabled)
+{
+  softpwm_engine *engine;
+  int i;
+
+  if (pwm == NULL || (enabled != ENABLED && enabled != DISABLED))
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid softpwm pointer or state");
+    return EXIT_FAILURE;
+  }
+
+  engine = pwm->engine;
+
+  pthread_mutex_lock(&engine->lock);
+
+  if (pwm->enabled == enabled)
+  {
+    pthread_mutex_unlock(&engine->lock);
+    return EXIT_SUCCESS;
+  }
+
+  if (enabled == ENABLED)
+  {
+    if (pwm->period == 0)
+    {
+      pthread_mutex_unlock(&engine->lock);
+      libsoc_softpwm_debug(__func__, pwm->gpio->gpio,
+        "period must be set before enabling");
+      return EXIT_FAILURE;
+    }
+
+    pwm->active = 0;
+    pwm->next_edge = softpwm_now();
+
+    // Due now, so it belongs at the front of the edge list
+    memmove(&engine->edges[1], &engine->edges[0],
+      engine->num_edges * sizeof(softpwm *));
+    engine->edges[0] = pwm;
+    engine->num_edges++;
+  }
+  else
+  {
+    for (i = 0; i < engine->num_edges; i++)
+    {
+      if (engine->edges[i] == pwm)
+      {
+        memmove(&engine->edges[i], &engine->edges[i + 1],
+          (engine->num_edges - i - 1) * sizeof(softpwm *));
+        engine->num_edges--;
+        break;
+      }
+    }
+
+    pwm->active = 0;
+
+    // The engine may be writing this channel, the write waits it out
+    softpwm_set_level(engine, pwm, !softpwm_active_level(pwm));
+  }
+
+  pwm->enabled = enabled;
+
+  pthread_cond_signal(&engine->cond);
+  pthread_mutex_unlock(&engine->lock);
+
+  return EXIT_SUCCESS;
+}
+
+pwm_enabled libsoc_softpwm_get_enabled(softpwm *pwm)
+{
+  if (pwm == NULL)
+  {
+    return ENABLED_ERROR;
+  }
+
+  return pwm->enabled;
+}
+
+int libsoc_softpwm_set_period(softpwm *pwm, unsigned int period)
+{
+  if (pwm == NULL || period == 0)
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid softpwm pointer or period");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&pwm->engine->lock);
+
+  if (period < pwm->duty)
+  {
+    pthread_mutex_unlock(&pwm->engine->lock);
+    libsoc_softpwm_debug(__func__, pwm->gpio->gpio, "period %u below duty %u",
+      period, pwm->duty);
+    return EXIT_FAILURE;
+  }
+
+  pwm->period = period;
+
+  pthread_mutex_unlock(&pwm->engine->lock);
+
+  return EXIT_SUCCESS;
+}
+
+int libsoc_softpwm_get_period(softpwm *pwm)
+{
+  if (pwm == NULL)
+  {
+    return -1;
+  }
+
+  return pwm->period;
+}
+
+int libsoc_softpwm_set_duty_cycle(softpwm *pwm, unsigned int duty)
+{
+  return libsoc_softpwm_set_duty_cycles(&pwm, &duty, 1);
+}
+
+int libsoc_softpwm_get_duty_cycle(softpwm *pwm)
+{
+  if (pwm == NULL)
+  {
+    return -1;
+  }
+
+  return pwm->duty;
+}
+
+int libsoc_softpwm_set_polarity(softpwm *pwm, pwm_polarity polarity)
+{
+  if (pwm == NULL || (polarity != NORMAL && polarity != INVERSED))
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid softpwm pointer or polarity");
+    return EXIT_FAILURE;
+  }
+
+  pthread_mutex_lock(&pwm->engine->lock);
+
+  pwm->polarity = polarity;
+
+  // A disabled channel holds its inactive level, which has just changed
+  if (pwm->enabled == DISABLED && pwm->level >= 0)
+  {
+    softpwm_set_level(pwm->engine, pwm, !softpwm_active_level(pwm));
+  }
+
+  pthread_mutex_unlock(&pwm->engine->lock);
+
+  return EXIT_SUCCESS;
+}
+
+pwm_polarity libsoc_softpwm_get_polarity(softpwm *pwm)
+{
+  if (pwm == NULL)
+  {
+    return POLARITY_ERROR;
+  }
+
+  return pwm->polarity;
+}
+
+int libsoc_softpwm_set_duty_cycles(softpwm **pwms, const unsigned int *duties,
+  int num)
+{
+  softpwm_engine *engine;
+  int i;
+
+  if (pwms == NULL || duties == NULL || num <= 0 || pwms[0] == NULL)
+  {
+    libsoc_softpwm_debug(__func__, -1, "invalid softpwm or duty array");
+    return EXIT_FAILURE;
+  }
+
+  engine = pwms[0]->engine;
+
+  pthread_mutex_lock(&engine->lock);
+
+  for (i = 0; i < num; i++)
+  {
+    if (pwms[i] == NULL || pwms[i]->engine != engine ||
+      duties[i] > pwms[i]->period)
+    {
+      pthread_mutex_unlock(&engine->lock);
+      libsoc_softpwm_debug(__func__, -1,
+        "channel %d invalid or duty above period", i);
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    pwms[i]->duty = duties[i];
+  }
+
+  pthread_mutex_unlock(&engine->lock);
+
+  return EXIT_SUCCESS;
+}
@@ -12,39 +12,38 @@
 #include <linux/spi/spidev.h>
 
 #include "libsoc_spi.h"
-#include "libsoc_debug.h"
+#include "libsoc_log.h"
 #include "libsoc_file.h"
 
-void
-libsoc_spi_debug (const char *func, spi * spi, char *format, ...)
+static void LIBSOC_PRINTER (3)
+libsoc_spi_debug_print (const char *func, spi * spi, char *format, ...)
 {
-#ifdef DEBUG
+  va_list args;
 
-  if (libsoc_get_debug ())
-    {
-      va_list args;
-
-      fprintf (stderr, "libsoc-spi-debug: ");
-
-      va_start (args, format);
-      vfprintf (stderr, format, args);
-      va_end (args);
+  fprintf (stderr, "libsoc-spi-debug: ");
 
-      if (spi == NULL)
-	{
-	  fprintf (stderr, " (NULL, %s)", func);
-	}
-      else
-	{
-	  fprintf (stderr, " (spidev%d.%d, %s)", spi->spi_dev,
-		   spi->chip_select, func);
-	}
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
 
-      fprintf (stderr, "\n");
+  if (spi == NULL)
+    {
+      fprintf (stderr, " (NULL, %s)", func);
     }
-#endif
+  else
+    {
+      fprintf (stderr, " (spidev%d.%d, %s)", spi->spi_dev,
+	       spi->chip_select, func);
+    }
+
+  fprintf (stderr, "\n");
 }
 
+#define libsoc_spi_debug(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_INFO, libsoc_spi_debug_print, __VA_ARGS__)
+#define libsoc_spi_trace(...) \
+  LIBSOC_LOG (LIBSOC_DEBUG_TRACE, libsoc_spi_debug_print, __VA_ARGS__)
+
 spi *
 libsoc_spi_init (uint16_t spidev_device, uint8_t chip_select)
 {
@@ -82,6 +81,10 @@ libsoc_spi_init (uint16_t spidev_device, uint8_t chip_select)
       goto error;
     }
 
+  spi_dev->stats = libsoc_stats_new (LS_STATS_SPI,
+				     LIBSOC_TRACE_SPI_ID (spidev_device,
+							  chip_select));
+
   return spi_dev;
 
 error:
@@ -96,7 +99,7 @@ libsoc_spi_set_bits_per_word (spi * spi, spi_bpw bpw)
 {
   if (bpw != BITS_8 && bpw != BITS_16)
     {
-      libsoc_spi_debug (__func__, spi, "bits per word was not BITS_8"
+      libsoc_spi_debug (__func__, spi, "bits per word %d was not BITS_8"
 			" or BITS_16", bpw);
       return EXIT_FAILURE;
     }
@@ -259,7 +262,7 @@ libsoc_spi_get_mode (spi * spi)
 int
 libsoc_spi_write (spi * spi, uint8_t * tx, uint32_t len)
 {
-  libsoc_spi_debug (__func__, spi, "performing write transfer of %d bytes",
+  libsoc_spi_trace (__func__, spi, "performing write transfer of %d bytes",
 		    len);
 
   if (spi == NULL || tx == NULL)
@@ -274,6 +277,7 @@ libsoc_spi_write (spi * spi, uint8_t * tx, uint32_t len)
       return EXIT_FAILURE;
     }
 
+  uint64_t start;
   int ret;
 
   struct spi_ioc_transfer tr = {
@@ -281,8 +285,14 @@ libsoc_spi_write (spi * spi, uint8_t * tx, uint32_t len)
     .len = len,
   };
 
+  start = libsoc_io_begin (spi->stats);
+
   ret = ioctl (spi->fd, SPI_IOC_MESSAGE (1), &tr);
 
+  libsoc_io_end (start, spi->stats, LS_TRACE_SPI_WRITE,
+		 LIBSOC_TRACE_SPI_ID (spi->spi_dev, spi->chip_select), len,
+		 ret);
+
   if (ret < 1)
   {
     libsoc_spi_debug (__func__, spi, "failed sending message");
@@ -295,7 +305,7 @@ libsoc_spi_write (spi * spi, uint8_t * tx, uint32_t len)
 int
 libsoc_spi_read (spi * spi, uint8_t * rx, uint32_t len)
 {
-  libsoc_spi_debug (__func__, spi, "performing read transfer of %d bytes",
+  libsoc_spi_trace (__func__, spi, "performing read transfer of %d bytes",
 		    len);
 
   if (spi == NULL || rx == NULL)
@@ -310,6 +320,7 @@ libsoc_spi_read (spi * spi, uint8_t * rx, uint32_t len)
       return EXIT_FAILURE;
     }
 
+  uint64_t start;
   int ret;
 
   struct spi_ioc_transfer tr = {
@@ -317,8 +328,14 @@ libsoc_spi_read (spi * spi, uint8_t * rx, uint32_t len)
     .len = len,
   };
 
+  start = libsoc_io_begin (spi->stats);
+
   ret = ioctl (spi->fd, SPI_IOC_MESSAGE (1), &tr);
 
+  libsoc_io_end (start, spi->stats, LS_TRACE_SPI_READ,
+		 LIBSOC_TRACE_SPI_ID (spi->spi_dev, spi->chip_select), len,
+		 ret);
+
   if (ret < 1)
     {
       libsoc_spi_debug (__func__, spi, "failed recieving message");
@@ -331,7 +348,7 @@ libsoc_spi_read (spi * spi, uint8_t * rx, uint32_t len)
 int
 libsoc_spi_rw (spi * spi, uint8_t * tx, uint8_t * rx, uint32_t len)
 {
-  libsoc_spi_debug (__func__, spi,
+  libsoc_spi_trace (__func__, spi,
 		    "performing duplex rw transfer of %d bytes", len);
 
   if (spi == NULL || rx == NULL || tx == NULL)
@@ -346,6 +363,7 @@ libsoc_spi_rw (spi * spi, uint8_t * tx, uint8_t * rx, uint32_t len)
       return EXIT_FAILURE;
     }
 
+  uint64_t start;
   int ret;
 
   struct spi_ioc_transfer tr = {
@@ -354,8 +372,14 @@ libsoc_spi_rw (spi * spi, uint8_t * tx, uint8_t * rx, uint32_t len)
     .len = len,
   };
 
+  start = libsoc_io_begin (spi->stats);
+
   ret = ioctl (spi->fd, SPI_IOC_MESSAGE (1), &tr);
 
+  libsoc_io_end (start, spi->stats, LS_TRACE_SPI_RW,
+		 LIBSOC_TRACE_SPI_ID (spi->spi_dev, spi->chip_select), len,
+		 ret);
+
   if (ret < 1)
   {
     libsoc_spi_debug (__func__, spi, "failed duplex transfer");
@@ -379,6 +403,8 @@ libsoc_spi_free (spi * spi)
   if (file_close (spi->fd) < 0)
     return EXIT_FAILURE;
 
+  libsoc_stats_free (spi->stats);
+
   free (spi);
 
   return EXIT_SUCCESS;
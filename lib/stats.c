@@ -0,0 +1,233 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libsoc_log.h"
+#include "libsoc_stats.h"
+
+/*
+ * Per handle counters. Handles opened while counting is enabled get an
+ * io_stats, which the hardware paths update with relaxed atomics so a
+ * handle shared between threads still counts every operation. The
+ * registry of counters is only locked to add, remove or copy them.
+ */
+
+struct stats_entry
+{
+  io_stats stats;
+  struct stats_entry *next;
+  struct stats_entry **prev;
+};
+
+static int stats_enabled;
+static struct stats_entry *stats_entries;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t
+libsoc_io_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+
+  // Never 0, which marks an operation that is not measured
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+}
+
+static void
+libsoc_stats_update (io_stats * stats, uint64_t ns, uint32_t bytes,
+		     int failed)
+{
+  uint64_t max;
+  int bucket;
+
+  bucket = ns ? 64 - __builtin_clzll (ns) : 0;
+
+  if (bucket >= LIBSOC_STATS_BUCKETS)
+    bucket = LIBSOC_STATS_BUCKETS - 1;
+
+  __atomic_fetch_add (&stats->ops, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&stats->total_ns, ns, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&stats->latency[bucket], 1, __ATOMIC_RELAXED);
+
+  if (bytes)
+    __atomic_fetch_add (&stats->bytes, bytes, __ATOMIC_RELAXED);
+
+  if (failed)
+    __atomic_fetch_add (&stats->errors, 1, __ATOMIC_RELAXED);
+
+  max = __atomic_load_n (&stats->max_ns, __ATOMIC_RELAXED);
+
+  while (ns > max &&
+	 !__atomic_compare_exchange_n (&stats->max_ns, &max, ns, 1,
+				       __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+void
+libsoc_io_record (uint64_t start, io_stats * stats, int op, uint32_t device,
+		  uint32_t length, int32_t result)
+{
+  int saved_errno = errno;
+  uint64_t end = libsoc_io_now ();
+  uint32_t bytes = 0;
+
+  // Only SPI and I2C lengths are in bytes
+  if (op >= LS_TRACE_SPI_WRITE && op <= LS_TRACE_I2C_READ && result >= 0)
+    bytes = length;
+
+  if (stats)
+    libsoc_stats_update (stats, end - start, bytes, result < 0);
+
+  if (__atomic_load_n (&libsoc_trace_on, __ATOMIC_RELAXED))
+    libsoc_trace_record (start, end, op, device, length, result,
+			 result < 0 ? saved_errno : 0);
+
+  errno = saved_errno;
+}
+
+io_stats *
+libsoc_stats_new (stats_type type, uint32_t device)
+{
+  struct stats_entry *entry;
+
+  if (!__atomic_load_n (&stats_enabled, __ATOMIC_RELAXED))
+    return NULL;
+
+  entry = calloc (1, sizeof (struct stats_entry));
+
+  if (entry == NULL)
+    {
+      libsoc_debug (__func__, "failed to allocate counters");
+      return NULL;
+    }
+
+  entry->stats.type = type;
+  entry->stats.device = device;
+
+  pthread_mutex_lock (&stats_lock);
+
+  entry->next = stats_entries;
+  entry->prev = &stats_entries;
+
+  if (stats_entries)
+    stats_entries->prev = &entry->next;
+
+  stats_entries = entry;
+
+  pthread_mutex_unlock (&stats_lock);
+
+  return &entry->stats;
+}
+
+void
+libsoc_stats_free (io_stats * stats)
+{
+  struct stats_entry *entry = (struct stats_entry *) stats;
+
+  if (stats == NULL)
+    return;
+
+  pthread_mutex_lock (&stats_lock);
+
+  *entry->prev = entry->next;
+
+  if (entry->next)
+    entry->next->prev = entry->prev;
+
+  pthread_mutex_unlock (&stats_lock);
+
+  free (entry);
+}
+
+void
+libsoc_stats_enable (int enable)
+{
+  libsoc_debug (__func__, "%s counters", enable ? "enabling" : "disabling");
+
+  __atomic_store_n (&stats_enabled, enable != 0, __ATOMIC_RELAXED);
+}
+
+static void
+libsoc_stats_copy (io_stats * dst, io_stats * src)
+{
+  int i;
+
+  dst->type = src->type;
+  dst->device = src->device;
+  dst->ops = __atomic_load_n (&src->ops, __ATOMIC_RELAXED);
+  dst->bytes = __atomic_load_n (&src->bytes, __ATOMIC_RELAXED);
+  dst->errors = __atomic_load_n (&src->errors, __ATOMIC_RELAXED);
+  dst->total_ns = __atomic_load_n (&src->total_ns, __ATOMIC_RELAXED);
+  dst->max_ns = __atomic_load_n (&src->max_ns, __ATOMIC_RELAXED);
+
+  for (i = 0; i < LIBSOC_STATS_BUCKETS; i++)
+    dst->latency[i] = __atomic_load_n (&src->latency[i], __ATOMIC_RELAXED);
+}
+
+int
+libsoc_stats_snapshot (io_stats * stats, int max)
+{
+  struct stats_entry *entry;
+  int num = 0;
+
+  if (stats == NULL && max > 0)
+    return -1;
+
+  pthread_mutex_lock (&stats_lock);
+
+  for (entry = stats_entries; entry; entry = entry->next)
+    {
+      if (num < max)
+	libsoc_stats_copy (&stats[num], &entry->stats);
+
+      num++;
+    }
+
+  pthread_mutex_unlock (&stats_lock);
+
+  return num;
+}
+
+uint64_t
+libsoc_stats_percentile (const io_stats * stats, double percentile)
+{
+  uint64_t count = 0, target, bound;
+  double rank;
+  int i;
+
+  if (stats == NULL || stats->ops == 0)
+    return 0;
+
+  if (percentile < 0)
+    percentile = 0;
+
+  if (percentile > 100)
+    percentile = 100;
+
+  // The rank of the percentile, rounded up
+  rank = stats->ops * percentile / 100;
+  target = rank;
+
+  if (target < rank || target == 0)
+    target++;
+
+  for (i = 0; i < LIBSOC_STATS_BUCKETS - 1; i++)
+    {
+      count += stats->latency[i];
+
+      if (count >= target)
+	break;
+    }
+
+  if (i == LIBSOC_STATS_BUCKETS - 1)
+    return stats->max_ns;
+
+  bound = i ? (1ULL << i) - 1 : 0;
+
+  return bound < stats->max_ns ? bound : stats->max_ns;
+}
@@ -0,0 +1,615 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libsoc_log.h"
+#include "libsoc_stats.h"
+
+/*
+ * OpenMetrics text exporter for the handle counters. The counters are
+ * copied with libsoc_stats_snapshot, which never blocks the hardware paths,
+ * then handles on the same device are merged and formatted without holding
+ * any lock. A single thread serves one scrape at a time, over plain HTTP
+ * for Prometheus or as the bare text for other clients. Client sockets are
+ * non-blocking with one deadline for the request and one for the response,
+ * so a slow client can neither hold up later scrapes for long nor keep the
+ * exporter from stopping.
+ */
+
+#define EXPORT_REQUEST_MAX 1024
+
+// Milliseconds allowed for a client's whole request and whole response
+#define EXPORT_REQUEST_TIMEOUT 1000
+#define EXPORT_RESPONSE_TIMEOUT 5000
+
+struct export_buf
+{
+  char *buf;
+  size_t len;
+  size_t pos;
+};
+
+static int export_fd = -1;
+static int export_stop_fd = -1;
+static char export_path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+static pthread_t export_thread;
+static pthread_mutex_t export_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *stats_type_names[] = {
+  [LS_STATS_GPIO] = "gpio",
+  [LS_STATS_SPI] = "spi",
+  [LS_STATS_I2C] = "i2c",
+  [LS_STATS_PWM] = "pwm",
+};
+
+static void
+export_printf (struct export_buf *out, const char *format, ...)
+{
+  va_list args;
+  int len;
+
+  va_start (args, format);
+
+  if (out->pos < out->len)
+    len = vsnprintf (out->buf + out->pos, out->len - out->pos, format, args);
+  else
+    len = vsnprintf (NULL, 0, format, args);
+
+  va_end (args);
+
+  if (len > 0)
+    out->pos += len;
+}
+
+static int
+export_cmp (const void *a, const void *b)
+{
+  const io_stats *sa = a, *sb = b;
+
+  if (sa->type != sb->type)
+    return sa->type < sb->type ? -1 : 1;
+
+  if (sa->device != sb->device)
+    return sa->device < sb->device ? -1 : 1;
+
+  return 0;
+}
+
+// Sum the counters of handles on the same device, returns the new count
+static int
+export_merge (io_stats * stats, int num)
+{
+  int i, j, b;
+
+  qsort (stats, num, sizeof (io_stats), export_cmp);
+
+  for (i = 0, j = 1; j < num; j++)
+    {
+      if (export_cmp (&stats[i], &stats[j]) != 0)
+	{
+	  stats[++i] = stats[j];
+	  continue;
+	}
+
+      stats[i].ops += stats[j].ops;
+      stats[i].bytes += stats[j].bytes;
+      stats[i].errors += stats[j].errors;
+      stats[i].total_ns += stats[j].total_ns;
+
+      if (stats[j].max_ns > stats[i].max_ns)
+	stats[i].max_ns = stats[j].max_ns;
+
+      for (b = 0; b < LIBSOC_STATS_BUCKETS; b++)
+	stats[i].latency[b] += stats[j].latency[b];
+    }
+
+  return num ? i + 1 : 0;
+}
+
+// Labels of a device, named as by the libsoc_trace tool
+static void
+export_labels (char *buf, size_t len, const io_stats * stats)
+{
+  const char *type = "unknown";
+
+  if (stats->type >= LS_STATS_GPIO && stats->type <= LS_STATS_PWM)
+    type = stats_type_names[stats->type];
+
+  switch (stats->type)
+    {
+    case LS_STATS_SPI:
+      snprintf (buf, len, "type=\"%s\",device=\"spidev%u.%u\"", type,
+		stats->device >> 8, stats->device & 0xff);
+      break;
+
+    case LS_STATS_I2C:
+      snprintf (buf, len, "type=\"%s\",device=\"i2c-%u@0x%02x\"", type,
+		stats->device >> 8, stats->device & 0xff);
+      break;
+
+    case LS_STATS_PWM:
+      snprintf (buf, len, "type=\"%s\",device=\"pwmchip%u/pwm%u\"", type,
+		stats->device >> 16, stats->device & 0xffff);
+      break;
+
+    default:
+      snprintf (buf, len, "type=\"%s\",device=\"gpio%u\"", type,
+		stats->device);
+      break;
+    }
+}
+
+static void
+export_counter (struct export_buf *out, io_stats * stats, int num,
+		const char *name, const char *help, size_t offset)
+{
+  char labels[80];
+  int i;
+
+  export_printf (out, "# TYPE %s counter\n# HELP %s %s\n", name, name, help);
+
+  for (i = 0; i < num; i++)
+    {
+      export_labels (labels, sizeof (labels), &stats[i]);
+      export_printf (out, "%s_total{%s} %llu\n", name, labels,
+		     (unsigned long long) *(uint64_t *) ((char *) &stats[i] +
+							  offset));
+    }
+}
+
+static void
+export_histogram (struct export_buf *out, io_stats * stats, int num)
+{
+  const char *name = "libsoc_latency_seconds";
+  unsigned long long count;
+  char labels[80];
+  int i, b;
+
+  export_printf (out, "# TYPE %s histogram\n# UNIT %s seconds\n"
+		 "# HELP %s Latency of the operations.\n", name, name, name);
+
+  for (i = 0; i < num; i++)
+    {
+      export_labels (labels, sizeof (labels), &stats[i]);
+
+      // Bucket b holds latencies below 2^b ns, the last one is +Inf
+      for (b = 0, count = 0; b < LIBSOC_STATS_BUCKETS - 1; b++)
+	{
+	  count += stats[i].latency[b];
+	  export_printf (out, "%s_bucket{%s,le=\"%.9g\"} %llu\n", name, labels,
+			 ((1ULL << b) - 1) / 1e9, count);
+	}
+
+      export_printf (out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, labels,
+		     (unsigned long long) stats[i].ops);
+      export_printf (out, "%s_sum{%s} %.9f\n", name, labels,
+		     stats[i].total_ns / 1e9);
+      export_printf (out, "%s_count{%s} %llu\n", name, labels,
+		     (unsigned long long) stats[i].ops);
+    }
+}
+
+int
+libsoc_stats_format (char *buf, size_t len)
+{
+  struct export_buf out = { buf, buf ? len : 0, 0 };
+  io_stats *stats = NULL, *tmp;
+  int num, max = 0;
+
+  // Handles may be opened while copying, so grow until they all fit
+  while ((num = libsoc_stats_snapshot (stats, max)) > max)
+    {
+      max = num + 8;
+      tmp = realloc (stats, max * sizeof (io_stats));
+
+      if (tmp == NULL)
+	{
+	  free (stats);
+	  return -1;
+	}
+
+      stats = tmp;
+    }
+
+  if (num < 0)
+    {
+      free (stats);
+      return -1;
+    }
+
+  num = export_merge (stats, num);
+
+  export_counter (&out, stats, num, "libsoc_operations",
+		  "Operations issued through libsoc handles.",
+		  offsetof (io_stats, ops));
+  export_counter (&out, stats, num, "libsoc_bytes",
+		  "Bytes transferred by SPI and I2C operations.",
+		  offsetof (io_stats, bytes));
+  export_counter (&out, stats, num, "libsoc_errors",
+		  "Operations which failed.", offsetof (io_stats, errors));
+  export_histogram (&out, stats, num);
+  export_printf (&out, "# EOF\n");
+
+  free (stats);
+
+  return out.pos;
+}
+
+static uint64_t
+export_now_ms ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Wait for a client socket to become ready, returns 0 once the deadline
+ * has passed or the exporter is being stopped
+ */
+static int
+export_wait (int fd, short events, uint64_t deadline)
+{
+  struct pollfd pfds[2];
+  int64_t left;
+  int ret;
+
+  pfds[0].fd = fd;
+  pfds[0].events = events;
+  pfds[1].fd = export_stop_fd;
+  pfds[1].events = POLLIN;
+
+  while (1)
+    {
+      left = (int64_t) (deadline - export_now_ms ());
+
+      if (left <= 0)
+	return 0;
+
+      ret = poll (pfds, 2, left);
+
+      if (ret < 0 && errno == EINTR)
+	continue;
+
+      return ret > 0 && !pfds[1].revents;
+    }
+}
+
+static int
+export_write (int fd, const char *buf, size_t len, uint64_t deadline)
+{
+  ssize_t ret;
+
+  while (len > 0)
+    {
+      ret = send (fd, buf, len, MSG_NOSIGNAL);
+
+      if (ret < 0 && errno == EINTR)
+	continue;
+
+      if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+	  if (!export_wait (fd, POLLOUT, deadline))
+	    return EXIT_FAILURE;
+
+	  continue;
+	}
+
+      if (ret <= 0)
+	return EXIT_FAILURE;
+
+      buf += ret;
+      len -= ret;
+    }
+
+  return EXIT_SUCCESS;
+}
+
+/*
+ * Read the request of a client, returns 1 if it is an HTTP GET. Clients
+ * which send nothing get the bare text once the timeout expires.
+ */
+static int
+export_read_request (int fd)
+{
+  char req[EXPORT_REQUEST_MAX + 1];
+  uint64_t deadline = export_now_ms () + EXPORT_REQUEST_TIMEOUT;
+  size_t len = 0;
+  ssize_t ret;
+
+  while (len < EXPORT_REQUEST_MAX && export_wait (fd, POLLIN, deadline))
+    {
+      ret = recv (fd, req + len, EXPORT_REQUEST_MAX - len, 0);
+
+      if (ret < 0 && (errno == EINTR || errno == EAGAIN ||
+		      errno == EWOULDBLOCK))
+	continue;
+
+      if (ret <= 0)
+	break;
+
+      len += ret;
+      req[len] = '\0';
+
+      if (strstr (req, "\r\n\r\n") || strstr (req, "\n\n"))
+	break;
+    }
+
+  return len >= 4 && memcmp (req, "GET ", 4) == 0;
+}
+
+static void
+export_serve (int fd)
+{
+  static const char header[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: application/openmetrics-text; version=1.0.0; "
+    "charset=utf-8\r\n"
+    "Connection: close\r\n\r\n";
+  char *buf = NULL, *tmp;
+  uint64_t deadline;
+  int http, len, size = 0;
+
+  http = export_read_request (fd);
+
+  while ((len = libsoc_stats_format (buf, size)) >= size)
+    {
+      if (len < 0)
+	{
+	  free (buf);
+	  return;
+	}
+
+      size = len + 4096;
+      tmp = realloc (buf, size);
+
+      if (tmp == NULL)
+	{
+	  free (buf);
+	  return;
+	}
+
+      buf = tmp;
+    }
+
+  deadline = export_now_ms () + EXPORT_RESPONSE_TIMEOUT;
+
+  if (http && export_write (fd, header, sizeof (header) - 1, deadline)
+      == EXIT_FAILURE)
+    {
+      free (buf);
+      return;
+    }
+
+  export_write (fd, buf, len, deadline);
+
+  free (buf);
+}
+
+static void *
+export_run (void *arg)
+{
+  struct pollfd pfds[2];
+  int fd;
+
+  pfds[0].fd = export_fd;
+  pfds[0].events = POLLIN;
+  pfds[1].fd = export_stop_fd;
+  pfds[1].events = POLLIN;
+
+  while (1)
+    {
+      if (poll (pfds, 2, -1) < 0)
+	{
+	  if (errno == EINTR)
+	    continue;
+
+	  libsoc_debug (__func__, "poll failed, exporter stopped");
+	  break;
+	}
+
+      if (pfds[1].revents)
+	break;
+
+      if (!(pfds[0].revents & POLLIN))
+	continue;
+
+      fd = accept (export_fd, NULL, NULL);
+
+      if (fd < 0)
+	continue;
+
+      if (fcntl (fd, F_SETFL, O_NONBLOCK) < 0)
+	{
+	  close (fd);
+	  continue;
+	}
+
+      export_serve (fd);
+
+      close (fd);
+    }
+
+  return NULL;
+}
+
+// Listen on a Unix socket path or a localhost TCP port
+static int
+export_listen (const char *address)
+{
+  struct sockaddr_un un;
+  struct sockaddr_in in;
+  struct stat st;
+  char *end;
+  long port;
+  int fd, one = 1;
+
+  port = strtol (address, &end, 10);
+
+  if (*address != '\0' && *end == '\0')
+    {
+      if (port < 1 || port > 65535)
+	return -1;
+
+      fd = socket (AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+      if (fd < 0)
+	return -1;
+
+      setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+      memset (&in, 0, sizeof (in));
+      in.sin_family = AF_INET;
+      in.sin_port = htons (port);
+      in.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+      if (bind (fd, (struct sockaddr *) &in, sizeof (in)) < 0)
+	{
+	  close (fd);
+	  return -1;
+	}
+
+      export_path[0] = '\0';
+    }
+  else
+    {
+      if (strlen (address) >= sizeof (un.sun_path))
+	return -1;
+
+      fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+      if (fd < 0)
+	return -1;
+
+      // Replace a socket left behind by an earlier process
+      if (lstat (address, &st) == 0 && S_ISSOCK (st.st_mode))
+	unlink (address);
+
+      memset (&un, 0, sizeof (un));
+      un.sun_family = AF_UNIX;
+      strcpy (un.sun_path, address);
+
+      if (bind (fd, (struct sockaddr *) &un, sizeof (un)) < 0)
+	{
+	  close (fd);
+	  return -1;
+	}
+
+      strcpy (export_path, address);
+    }
+
+  if (listen (fd, 8) < 0)
+    {
+      close (fd);
+
+      if (export_path[0])
+	unlink (export_path);
+
+      return -1;
+    }
+
+  return fd;
+}
+
+int
+libsoc_stats_export_start (const char *address)
+{
+  if (address == NULL)
+    return EXIT_FAILURE;
+
+  pthread_mutex_lock (&export_lock);
+
+  if (export_fd >= 0)
+    {
+      pthread_mutex_unlock (&export_lock);
+      libsoc_debug (__func__, "exporter already running");
+      return EXIT_FAILURE;
+    }
+
+  export_fd = export_listen (address);
+
+  if (export_fd < 0)
+    {
+      pthread_mutex_unlock (&export_lock);
+      libsoc_debug (__func__, "could not listen on %s", address);
+      return EXIT_FAILURE;
+    }
+
+  export_stop_fd = eventfd (0, EFD_CLOEXEC);
+
+  if (export_stop_fd < 0 ||
+      pthread_create (&export_thread, NULL, export_run, NULL) != 0)
+    {
+      libsoc_debug (__func__, "could not start the exporter thread");
+
+      if (export_stop_fd >= 0)
+	close (export_stop_fd);
+
+      close (export_fd);
+
+      if (export_path[0])
+	unlink (export_path);
+
+      export_fd = export_stop_fd = -1;
+      pthread_mutex_unlock (&export_lock);
+      return EXIT_FAILURE;
+    }
+
+  pthread_mutex_unlock (&export_lock);
+
+  libsoc_debug (__func__, "exporting counters on %s", address);
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_stats_export_stop ()
+{
+  uint64_t one = 1;
+
+  pthread_mutex_lock (&export_lock);
+
+  if (export_fd < 0)
+    {
+      pthread_mutex_unlock (&export_lock);
+      return EXIT_FAILURE;
+    }
+
+  if (write (export_stop_fd, &one, sizeof (one)) != sizeof (one))
+    libsoc_debug (__func__, "failed to signal the exporter thread");
+
+  pthread_join (export_thread, NULL);
+
+  close (export_stop_fd);
+  close (export_fd);
+
+  if (export_path[0])
+    unlink (export_path);
+
+  export_fd = export_stop_fd = -1;
+
+  pthread_mutex_unlock (&export_lock);
+
+  libsoc_debug (__func__, "exporter stopped");
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,561 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#include "libsoc_log.h"
+#include "libsoc_trace.h"
+
+/*
+ * Binary trace of the hardware paths. Each thread writes fixed size records
+ * into its own ring with no locks, publishing them by advancing the ring
+ * head. Before overwriting a slot the owner marks the record it is writing,
+ * readers copy records out and then check the mark, dropping any the owner
+ * may have overwritten while they were being copied.
+ *
+ * Rings are never freed. When a thread exits its ring is handed to the next
+ * thread that traces, which carries on from the same head so a stream keeps
+ * its place.
+ */
+
+#define TRACE_DEFAULT_RECORDS 4096
+#define TRACE_MAX_RECORDS (1 << 24)
+#define TRACE_DEFAULT_INTERVAL 100
+
+struct trace_ring
+{
+  uint64_t head;
+  uint64_t writing;
+  uint64_t drained;
+  uint32_t size;
+  uint32_t tid;
+  int in_use;
+  struct trace_ring *next;
+  trace_record records[];
+};
+
+int libsoc_trace_on;
+
+static struct trace_ring *trace_rings;
+static unsigned int trace_size = TRACE_DEFAULT_RECORDS;
+static __thread struct trace_ring *trace_ring;
+static pthread_key_t trace_key;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+
+static FILE *stream_file;
+static int stream_interval;
+static int stream_stop;
+static unsigned long stream_lost;
+static pthread_t stream_thread;
+static pthread_mutex_t stream_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stream_cond = PTHREAD_COND_INITIALIZER;
+
+static const char *trace_op_names[LS_TRACE_NUM_OPS] = {
+  [LS_TRACE_NONE] = "none",
+  [LS_TRACE_GPIO_SET_LEVEL] = "gpio_set_level",
+  [LS_TRACE_GPIO_GET_LEVEL] = "gpio_get_level",
+  [LS_TRACE_GPIO_POLL] = "gpio_poll",
+  [LS_TRACE_SPI_WRITE] = "spi_write",
+  [LS_TRACE_SPI_READ] = "spi_read",
+  [LS_TRACE_SPI_RW] = "spi_rw",
+  [LS_TRACE_I2C_WRITE] = "i2c_write",
+  [LS_TRACE_I2C_READ] = "i2c_read",
+  [LS_TRACE_PWM_SET_ENABLED] = "pwm_set_enabled",
+  [LS_TRACE_PWM_SET_PERIOD] = "pwm_set_period",
+  [LS_TRACE_PWM_SET_DUTY] = "pwm_set_duty",
+};
+
+static void
+trace_release (void *ring)
+{
+  __atomic_store_n (&((struct trace_ring *) ring)->in_use, 0,
+		    __ATOMIC_RELEASE);
+}
+
+static void
+trace_key_create (void)
+{
+  pthread_key_create (&trace_key, trace_release);
+}
+
+static struct trace_ring *
+trace_acquire (void)
+{
+  struct trace_ring *ring;
+  unsigned int size;
+  int unused = 0;
+
+  pthread_once (&trace_once, trace_key_create);
+
+  size = __atomic_load_n (&trace_size, __ATOMIC_RELAXED);
+
+  // Take over the ring of an exited thread before growing the list
+  for (ring = __atomic_load_n (&trace_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+    {
+      if (ring->size == size &&
+	  __atomic_compare_exchange_n (&ring->in_use, &unused, 1, 0,
+				       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	break;
+
+      unused = 0;
+    }
+
+  if (ring == NULL)
+    {
+      ring = calloc (1, sizeof (struct trace_ring) +
+		     size * sizeof (trace_record));
+
+      if (ring == NULL)
+	return NULL;
+
+      ring->size = size;
+      ring->in_use = 1;
+      ring->next = __atomic_load_n (&trace_rings, __ATOMIC_RELAXED);
+
+      while (!__atomic_compare_exchange_n (&trace_rings, &ring->next, ring, 1,
+					   __ATOMIC_RELEASE,
+					   __ATOMIC_RELAXED))
+	;
+    }
+
+  ring->tid = syscall (SYS_gettid);
+
+  pthread_setspecific (trace_key, ring);
+
+  return ring;
+}
+
+void
+libsoc_trace_record (uint64_t start, uint64_t end, int op, uint32_t device,
+		     uint32_t length, int32_t result, int error)
+{
+  struct trace_ring *ring = trace_ring;
+  trace_record *rec;
+  uint64_t head;
+
+  if (ring == NULL)
+    {
+      ring = trace_acquire ();
+
+      if (ring == NULL)
+	return;
+
+      trace_ring = ring;
+    }
+
+  head = ring->head;
+  rec = &ring->records[head & (ring->size - 1)];
+
+  // Readers which see any of the new contents also see the mark
+  __atomic_store_n (&ring->writing, head + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  rec->timestamp = start - 1;
+  rec->duration = end - start;
+  rec->tid = ring->tid;
+  rec->op = op;
+  rec->error = error;
+  rec->device = device;
+  rec->length = length;
+  rec->result = result;
+
+  __atomic_store_n (&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Copy the records of a ring from index from up to its head, returns the
+ * number copied and sets from to the head. Records which were overwritten
+ * before or during the copy are skipped.
+ */
+static int
+trace_copy (struct trace_ring *ring, uint64_t *from, trace_record *records)
+{
+  uint64_t head, first, valid, i;
+  int num;
+
+  head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+  first = head > ring->size ? head - ring->size : 0;
+
+  if (*from > first)
+    first = *from;
+
+  for (i = first; i < head; i++)
+    records[i - first] = ring->records[i & (ring->size - 1)];
+
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+
+  valid = __atomic_load_n (&ring->writing, __ATOMIC_RELAXED);
+  valid = valid > ring->size ? valid - ring->size : 0;
+
+  if (valid > head)
+    valid = head;
+
+  if (valid > first)
+    {
+      num = head - valid;
+      memmove (records, records + (valid - first), num * sizeof (*records));
+    }
+  else
+    {
+      num = head - first;
+    }
+
+  *from = head;
+
+  return num;
+}
+
+static int
+trace_cmp (const void *a, const void *b)
+{
+  const trace_record *ra = a, *rb = b;
+
+  if (ra->timestamp != rb->timestamp)
+    return ra->timestamp < rb->timestamp ? -1 : 1;
+
+  return 0;
+}
+
+// Copy every ring, sorted by time, the caller frees the records
+static int
+trace_collect (trace_record ** records)
+{
+  struct trace_ring *rings, *ring;
+  trace_record *buf;
+  size_t total = 0;
+  uint64_t from;
+  int num = 0;
+
+  // Rings are only ever pushed on the front, so this list stays the same
+  rings = __atomic_load_n (&trace_rings, __ATOMIC_ACQUIRE);
+
+  for (ring = rings; ring; ring = ring->next)
+    total += ring->size;
+
+  buf = malloc ((total ? total : 1) * sizeof (trace_record));
+
+  if (buf == NULL)
+    return -1;
+
+  for (ring = rings; ring; ring = ring->next)
+    {
+      from = 0;
+      num += trace_copy (ring, &from, buf + num);
+    }
+
+  qsort (buf, num, sizeof (trace_record), trace_cmp);
+
+  *records = buf;
+
+  return num;
+}
+
+int
+libsoc_trace_enable (unsigned int records)
+{
+  unsigned int size = 1;
+
+  if (records == 0)
+    records = TRACE_DEFAULT_RECORDS;
+
+  if (records > TRACE_MAX_RECORDS)
+    {
+      libsoc_debug (__func__, "%u trace records is too many", records);
+      return EXIT_FAILURE;
+    }
+
+  while (size < records)
+    size <<= 1;
+
+  libsoc_debug (__func__, "tracing %u records per thread", size);
+
+  __atomic_store_n (&trace_size, size, __ATOMIC_RELAXED);
+  __atomic_store_n (&libsoc_trace_on, 1, __ATOMIC_RELEASE);
+
+  return EXIT_SUCCESS;
+}
+
+void
+libsoc_trace_disable ()
+{
+  libsoc_debug (__func__, "tracing disabled");
+
+  __atomic_store_n (&libsoc_trace_on, 0, __ATOMIC_RELEASE);
+}
+
+int
+libsoc_trace_snapshot (trace_record * records, int max)
+{
+  trace_record *buf;
+  int num;
+
+  if (records == NULL || max < 0)
+    return -1;
+
+  num = trace_collect (&buf);
+
+  if (num < 0)
+    return -1;
+
+  if (num > max)
+    {
+      memcpy (records, buf + (num - max), max * sizeof (trace_record));
+      num = max;
+    }
+  else
+    {
+      memcpy (records, buf, num * sizeof (trace_record));
+    }
+
+  free (buf);
+
+  return num;
+}
+
+static FILE *
+trace_create (const char *path)
+{
+  trace_file_header header;
+  FILE *file;
+
+  file = fopen (path, "we");
+
+  if (file == NULL)
+    {
+      libsoc_debug (__func__, "could not create %s", path);
+      return NULL;
+    }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, LIBSOC_TRACE_MAGIC, sizeof (LIBSOC_TRACE_MAGIC));
+  header.version = LIBSOC_TRACE_VERSION;
+  header.record_size = sizeof (trace_record);
+
+  if (fwrite (&header, sizeof (header), 1, file) != 1)
+    {
+      fclose (file);
+      return NULL;
+    }
+
+  return file;
+}
+
+int
+libsoc_trace_dump (const char *path)
+{
+  trace_record *buf;
+  FILE *file;
+  int num, ret = EXIT_SUCCESS;
+
+  if (path == NULL)
+    return EXIT_FAILURE;
+
+  file = trace_create (path);
+
+  if (file == NULL)
+    return EXIT_FAILURE;
+
+  num = trace_collect (&buf);
+
+  if (num < 0)
+    {
+      fclose (file);
+      return EXIT_FAILURE;
+    }
+
+  if (fwrite (buf, sizeof (trace_record), num, file) != num)
+    ret = EXIT_FAILURE;
+
+  if (fclose (file) != 0)
+    ret = EXIT_FAILURE;
+
+  free (buf);
+
+  libsoc_debug (__func__, "wrote %d records to %s", num, path);
+
+  return ret;
+}
+
+// Append the records added to every ring since the last drain
+static void
+trace_drain (trace_record ** buf, unsigned int *buf_size)
+{
+  struct trace_ring *ring;
+  trace_record *tmp;
+  uint64_t from;
+  int num;
+
+  for (ring = __atomic_load_n (&trace_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+    {
+      if (ring->size > *buf_size)
+	{
+	  tmp = realloc (*buf, ring->size * sizeof (trace_record));
+
+	  if (tmp == NULL)
+	    continue;
+
+	  *buf = tmp;
+	  *buf_size = ring->size;
+	}
+
+      from = ring->drained;
+      num = trace_copy (ring, &ring->drained, *buf);
+      stream_lost += ring->drained - from - num;
+
+      fwrite (*buf, sizeof (trace_record), num, stream_file);
+    }
+
+  fflush (stream_file);
+}
+
+static void *
+trace_stream (void *arg)
+{
+  unsigned int buf_size = 0;
+  trace_record *buf = NULL;
+  struct timespec ts;
+  int stop = 0;
+
+  pthread_mutex_lock (&stream_lock);
+
+  while (!stop)
+    {
+      clock_gettime (CLOCK_REALTIME, &ts);
+      ts.tv_sec += stream_interval / 1000;
+      ts.tv_nsec += (stream_interval % 1000) * 1000000;
+
+      if (ts.tv_nsec >= 1000000000)
+	{
+	  ts.tv_sec++;
+	  ts.tv_nsec -= 1000000000;
+	}
+
+      while (!stream_stop &&
+	     pthread_cond_timedwait (&stream_cond, &stream_lock, &ts) == 0)
+	;
+
+      stop = stream_stop;
+
+      trace_drain (&buf, &buf_size);
+    }
+
+  pthread_mutex_unlock (&stream_lock);
+
+  free (buf);
+
+  return NULL;
+}
+
+int
+libsoc_trace_stream_start (const char *path, int interval)
+{
+  struct trace_ring *ring;
+
+  if (path == NULL || interval < 0)
+    return EXIT_FAILURE;
+
+  pthread_mutex_lock (&stream_lock);
+
+  if (stream_file)
+    {
+      pthread_mutex_unlock (&stream_lock);
+      libsoc_debug (__func__, "trace already streaming");
+      return EXIT_FAILURE;
+    }
+
+  stream_file = trace_create (path);
+
+  if (stream_file == NULL)
+    {
+      pthread_mutex_unlock (&stream_lock);
+      return EXIT_FAILURE;
+    }
+
+  // Only records from now on are streamed
+  for (ring = __atomic_load_n (&trace_rings, __ATOMIC_ACQUIRE); ring;
+       ring = ring->next)
+    ring->drained = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+
+  stream_interval = interval ? interval : TRACE_DEFAULT_INTERVAL;
+  stream_stop = 0;
+  stream_lost = 0;
+
+  if (pthread_create (&stream_thread, NULL, trace_stream, NULL) != 0)
+    {
+      fclose (stream_file);
+      stream_file = NULL;
+      pthread_mutex_unlock (&stream_lock);
+      libsoc_debug (__func__, "could not start the stream thread");
+      return EXIT_FAILURE;
+    }
+
+  pthread_mutex_unlock (&stream_lock);
+
+  libsoc_debug (__func__, "streaming trace to %s", path);
+
+  return EXIT_SUCCESS;
+}
+
+int
+libsoc_trace_stream_stop ()
+{
+  int ret = EXIT_SUCCESS;
+
+  pthread_mutex_lock (&stream_lock);
+
+  if (stream_file == NULL)
+    {
+      pthread_mutex_unlock (&stream_lock);
+      return EXIT_FAILURE;
+    }
+
+  stream_stop = 1;
+  pthread_cond_signal (&stream_cond);
+  pthread_mutex_unlock (&stream_lock);
+
+  pthread_join (stream_thread, NULL);
+
+  pthread_mutex_lock (&stream_lock);
+
+  if (ferror (stream_file))
+    ret = EXIT_FAILURE;
+
+  if (fclose (stream_file) != 0)
+    ret = EXIT_FAILURE;
+
+  stream_file = NULL;
+
+  pthread_mutex_unlock (&stream_lock);
+
+  libsoc_debug (__func__, "trace stream stopped, %lu records lost",
+		stream_lost);
+
+  return ret;
+}
+
+unsigned long
+libsoc_trace_lost ()
+{
+  unsigned long lost;
+
+  pthread_mutex_lock (&stream_lock);
+  lost = stream_lost;
+  pthread_mutex_unlock (&stream_lock);
+
+  return lost;
+}
+
+const char *
+libsoc_trace_op_name (int op)
+{
+  if (op < 0 || op >= LS_TRACE_NUM_OPS)
+    return "unknown";
+
+  return trace_op_names[op];
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+
+#include "libsoc_board.h"
+#include "libsoc_i2c_sim.h"
+
+/**
+ *
+ * This board_cache_test loads a generated board config with many pins
+ * through libsoc_board_init, checking the binary cache is written on the
+ * first load, used on the next, returns the same values as the parsed
+ * config, including the resolved SPI, I2C and PWM sections, and is
+ * regenerated when the config changes. A named I2C device is opened through
+ * the i2c simulator. It then compares
+ * loading and pin lookup with and without the cache. It needs no hardware
+ * and is run by "make check".
+ *
+ */
+
+#define NUM_PINS    512
+#define INIT_LOOPS  2000
+#define BENCH_LOOPS 2000000
+
+static char conf_path[] = "/tmp/libsoc_confXXXXXX";
+static char cache_dir[] = "/tmp/libsoc_cacheXXXXXX";
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_conf(int offset)
+{
+  FILE *fp = fopen(conf_path, "w");
+  int i;
+
+  if (fp == NULL)
+    return EXIT_FAILURE;
+
+  fprintf(fp, "[board]\nmodel = Test Board\n\n[GPIO]\n");
+
+  for (i = 0; i < NUM_PINS; i++)
+    fprintf(fp, "P%d_%d = %d\n", i / 32, i % 32, i + offset);
+
+  fprintf(fp, "NC = none\nDUP = 1\nDUP = 2\n\n"
+    "[SPI]\nFLASH = 1.0 3 20000000\nDISPLAY = 2.1\nBAD = 1.0 4\n\n"
+    "[I2C]\nEEPROM = 1 0x50\nSENSORS = 2\n\n"
+    "[PWM]\nBACKLIGHT = 0.1 1000000 inversed\nBUZZER = 1.0\n");
+  fclose(fp);
+
+  return EXIT_SUCCESS;
+}
+
+static void clean_cache()
+{
+  char path[sizeof(cache_dir) + 256];
+  DIR *dirp = opendir(cache_dir);
+  struct dirent *dp;
+
+  if (dirp == NULL)
+    return;
+
+  while ((dp = readdir(dirp)) != NULL) {
+    if (dp->d_name[0] == '.')
+      continue;
+    sprintf(path, "%s/%s", cache_dir, dp->d_name);
+    unlink(path);
+  }
+
+  closedir(dirp);
+}
+
+// Check every value of the config, whether parsed or cached
+static int check_config(board_config *config, int offset)
+{
+  char pin[16];
+  int i;
+
+  for (i = 0; i < NUM_PINS; i++) {
+    sprintf(pin, "P%d_%d", i / 32, i % 32);
+    if (libsoc_board_gpio_id(config, pin) != i + offset)
+      return EXIT_FAILURE;
+  }
+
+  if (libsoc_board_gpio_id(config, "P99_0") != -1 ||
+      libsoc_board_gpio_id(config, "NC") != -1 ||
+      libsoc_board_gpio_id(config, "DUP") != 2 ||
+      strcmp(libsoc_board_get(config, "board", "model", ""), "Test Board") ||
+      strcmp(libsoc_board_get(config, "GPIO", "NC", ""), "none") ||
+      libsoc_board_get(config, "board", "P0_0", NULL) != NULL ||
+      libsoc_board_get(config, "SPI", "model", NULL) != NULL)
+    return EXIT_FAILURE;
+
+  const board_spi *flash = libsoc_board_spi(config, "FLASH");
+  const board_spi *display = libsoc_board_spi(config, "DISPLAY");
+  const board_i2c *eeprom = libsoc_board_i2c(config, "EEPROM");
+  const board_i2c *sensors = libsoc_board_i2c(config, "SENSORS");
+  const board_pwm *backlight = libsoc_board_pwm(config, "BACKLIGHT");
+  const board_pwm *buzzer = libsoc_board_pwm(config, "BUZZER");
+
+  if (!flash || strcmp(flash->path, "/dev/spidev1.0") ||
+      flash->mode != MODE_3 || flash->speed != 20000000 ||
+      !display || display->device != 2 || display->chip_select != 1 ||
+      display->mode != MODE_ERROR || display->speed != 0 ||
+      libsoc_board_spi(config, "BAD") || libsoc_board_spi(config, "EEPROM") ||
+      !eeprom || strcmp(eeprom->path, "/dev/i2c-1") || eeprom->address != 0x50 ||
+      !sensors || sensors->bus != 2 || sensors->address != 0 ||
+      !backlight || strcmp(backlight->path, "/sys/class/pwm/pwmchip0/pwm1") ||
+      backlight->period != 1000000 || backlight->polarity != INVERSED ||
+      !buzzer || buzzer->period != 0 || buzzer->polarity != POLARITY_ERROR)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+static double bench_init(int cached)
+{
+  double start;
+  int i;
+
+  clean_cache();
+  libsoc_board_free(libsoc_board_init());
+
+  start = now();
+
+  for (i = 0; i < INIT_LOOPS; i++) {
+    if (!cached)
+      clean_cache();
+    libsoc_board_free(libsoc_board_init());
+  }
+
+  return (now() - start) / INIT_LOOPS * 1e6;
+}
+
+static double bench_lookup(board_config *config)
+{
+  char pins[NUM_PINS][16];
+  double start;
+  int i;
+
+  for (i = 0; i < NUM_PINS; i++)
+    sprintf(pins[i], "P%d_%d", i / 32, i % 32);
+
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++)
+    libsoc_board_gpio_id(config, pins[i % NUM_PINS]);
+
+  return BENCH_LOOPS / (now() - start) / 1e6;
+}
+
+int main()
+{
+  board_config *parsed = NULL, *cached = NULL;
+  int fd, ret = EXIT_FAILURE;
+
+  fd = mkstemp(conf_path);
+
+  if (fd < 0 || mkdtemp(cache_dir) == NULL)
+    return EXIT_FAILURE;
+
+  close(fd);
+
+  setenv("LIBSOC_CONF", conf_path, 1);
+  setenv("LIBSOC_CACHE_DIR", cache_dir, 1);
+
+  if (write_conf(0) == EXIT_FAILURE)
+    goto cleanup;
+
+  // The first load parses and writes the cache, creating the cache dir,
+  // the second maps it
+  rmdir(cache_dir);
+  parsed = libsoc_board_init();
+  cached = libsoc_board_init();
+
+  if (parsed == NULL || parsed->cache != NULL ||
+      cached == NULL || cached->cache == NULL ||
+      check_config(parsed, 0) == EXIT_FAILURE ||
+      check_config(cached, 0) == EXIT_FAILURE) {
+    printf("Cached config : Incorrect\n");
+    goto cleanup;
+  }
+
+  printf("Cached config : Correct\n");
+
+  // The conffile of a cached config is parsed on demand
+  if (libsoc_board_conf(parsed) == NULL ||
+      libsoc_board_conf(cached) == NULL ||
+      strcmp(conffile_get(libsoc_board_conf(cached), "board", "model", ""),
+             "Test Board")) {
+    printf("Cached conffile : Incorrect\n");
+    goto cleanup;
+  }
+
+  printf("Cached conffile : Correct\n");
+
+  // Open a named device, simulated so no hardware is needed
+  i2c_sim_device eeprom_desc = {
+    .type = I2C_SIM_EEPROM,
+    .size = 4096,
+    .addr_len = 2,
+    .page_size = 32,
+  };
+  uint8_t data[3] = { 0x00, 0x10, 0x5a };
+  i2c *eeprom;
+
+  libsoc_i2c_sim_enable();
+  libsoc_i2c_sim_add(1, 0x50, &eeprom_desc);
+
+  eeprom = libsoc_board_i2c_init(cached, "EEPROM");
+
+  if (eeprom == NULL || libsoc_i2c_write(eeprom, data, 3) == EXIT_FAILURE ||
+      libsoc_i2c_sim_memory(1, 0x50)[0x10] != 0x5a ||
+      libsoc_board_i2c_init(cached, "MISSING") != NULL) {
+    printf("Named I2C device : Incorrect\n");
+    if (eeprom)
+      libsoc_i2c_free(eeprom);
+    libsoc_i2c_sim_disable();
+    goto cleanup;
+  }
+
+  libsoc_i2c_free(eeprom);
+  libsoc_i2c_sim_disable();
+
+  printf("Named I2C device : Correct\n");
+
+  printf("Init benchmark : %.1fus uncached, %.1fus cached\n",
+    bench_init(0), bench_init(1));
+
+  printf("Lookup benchmark : %.1fM/s parsed, %.1fM/s cached\n",
+    bench_lookup(parsed), bench_lookup(cached));
+
+  libsoc_board_free(cached);
+  cached = NULL;
+
+  // A changed config regenerates the cache
+  sleep(1);
+
+  if (write_conf(1000) == EXIT_FAILURE)
+    goto cleanup;
+
+  libsoc_board_free(libsoc_board_init());
+  cached = libsoc_board_init();
+
+  if (cached == NULL || cached->cache == NULL ||
+      check_config(cached, 1000) == EXIT_FAILURE) {
+    printf("Regenerated cache : Incorrect\n");
+    goto cleanup;
+  }
+
+  printf("Regenerated cache : Correct\n");
+
+  ret = EXIT_SUCCESS;
+
+  cleanup:
+
+  libsoc_board_free(parsed);
+  libsoc_board_free(cached);
+  clean_cache();
+  unlink(conf_path);
+  rmdir(cache_dir);
+
+  return ret;
+}
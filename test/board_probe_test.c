@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "libsoc_board.h"
+
+/**
+ *
+ * This board_probe_test probes a generated set of board files with a fake
+ * device tree model, checking the cache dir is created and the probe index
+ * is built, used, and rebuilt when a board file changes. It then times probing the contributed board
+ * files with and without the index. It needs no hardware and is run by
+ * "make check".
+ *
+ */
+
+#define NUM_BOARDS  30
+#define BENCH_LOOPS 200
+
+static char data_dir[] = "/tmp/libsoc_boardsXXXXXX";
+static char cache_dir[] = "/tmp/libsoc_cacheXXXXXX";
+static char index_path[64];
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int write_file(const char *path, const char *text)
+{
+  FILE *fp = fopen(path, "w");
+
+  if (fp == NULL)
+    return EXIT_FAILURE;
+
+  fputs(text, fp);
+  fclose(fp);
+
+  return EXIT_SUCCESS;
+}
+
+static int write_board(int n, int gpio)
+{
+  char path[128], text[256];
+
+  sprintf(path, "%s/board%d.conf", data_dir, n);
+  sprintf(text, "[board]\nmodel = Board %d\ndtfile = %s/model\n\n[GPIO]\nLED = %d\n",
+    n, data_dir, gpio);
+
+  return write_file(path, text);
+}
+
+// Probe and return the LED gpio of the matched board, -1 if none matched
+static int probe()
+{
+  board_config *config = libsoc_board_init();
+  int led;
+
+  if (config == NULL)
+    return -1;
+
+  led = libsoc_board_gpio_id(config, "LED");
+  libsoc_board_free(config);
+
+  return led;
+}
+
+// The cache dir also holds the board config caches
+static void clean_cache()
+{
+  char path[sizeof(cache_dir) + 256];
+  DIR *dirp = opendir(cache_dir);
+  struct dirent *dp;
+
+  if (dirp == NULL)
+    return;
+
+  while ((dp = readdir(dirp)) != NULL) {
+    if (dp->d_name[0] == '.')
+      continue;
+    sprintf(path, "%s/%s", cache_dir, dp->d_name);
+    unlink(path);
+  }
+
+  closedir(dirp);
+}
+
+static double bench(const char *dir, int indexed)
+{
+  double start;
+  int i;
+
+  setenv("LIBSOC_DATA_DIR", dir, 1);
+  unlink(index_path);
+
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++) {
+    if (!indexed)
+      unlink(index_path);
+    libsoc_board_free(libsoc_board_init());
+  }
+
+  return (now() - start) / BENCH_LOOPS * 1e6;
+}
+
+int main()
+{
+  char path[128];
+  struct stat st;
+  int i, ret = EXIT_FAILURE;
+
+  if (mkdtemp(data_dir) == NULL || mkdtemp(cache_dir) == NULL)
+    return EXIT_FAILURE;
+
+  setenv("LIBSOC_CONF", "/nonexistent/libsoc.conf", 1);
+  setenv("LIBSOC_DATA_DIR", data_dir, 1);
+  setenv("LIBSOC_CACHE_DIR", cache_dir, 1);
+  sprintf(index_path, "%s/board.index", cache_dir);
+
+  for (i = 0; i < NUM_BOARDS; i++) {
+    if (write_board(i, i + 100) == EXIT_FAILURE)
+      goto cleanup;
+  }
+
+  // One more board file without a model, it is given one later
+  sprintf(path, "%s/board%d.conf", data_dir, NUM_BOARDS);
+  if (write_file(path, "[board]\n\n[GPIO]\nLED = 1\n") == EXIT_FAILURE)
+    goto cleanup;
+
+  sprintf(path, "%s/model", data_dir);
+  write_file(path, "Board 17");
+
+  // The cache dir is created by the first probe when it does not exist
+  rmdir(cache_dir);
+
+  // First probe scans and writes the index, the second uses it
+  if (probe() != 117 || stat(index_path, &st) != 0 || probe() != 117) {
+    printf("Probe with index : Incorrect\n");
+    goto cleanup;
+  }
+
+  printf("Probe with index : Correct\n");
+
+  // A changed board file makes the index stale, the change must be seen
+  sleep(1);
+  write_board(17, 999);
+
+  if (probe() != 999) {
+    printf("Stale index : Incorrect\n");
+    goto cleanup;
+  }
+
+  // An index that matches nothing means the board is unsupported
+  write_file(path, "Unknown Board");
+
+  if (probe() != -1) {
+    printf("Unmatched model : Incorrect\n");
+    goto cleanup;
+  }
+
+  // Editing any board file in place makes the index stale, even one that
+  // did not match, and within the same second
+  sprintf(path, "%s/model", data_dir);
+  write_file(path, "Board 30");
+
+  if (probe() != -1 || write_board(NUM_BOARDS, 130) == EXIT_FAILURE ||
+      probe() != 130) {
+    printf("Stale index : Incorrect\n");
+    goto cleanup;
+  }
+
+  printf("Stale index : Correct\n");
+
+  printf("Probe benchmark over %s : %.0fus scanning, %.0fus indexed\n",
+    BOARD_FILES_DIR, bench(BOARD_FILES_DIR, 0), bench(BOARD_FILES_DIR, 1));
+
+  ret = EXIT_SUCCESS;
+
+  cleanup:
+
+  for (i = 0; i <= NUM_BOARDS; i++) {
+    sprintf(path, "%s/board%d.conf", data_dir, i);
+    unlink(path);
+  }
+
+  sprintf(path, "%s/model", data_dir);
+  unlink(path);
+  clean_cache();
+  rmdir(data_dir);
+  rmdir(cache_dir);
+
+  return ret;
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libsoc_conffile.h"
+
+/**
+ *
+ * This conffile_test loads a generated board config with many pins and
+ * checks every lookup, including repeated and missing keys, and that
+ * malformed files, including ones with NUL bytes, are rejected. It then reports the lookup and reload
+ * rates. It needs no hardware and is run by "make check".
+ *
+ */
+
+#define NUM_PINS    512
+#define BENCH_LOOPS 200
+
+static int load_fails_len(const char *text, size_t len)
+{
+  char path[] = "/tmp/libsoc_conffile_testXXXXXX";
+  conffile *conf;
+  int fd = mkstemp(path);
+
+  if (fd < 0 || write(fd, text, len) != len)
+    return 0;
+
+  close(fd);
+  conf = conffile_load(path);
+  unlink(path);
+
+  if (conf == NULL)
+    return 1;
+
+  conffile_free(conf);
+  return 0;
+}
+
+static int load_fails(const char *text)
+{
+  return load_fails_len(text, strlen(text));
+}
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+  char path[] = "/tmp/libsoc_conffile_testXXXXXX";
+  char pin[32];
+  conffile *conf;
+  double start, elapsed;
+  FILE *fp;
+  int fd, i, loop, ret = EXIT_FAILURE;
+
+  fd = mkstemp(path);
+
+  if (fd < 0 || (fp = fdopen(fd, "w")) == NULL) {
+    printf("Failed to create config\n");
+    return EXIT_FAILURE;
+  }
+
+  fprintf(fp, "# generated board config\n[board]\nmodel = Test Board\n\n[GPIO]\n");
+
+  for (i = 0; i < NUM_PINS; i++)
+    fprintf(fp, "P%d_%d = %d\n", i / 32, i % 32, i);
+
+  // A repeated key keeps its last value
+  fprintf(fp, "P0_0 = 1000\n");
+  fclose(fp);
+
+  conf = conffile_load(path);
+
+  if (conf == NULL) {
+    printf("Failed to load config\n");
+    unlink(path);
+    return EXIT_FAILURE;
+  }
+
+  if (strcmp(conffile_get(conf, "board", "model", ""), "Test Board") != 0 ||
+      conffile_get_int(conf, "GPIO", "P0_0", -1) != 1000 ||
+      conffile_get_int(conf, "GPIO", "P99_0", -1) != -1 ||
+      conffile_get(conf, "SPI", "P0_1", NULL) != NULL ||
+      conffile_get(conf, "board", "P0_1", NULL) != NULL) {
+    printf("Config lookup : Incorrect\n");
+    goto free;
+  }
+
+  for (i = 1; i < NUM_PINS; i++) {
+    sprintf(pin, "P%d_%d", i / 32, i % 32);
+
+    if (conffile_get_int(conf, "GPIO", pin, -1) != i) {
+      printf("Config lookup of %s : Incorrect\n", pin);
+      goto free;
+    }
+  }
+
+  printf("Config lookup : Correct\n");
+
+  if (!load_fails("pin = 1\n[GPIO]\n") || !load_fails("[GPIO]\npin 1\n") ||
+      !load_fails("[GPIO\n") || !load_fails("[GPIO]\n = 1\n") ||
+      // Embedded NULs would add lines the first pass never counted
+      !load_fails_len("[A]\na=1\0[B]\0[C]\0[D]\0\nb=2\n", 25)) {
+    printf("Malformed configs : Incorrect\n");
+    goto free;
+  }
+
+  printf("Malformed configs : Correct\n");
+
+  start = now();
+
+  for (loop = 0; loop < BENCH_LOOPS; loop++) {
+    for (i = 0; i < NUM_PINS; i++) {
+      sprintf(pin, "P%d_%d", i / 32, i % 32);
+      conffile_get(conf, "GPIO", pin, NULL);
+    }
+  }
+
+  elapsed = now() - start;
+
+  printf("Config lookup benchmark : %.0f lookups/s with %d pins\n",
+    BENCH_LOOPS * NUM_PINS / elapsed, NUM_PINS);
+
+  start = now();
+
+  for (loop = 0; loop < BENCH_LOOPS; loop++)
+    conffile_free(conffile_load(path));
+
+  elapsed = now() - start;
+
+  printf("Config reload benchmark : %.0f loads/s with %d pins\n",
+    BENCH_LOOPS / elapsed, NUM_PINS);
+
+  ret = EXIT_SUCCESS;
+
+  free:
+
+  unlink(path);
+  conffile_free(conf);
+
+  return ret;
+}
@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "libsoc_gpio.h"
+#include "libsoc_debug.h"
+
+/**
+ *
+ * This debug_test checks the debug levels filter the debug output of the
+ * gpio toggle path, then times the toggle path with debug off and at the
+ * info level to show the disabled debug code costs nothing measurable. It
+ * drives a gpio struct backed by /dev/null so it needs no hardware and is
+ * run by "make check".
+ *
+ */
+
+#define BENCH_LOOPS 2000000
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Whether a level change prints its trace message at the given level
+static int traced(gpio *gpio, int level, int log_fd)
+{
+  char buf[1024];
+  struct stat st;
+  off_t start;
+  ssize_t len;
+
+  fstat(log_fd, &st);
+  start = st.st_size;
+
+  libsoc_set_debug(level);
+  libsoc_gpio_set_level(gpio, HIGH);
+  libsoc_set_debug(LIBSOC_DEBUG_OFF);
+
+  len = pread(log_fd, buf, sizeof(buf) - 1, start);
+  buf[len > 0 ? len : 0] = '\0';
+
+  return strstr(buf, "setting level to 1") != NULL;
+}
+
+static double bench(gpio *gpio, int level)
+{
+  double start;
+  int i;
+
+  libsoc_set_debug(level);
+
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++)
+    libsoc_gpio_set_level(gpio, i & 1);
+
+  libsoc_set_debug(LIBSOC_DEBUG_OFF);
+
+  return BENCH_LOOPS / (now() - start) / 1e6;
+}
+
+int main()
+{
+  char log_path[] = "/tmp/libsoc_debugXXXXXX";
+  gpio gpio;
+  int off, info, trace;
+  int log_fd, stderr_fd, ret = EXIT_SUCCESS;
+
+  memset(&gpio, 0, sizeof(gpio));
+  gpio.gpio = 1;
+  gpio.value_fd = open("/dev/null", O_WRONLY);
+  log_fd = mkstemp(log_path);
+
+  if (gpio.value_fd < 0 || log_fd < 0)
+    return EXIT_FAILURE;
+
+  // Capture stderr, where the debug output goes
+  fflush(stderr);
+  stderr_fd = dup(STDERR_FILENO);
+  dup2(log_fd, STDERR_FILENO);
+
+  off = traced(&gpio, LIBSOC_DEBUG_OFF, log_fd);
+  info = traced(&gpio, LIBSOC_DEBUG_INFO, log_fd);
+  trace = traced(&gpio, LIBSOC_DEBUG_TRACE, log_fd);
+
+  dup2(stderr_fd, STDERR_FILENO);
+  close(stderr_fd);
+
+  // Level changes are only printed at the trace level, if it is built in
+#if defined(LIBSOC_DEBUG_MAX) && LIBSOC_DEBUG_MAX == LIBSOC_DEBUG_TRACE
+  if (off || info || !trace) {
+    printf("Debug levels : Incorrect\n");
+    ret = EXIT_FAILURE;
+  } else {
+    printf("Debug levels : Correct\n");
+  }
+#else
+  if (off || info || trace) {
+    printf("Debug levels : Incorrect\n");
+    ret = EXIT_FAILURE;
+  } else {
+    printf("Debug levels : Correct, trace compiled out\n");
+  }
+#endif
+
+  printf("Toggle benchmark : %.1fM/s debug off, %.1fM/s info level\n",
+    bench(&gpio, LIBSOC_DEBUG_OFF), bench(&gpio, LIBSOC_DEBUG_INFO));
+
+  close(gpio.value_fd);
+  close(log_fd);
+  unlink(log_path);
+
+  return ret;
+}
@@ -0,0 +1,339 @@
+// The syscall counting wrappers below can't coexist with fortified inlines
+#undef _FORTIFY_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "libsoc_file.h"
+
+/**
+ *
+ * This file_test checks the integer formatting and parsing used for sysfs
+ * attributes such as the PWM period and duty cycle. It needs no hardware
+ * and is run by "make check".
+ *
+ * It then benchmarks PWM style updates, a duty cycle write followed by a
+ * read back, with the previous sprintf/atoi implementation and the current
+ * one. Writes go to /dev/null and reads come from a temporary file, so the
+ * numbers show the library and syscall overhead rather than the driver.
+ *
+ * Finally it compares reading enumerated attributes, such as a gpio
+ * direction, the old open/lseek/read/close way and through the attribute
+ * helpers, counting the syscalls each makes.
+ *
+ */
+
+#define BENCH_LOOPS 500000
+
+#define OLD_INT_STR_BUF 20
+
+#define ATTR_LOOPS 200000
+
+enum test_direction { TEST_IN, TEST_OUT, TEST_ERROR = -1 };
+
+static const file_enum direction_table[] = {
+  FILE_ENUM("in", TEST_IN),
+  FILE_ENUM("out", TEST_OUT),
+};
+
+/*
+ * The file syscalls libsoc makes are wrapped here so they can be counted,
+ * calls from the library resolve to these before libc
+ */
+static unsigned long syscalls;
+
+int open(const char *path, int flags, ...)
+{
+  va_list args;
+  mode_t mode = 0;
+
+  if (flags & O_CREAT) {
+    va_start(args, flags);
+    mode = va_arg(args, mode_t);
+    va_end(args);
+  }
+
+  syscalls++;
+  return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+int close(int fd)
+{
+  syscalls++;
+  return syscall(SYS_close, fd);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+  syscalls++;
+  return syscall(SYS_read, fd, buf, count);
+}
+
+ssize_t pread(int fd, void *buf, size_t count, off_t offset)
+{
+  syscalls++;
+  return syscall(SYS_pread64, fd, buf, count, offset);
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+  syscalls++;
+  return syscall(SYS_lseek, fd, offset, whence);
+}
+
+static double
+now (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The implementation before the formatting layer, kept for comparison
+static int old_write_int_fd(int fd, int val)
+{
+  char buf[OLD_INT_STR_BUF];
+
+  sprintf(buf, "%d", val);
+
+  if (write(fd, buf, OLD_INT_STR_BUF) < 0)
+    return EXIT_FAILURE;
+
+  return EXIT_SUCCESS;
+}
+
+static int old_read_int_fd(int fd, int *val)
+{
+  char buf[OLD_INT_STR_BUF];
+
+  lseek(fd, 0, SEEK_SET);
+
+  if (read(fd, buf, OLD_INT_STR_BUF) < 0)
+    return EXIT_FAILURE;
+
+  *val = atoi(buf);
+
+  return EXIT_SUCCESS;
+}
+
+// The getters before the attribute helpers, kept for comparison
+static int old_read_direction_path(const char *path)
+{
+  char buf[256];
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0)
+    return TEST_ERROR;
+
+  lseek(fd, 0, SEEK_SET);
+
+  if (read(fd, buf, sizeof(buf)) < 0)
+    return TEST_ERROR;
+
+  if (close(fd) < 0)
+    return TEST_ERROR;
+
+  return strncmp(buf, "in", 2) <= 0 ? TEST_IN : TEST_OUT;
+}
+
+static int old_read_direction_fd(int fd)
+{
+  char buf[1];
+
+  lseek(fd, 0, SEEK_SET);
+
+  if (read(fd, buf, 1) < 1)
+    return TEST_ERROR;
+
+  return buf[0] == 'i' ? TEST_IN : TEST_OUT;
+}
+
+static void bench_attr(const char *name, int (*fn)(const char *, int),
+  const char *path, int fd, int expect)
+{
+  unsigned long start_syscalls = syscalls;
+  double start = now(CLOCK_MONOTONIC);
+  int i, wrong = 0;
+
+  for (i = 0; i < ATTR_LOOPS; i++) {
+    if (fn(path, fd) != expect)
+      wrong++;
+  }
+
+  printf("%-30s : %8.0f reads/s, %.1f syscalls per read%s\n", name,
+    ATTR_LOOPS / (now(CLOCK_MONOTONIC) - start),
+    (double) (syscalls - start_syscalls) / ATTR_LOOPS,
+    wrong ? ", WRONG RESULT" : "");
+}
+
+static int attr_old_path(const char *path, int fd)
+{
+  return old_read_direction_path(path);
+}
+
+static int attr_new_path(const char *path, int fd)
+{
+  return file_read_enum_path(path, direction_table,
+    FILE_ENUM_NUM(direction_table), TEST_ERROR);
+}
+
+static int attr_old_fd(const char *path, int fd)
+{
+  return old_read_direction_fd(fd);
+}
+
+static int attr_new_fd(const char *path, int fd)
+{
+  return file_read_enum_fd(fd, direction_table,
+    FILE_ENUM_NUM(direction_table), TEST_ERROR);
+}
+
+static int check_format(int64_t val, const char *expect)
+{
+  char buf[FILE_INT_STR_BUF];
+  int64_t parsed;
+  int len = file_format_int(buf, val);
+
+  if (len != strlen(expect) || strcmp(buf, expect) != 0) {
+    printf("Format %s : Incorrect, got %s\n", expect, buf);
+    return EXIT_FAILURE;
+  }
+
+  if (file_parse_int(buf, len, &parsed) == EXIT_FAILURE || parsed != val) {
+    printf("Parse %s : Incorrect\n", expect);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+static int check_parse_fails(const char *str, int err)
+{
+  int64_t val;
+
+  errno = 0;
+
+  if (file_parse_int(str, strlen(str), &val) == EXIT_SUCCESS || errno != err) {
+    printf("Parse \"%s\" : Incorrect, accepted or wrong error\n", str);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
+
+int main()
+{
+  int null_fd, read_fd, i, val;
+  int64_t val64;
+  double start, old_rate, new_rate;
+  char path[] = "/tmp/libsoc_file_testXXXXXX";
+  char attr_path[32];
+
+  if (check_format(0, "0") || check_format(7, "7") ||
+      check_format(42, "42") || check_format(-5, "-5") ||
+      check_format(1000000, "1000000") ||
+      check_format(4294967295LL, "4294967295") ||
+      check_format(INT64_MAX, "9223372036854775807") ||
+      check_format(INT64_MIN, "-9223372036854775808"))
+    return EXIT_FAILURE;
+
+  if (check_parse_fails("", EINVAL) || check_parse_fails("\n", EINVAL) ||
+      check_parse_fails("-", EINVAL) || check_parse_fails("12a", EINVAL) ||
+      check_parse_fails("normal\n", EINVAL) ||
+      check_parse_fails("9223372036854775808", ERANGE) ||
+      check_parse_fails("-9223372036854775809", ERANGE))
+    return EXIT_FAILURE;
+
+  // sysfs values end in a newline and are not terminated
+  if (file_parse_int("20000000\nXX", 9, &val64) == EXIT_FAILURE ||
+      val64 != 20000000) {
+    printf("Parse sysfs value : Incorrect\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("Integer format and parse : Correct\n");
+
+  null_fd = open("/dev/null", O_WRONLY);
+  read_fd = mkstemp(path);
+
+  if (null_fd < 0 || read_fd < 0) {
+    printf("Failed to open benchmark files\n");
+    return EXIT_FAILURE;
+  }
+
+  unlink(path);
+
+  // Periods over INT_MAX nanoseconds need the 64 bit calls
+  if (file_write_int64_fd(read_fd, 3000000000LL) == EXIT_FAILURE ||
+      file_read_int64_fd(read_fd, &val64) == EXIT_FAILURE ||
+      val64 != 3000000000LL ||
+      file_read_int_fd(read_fd, &val) == EXIT_SUCCESS || errno != ERANGE) {
+    printf("64 bit values : Incorrect\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("64 bit values : Correct\n");
+
+  if (ftruncate(read_fd, 0) < 0 || pwrite(read_fd, "500000\n", 7, 0) != 7)
+    return EXIT_FAILURE;
+
+  start = now(CLOCK_MONOTONIC);
+
+  for (i = 0; i < BENCH_LOOPS; i++) {
+    old_write_int_fd(null_fd, 500000 + (i & 1023));
+    old_read_int_fd(read_fd, &val);
+  }
+
+  old_rate = BENCH_LOOPS / (now(CLOCK_MONOTONIC) - start);
+
+  start = now(CLOCK_MONOTONIC);
+
+  for (i = 0; i < BENCH_LOOPS; i++) {
+    file_write_int_fd(null_fd, 500000 + (i & 1023));
+    file_read_int_fd(read_fd, &val);
+  }
+
+  new_rate = BENCH_LOOPS / (now(CLOCK_MONOTONIC) - start);
+
+  printf("PWM update benchmark : before %.0f updates/s, after %.0f updates/s\n",
+    old_rate, new_rate);
+
+  // Enumerated attributes, sysfs values end in a newline
+  if (ftruncate(read_fd, 0) < 0 || pwrite(read_fd, "out\n", 4, 0) != 4)
+    return EXIT_FAILURE;
+
+  if (file_read_enum_fd(read_fd, direction_table,
+        FILE_ENUM_NUM(direction_table), TEST_ERROR) != TEST_OUT ||
+      file_lookup_enum("inx", 3, direction_table,
+        FILE_ENUM_NUM(direction_table), TEST_ERROR) != TEST_ERROR ||
+      file_lookup_enum("in", 2, direction_table,
+        FILE_ENUM_NUM(direction_table), TEST_ERROR) != TEST_IN) {
+    printf("Enumerated attributes : Incorrect\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("Enumerated attributes : Correct\n");
+
+  // The file is already unlinked, reopen it through its fd
+  sprintf(attr_path, "/proc/self/fd/%d", read_fd);
+
+  bench_attr("Attribute by path, before", attr_old_path, attr_path, read_fd, TEST_OUT);
+  bench_attr("Attribute by path, after", attr_new_path, attr_path, read_fd, TEST_OUT);
+  bench_attr("Attribute by cached fd, before", attr_old_fd, attr_path, read_fd, TEST_OUT);
+  bench_attr("Attribute by cached fd, after", attr_new_fd, attr_path, read_fd, TEST_OUT);
+
+  close(null_fd);
+  close(read_fd);
+
+  return EXIT_SUCCESS;
+}
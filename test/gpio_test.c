@@ -48,6 +48,15 @@ int main(void)
   {
     goto fail;
   }
+
+  // A second request shares the handle, freeing it drops the reference
+  gpio *gpio_shared = libsoc_gpio_request(GPIO_OUTPUT, LS_GPIO_SHARED);
+
+  if (gpio_shared != gpio_output || libsoc_gpio_free(gpio_shared) == EXIT_FAILURE)
+  {
+    printf("Failed shared request test\n");
+    goto fail;
+  }
   
   // Set direction to OUTPUT
   libsoc_gpio_set_direction(gpio_output, OUTPUT);
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#include "libsoc_i2c.h"
+#include "libsoc_i2c_sim.h"
+#include "libsoc_debug.h"
+
+/**
+ *
+ * This i2c_sim_test runs the i2c API against the in process i2c simulator
+ * so it needs no hardware and is run by "make check".
+ *
+ * An EEPROM (24C32 like, 4KiB with 32 byte pages) and a register file are
+ * simulated on bus 1. The test covers register access, bulk EEPROM
+ * transfers, bus scanning, the retry policy, including on EEPROM writes,
+ * and async transfers, then reports the transfer rate through the
+ * simulator as a benchmark of the library overhead.
+ *
+ */
+
+#define I2C_BUS         1
+#define EEPROM_ADDRESS  0x50
+#define REGS_ADDRESS    0x20
+
+#define EEPROM_SIZE       4096
+#define EEPROM_PAGE_SIZE  32
+
+#define BENCH_LOOPS 100000
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+  int ret = EXIT_FAILURE;
+  int i, done;
+  double start, elapsed;
+  unsigned long ioctls;
+
+  i2c_sim_device eeprom_desc = {
+    .type = I2C_SIM_EEPROM,
+    .size = EEPROM_SIZE,
+    .addr_len = 2,
+    .page_size = EEPROM_PAGE_SIZE,
+    .write_cycle = 3,
+  };
+
+  i2c_sim_device regs_desc = {
+    .type = I2C_SIM_REGISTERS,
+    .size = 256,
+    .addr_len = 1,
+  };
+
+  libsoc_i2c_sim_enable();
+
+  if (libsoc_i2c_sim_add(I2C_BUS, EEPROM_ADDRESS, &eeprom_desc) == EXIT_FAILURE ||
+      libsoc_i2c_sim_add(I2C_BUS, REGS_ADDRESS, &regs_desc) == EXIT_FAILURE) {
+    printf("Failed to add simulated devices\n");
+    return EXIT_FAILURE;
+  }
+
+  i2c *eeprom = libsoc_i2c_init(I2C_BUS, EEPROM_ADDRESS);
+  i2c *regs = libsoc_i2c_init(I2C_BUS, REGS_ADDRESS);
+
+  if (eeprom == NULL || regs == NULL) {
+    printf("Failed to get simulated I2C devices!\n");
+    goto free;
+  }
+
+  // Register access, write two registers then read them back
+  uint8_t reg_write[3] = { 0x10, 0xab, 0xcd };
+  uint8_t reg_read[2];
+
+  if (libsoc_i2c_write(regs, reg_write, 3) == EXIT_FAILURE ||
+      libsoc_i2c_write(regs, reg_write, 1) == EXIT_FAILURE ||
+      libsoc_i2c_read(regs, reg_read, 2) == EXIT_FAILURE ||
+      reg_read[0] != 0xab || reg_read[1] != 0xcd) {
+    printf("Register access : Incorrect\n");
+    goto free;
+  }
+
+  printf("Register access : Correct\n");
+
+  // Bulk EEPROM transfer, unaligned and spanning many pages
+  i2c_eeprom layout = {
+    .page_size = EEPROM_PAGE_SIZE,
+    .addr_len = 2,
+    .max_transfer = 256,
+    // The simulated write cycle is a count of NAKs rather than a time, so
+    // allow for a loaded machine oversleeping the polls
+    .write_timeout = 1000,
+  };
+
+  uint8_t data[3000];
+  uint8_t data_read[3000];
+
+  srand(1);
+
+  for (i = 0; i < sizeof(data); i++) {
+    data[i] = rand() % 255;
+  }
+
+  if (libsoc_i2c_eeprom_write(eeprom, &layout, 100, data, sizeof(data)) == EXIT_FAILURE ||
+      libsoc_i2c_eeprom_read(eeprom, &layout, 100, data_read, sizeof(data)) == EXIT_FAILURE ||
+      memcmp(data, data_read, sizeof(data)) != 0 ||
+      memcmp(data, libsoc_i2c_sim_memory(I2C_BUS, EEPROM_ADDRESS) + 100, sizeof(data)) != 0) {
+    printf("EEPROM bulk transfer : Incorrect\n");
+    goto free;
+  }
+
+  printf("EEPROM bulk transfer : Correct\n");
+
+  // Bus scan should find exactly the two devices
+  i2c_scan scan;
+
+  memset(&scan, 0, sizeof(scan));
+  scan.bus = I2C_BUS;
+
+  if (libsoc_i2c_scan(&scan, 1) == EXIT_FAILURE ||
+      !libsoc_i2c_scan_present(&scan, EEPROM_ADDRESS) ||
+      !libsoc_i2c_scan_present(&scan, REGS_ADDRESS) ||
+      libsoc_i2c_scan_present(&scan, REGS_ADDRESS + 1)) {
+    printf("Bus scan : Incorrect\n");
+    goto free;
+  }
+
+  printf("Bus scan : Correct\n");
+
+  // Retry policy, two NAKs are absorbed but three are not
+  i2c_policy policy = {
+    .timeout = -1,
+    .kernel_retries = -1,
+    .retries = 2,
+  };
+
+  libsoc_i2c_set_policy(regs, &policy);
+
+  libsoc_i2c_sim_fail(I2C_BUS, REGS_ADDRESS, 2);
+
+  if (libsoc_i2c_write(regs, reg_write, 3) == EXIT_FAILURE) {
+    printf("Retry policy : Incorrect\n");
+    goto free;
+  }
+
+  libsoc_i2c_sim_fail(I2C_BUS, REGS_ADDRESS, 3);
+
+  if (libsoc_i2c_write(regs, reg_write, 3) == EXIT_SUCCESS) {
+    printf("Retry policy : Incorrect\n");
+    goto free;
+  }
+
+  printf("Retry policy : Correct\n");
+
+  // EEPROM writes only poll on the errors the policy lists, the second page
+  // finds the device busy with the first and fails without ENXIO, with no
+  // further attempt after the failed poll
+  i2c_policy eeprom_policy = {
+    .timeout = -1,
+    .kernel_retries = -1,
+    .retry_errno = { EAGAIN },
+  };
+
+  libsoc_i2c_set_policy(eeprom, &eeprom_policy);
+  ioctls = libsoc_i2c_sim_ioctls();
+
+  if (libsoc_i2c_eeprom_write(eeprom, &layout, 0, data,
+        EEPROM_PAGE_SIZE * 2) == EXIT_SUCCESS ||
+      libsoc_i2c_sim_ioctls() - ioctls != 2) {
+    printf("EEPROM retry policy : Incorrect\n");
+    goto free;
+  }
+
+  eeprom_policy.retry_errno[0] = ENXIO;
+  eeprom_policy.backoff = 50;
+
+  libsoc_i2c_set_policy(eeprom, &eeprom_policy);
+
+  if (libsoc_i2c_eeprom_write(eeprom, &layout, 0, data,
+        EEPROM_PAGE_SIZE * 2) == EXIT_FAILURE ||
+      memcmp(data, libsoc_i2c_sim_memory(I2C_BUS, EEPROM_ADDRESS),
+        EEPROM_PAGE_SIZE * 2) != 0) {
+    printf("EEPROM retry policy : Incorrect\n");
+    goto free;
+  }
+
+  printf("EEPROM retry policy : Correct\n");
+
+  // Async transfers, completions are signalled on the eventfd
+  i2c_request reqs[16];
+  uint8_t async_read[8][2];
+  struct pollfd pfd;
+
+  if (libsoc_i2c_async_init(regs) == EXIT_FAILURE) {
+    printf("Failed to enable async transfers\n");
+    goto free;
+  }
+
+  for (i = 0; i < 8; i++) {
+    libsoc_i2c_submit_write(regs, &reqs[i * 2], reg_write, 1);
+    libsoc_i2c_submit_read(regs, &reqs[i * 2 + 1], async_read[i], 2);
+  }
+
+  pfd.fd = libsoc_i2c_async_get_fd(regs);
+  pfd.events = POLLIN;
+
+  for (done = 0; done < 16 && poll(&pfd, 1, 1000) == 1; ) {
+    i2c_request *req;
+
+    for (req = libsoc_i2c_complete(regs); req; req = req->next) {
+      if (req->result != EXIT_SUCCESS) {
+        printf("Async transfer failed\n");
+        goto free;
+      }
+      done++;
+    }
+  }
+
+  if (done != 16) {
+    printf("Async transfers : Incorrect\n");
+    goto free;
+  }
+
+  printf("Async transfers : Correct\n");
+
+  // Benchmark the library overhead per transfer
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++) {
+    libsoc_i2c_write(regs, reg_write, 1);
+    libsoc_i2c_read(regs, reg_read, 2);
+  }
+
+  elapsed = now() - start;
+
+  printf("Register read benchmark : %.0f register reads/s\n",
+    BENCH_LOOPS / elapsed);
+
+  ioctls = libsoc_i2c_sim_ioctls();
+  start = now();
+
+  for (i = 0; i < 100; i++) {
+    libsoc_i2c_eeprom_read(eeprom, &layout, 0, data_read, sizeof(data_read));
+  }
+
+  elapsed = now() - start;
+
+  printf("EEPROM read benchmark : %.1f MB/s, %lu ioctls per %d byte read\n",
+    100 * sizeof(data_read) / elapsed / 1e6,
+    (libsoc_i2c_sim_ioctls() - ioctls) / 100, (int) sizeof(data_read));
+
+  ret = EXIT_SUCCESS;
+
+  free:
+
+  if (eeprom)
+    libsoc_i2c_free(eeprom);
+
+  if (regs)
+    libsoc_i2c_free(regs);
+
+  libsoc_i2c_sim_disable();
+
+  return ret;
+}
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
+#include <poll.h>
 
 #include "libsoc_i2c.h"
 #include "libsoc_debug.h"
@@ -46,8 +47,29 @@ int main()
     return EXIT_FAILURE;
   }
   
+  // Check the EEPROM shows up in a scan of the bus
+  i2c_scan scan;
+
+  memset(&scan, 0, sizeof(scan));
+  scan.bus = I2C_BUS;
+
+  if (libsoc_i2c_scan(&scan, 1) == EXIT_FAILURE ||
+      !libsoc_i2c_scan_present(&scan, ADDRESS)) {
+    printf("EEPROM not found by bus scan\n");
+  }
+
   // Set the timeout for the i2c slave
   libsoc_i2c_set_timeout(eeprom, 1);
+
+  // Resend transfers the EEPROM NAKs up to 3 times
+  i2c_policy policy = {
+    .timeout = -1,
+    .kernel_retries = -1,
+    .retries = 3,
+    .backoff = 100,
+  };
+
+  libsoc_i2c_set_policy(eeprom, &policy);
   
   // Setup the seed for the random number
   struct timeval t1;
@@ -110,6 +132,65 @@ int main()
     }
   }
   
+  printf("Writing and reading across a page boundary\n");
+
+  i2c_eeprom layout = {
+    .page_size = EEPROM_PAGE_SIZE,
+    .addr_len = 1,
+  };
+
+  uint8_t span[EEPROM_PAGE_SIZE * 2];
+  uint8_t span_read[EEPROM_PAGE_SIZE * 2];
+  uint32_t span_offset = (page + EEPROM_PAGE_SIZE / 2) %
+    (EEPROM_SIZE / 8 - EEPROM_PAGE_SIZE * 2);
+
+  for (i=0; i<sizeof(span); i++) {
+    span[i] = rand() % 255;
+  }
+
+  if (libsoc_i2c_eeprom_write(eeprom, &layout, span_offset, span, sizeof(span)) == EXIT_FAILURE ||
+      libsoc_i2c_eeprom_read(eeprom, &layout, span_offset, span_read, sizeof(span)) == EXIT_FAILURE) {
+    printf("EEPROM span transfer failed\n");
+  } else if (memcmp(span, span_read, sizeof(span)) == 0) {
+    printf("EEPROM span : Correct\n");
+  } else {
+    printf("EEPROM span : Incorrect\n");
+  }
+
+  // Restore the page the checks below read back
+  libsoc_i2c_eeprom_write(eeprom, &layout, page, &data[1], EEPROM_PAGE_SIZE);
+
+  printf("Reading data asynchronously\n");
+
+  i2c_request req;
+  struct pollfd pfd;
+
+  if (libsoc_i2c_async_init(eeprom) == EXIT_FAILURE) {
+    printf("Failed to enable async transfers\n");
+    goto free;
+  }
+
+  ret = libsoc_i2c_write(eeprom, &page, 1);
+
+  memset(data_read, 0, EEPROM_PAGE_SIZE);
+  libsoc_i2c_submit_read(eeprom, &req, data_read, EEPROM_PAGE_SIZE);
+
+  // Wait on the eventfd for the read to complete
+  pfd.fd = libsoc_i2c_async_get_fd(eeprom);
+  pfd.events = POLLIN;
+
+  if (poll(&pfd, 1, 1000) != 1 || libsoc_i2c_complete(eeprom) != &req ||
+      req.result != EXIT_SUCCESS) {
+    printf("Async read page failed\n");
+    goto free;
+  }
+
+  if (memcmp(&data[1], data_read, EEPROM_PAGE_SIZE) == 0) {
+    printf("Async read : Correct\n");
+  } else {
+    printf("Async read : Incorrect\n");
+  }
+
   goto free;
 
   free:
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "libsoc_pwm.h"
+#include "libsoc_stats.h"
+
+/**
+ *
+ * This pwm_config_test checks libsoc_pwm_set_config against a pwm whose
+ * sysfs attributes are regular files in a temporary directory, so it needs
+ * no hardware and is run by "make check". A regular file keeps appending
+ * where sysfs replaces, so each attribute is reset before it is written.
+ * It also checks periods above INT_MAX are written and read back whole,
+ * that the sequencer checks its steps and leaves the cache coherent, and
+ * that group and sequencer writes are counted like single writes.
+ *
+ */
+
+// 3s, beyond what an int holds in nanoseconds
+#define LONG_PERIOD 3000000000U
+#define LONG_DUTY 2500000000U
+
+static char dir[] = "/tmp/libsoc_pwmXXXXXX";
+
+static int attr_open(const char *name, const char *value)
+{
+  char path[64];
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (fd >= 0 && write(fd, value, strlen(value)) != (ssize_t) strlen(value)) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Put an attribute back to value with the fd at the start, as sysfs would be
+static void attr_reset(int fd, const char *value)
+{
+  if (ftruncate(fd, 0) < 0 || pwrite(fd, value, strlen(value), 0) < 0)
+    perror("attr_reset");
+
+  lseek(fd, 0, SEEK_SET);
+}
+
+static int attr_equals(int fd, const char *value)
+{
+  char buf[32];
+  int len;
+
+  len = pread(fd, buf, sizeof(buf) - 1, 0);
+
+  if (len < 0)
+    return 0;
+
+  buf[len] = '\0';
+
+  return strcmp(buf, value) == 0;
+}
+
+static void attr_remove(const char *name)
+{
+  char path[64];
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  unlink(path);
+}
+
+int main()
+{
+  pwm *pwms[1];
+  pwm pwm;
+  io_stats counters;
+  int ret = EXIT_FAILURE;
+
+  if (mkdtemp(dir) == NULL)
+    return EXIT_FAILURE;
+
+  // A running pwm on a driver without polarity support
+  memset(&pwm, 0, sizeof(pwm));
+  pwm.enable_fd = attr_open("enable", "1");
+  pwm.period_fd = attr_open("period", "1000000");
+  pwm.duty_fd = attr_open("duty_cycle", "500000");
+  pwm.polarity_fd = -1;
+  pwm.capture_fd = -1;
+  pwm.period = -1;
+  pwm.duty = -1;
+  pwm.polarity = POLARITY_ERROR;
+  pwm.enabled = ENABLED_ERROR;
+
+  if (pwm.enable_fd < 0 || pwm.period_fd < 0 || pwm.duty_fd < 0)
+    goto free;
+
+  // An inversed request must fail without stopping the output
+  if (libsoc_pwm_set_config(&pwm, 2000000, 1000000, INVERSED,
+        ENABLED) == EXIT_SUCCESS ||
+      !attr_equals(pwm.enable_fd, "1") ||
+      !attr_equals(pwm.period_fd, "1000000")) {
+    printf("Unsupported polarity : Incorrect\n");
+    goto free;
+  }
+
+  printf("Unsupported polarity : Correct\n");
+
+  // A normal request is written, leaving the running output enabled
+  attr_reset(pwm.period_fd, "1000000");
+  attr_reset(pwm.duty_fd, "500000");
+
+  if (libsoc_pwm_set_config(&pwm, 2000000, 1000000, NORMAL,
+        ENABLED) == EXIT_FAILURE ||
+      !attr_equals(pwm.enable_fd, "1") ||
+      !attr_equals(pwm.period_fd, "2000000") ||
+      !attr_equals(pwm.duty_fd, "1000000")) {
+    printf("Normal polarity : Incorrect\n");
+    goto free;
+  }
+
+  printf("Normal polarity : Correct\n");
+
+  // Long periods read back through the 64 bit getters
+  attr_reset(pwm.period_fd, "");
+  attr_reset(pwm.duty_fd, "");
+
+  if (libsoc_pwm_set_period(&pwm, LONG_PERIOD) == EXIT_FAILURE ||
+      libsoc_pwm_set_duty_cycle(&pwm, LONG_DUTY) == EXIT_FAILURE ||
+      libsoc_pwm_get_period64(&pwm) != LONG_PERIOD ||
+      libsoc_pwm_get_duty_cycle64(&pwm) != LONG_DUTY ||
+      libsoc_pwm_get_period(&pwm) != -1 ||
+      libsoc_pwm_get_duty_cycle(&pwm) != -1) {
+    printf("Long period : Incorrect\n");
+    goto free;
+  }
+
+  // set_config compares against the cache, which now holds the long values
+  attr_reset(pwm.period_fd, "3000000000");
+  attr_reset(pwm.duty_fd, "2500000000");
+
+  if (libsoc_pwm_get_period64(&pwm) != LONG_PERIOD ||
+      libsoc_pwm_set_config(&pwm, LONG_PERIOD, LONG_DUTY / 2, NORMAL,
+        ENABLED) == EXIT_FAILURE ||
+      !attr_equals(pwm.period_fd, "3000000000") ||
+      !attr_equals(pwm.duty_fd, "1250000000")) {
+    printf("Long period : Incorrect\n");
+    goto free;
+  }
+
+  printf("Long period : Correct\n");
+
+  // A step longer than the period is refused before anything is played
+  pwm_step too_long[2] = { { 100000, 1000 }, { 2000000, 1000 } };
+  pwm_step ramp[2] = { { 100000, 1000 }, { 200000, 1000 } };
+  pwm_sequencer *seq;
+
+  attr_reset(pwm.period_fd, "1000000");
+  attr_reset(pwm.duty_fd, "");
+  pwm.period = -1;
+
+  if (libsoc_pwm_sequencer_start(&pwm, too_long, 2, 1, 0) != NULL ||
+      !attr_equals(pwm.duty_fd, "")) {
+    printf("Sequencer : Incorrect\n");
+    goto free;
+  }
+
+  // Once waited on the cache holds the last step
+  memset(&counters, 0, sizeof(counters));
+  pwm.stats = &counters;
+
+  seq = libsoc_pwm_sequencer_start(&pwm, ramp, 2, 1, 0);
+
+  if (seq == NULL || libsoc_pwm_sequencer_wait(seq) == EXIT_FAILURE ||
+      libsoc_pwm_sequencer_running(seq) ||
+      !attr_equals(pwm.duty_fd, "100000200000") ||
+      pwm.duty != 200000 || counters.ops != 2) {
+    printf("Sequencer : Incorrect\n");
+    libsoc_pwm_sequencer_free(seq);
+    goto free;
+  }
+
+  libsoc_pwm_sequencer_free(seq);
+
+  printf("Sequencer : Correct\n");
+
+  // Group writes skip unchanged duty cycles and count the rest
+  unsigned int duties[1] = { 300000 };
+  pwm_group *group;
+
+  pwms[0] = &pwm;
+  group = libsoc_pwm_group_new(pwms, 1);
+
+  attr_reset(pwm.duty_fd, "");
+
+  if (group == NULL ||
+      libsoc_pwm_group_set_duty_cycles(group, duties) == EXIT_FAILURE ||
+      libsoc_pwm_group_set_duty_cycles(group, duties) == EXIT_FAILURE ||
+      !attr_equals(pwm.duty_fd, "300000") || counters.ops != 3) {
+    printf("Group : Incorrect\n");
+    libsoc_pwm_group_free(group);
+    goto free;
+  }
+
+  libsoc_pwm_group_free(group);
+
+  printf("Group : Correct\n");
+
+  ret = EXIT_SUCCESS;
+
+  free:
+
+  close(pwm.enable_fd);
+  close(pwm.period_fd);
+  close(pwm.duty_fd);
+  attr_remove("enable");
+  attr_remove("period");
+  attr_remove("duty_cycle");
+  rmdir(dir);
+
+  return ret;
+}
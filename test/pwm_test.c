@@ -36,6 +36,14 @@ int main(void)
     goto fail;
   }
 
+  // A second request shares the handle, freeing it drops the reference
+  if (libsoc_pwm_request(PWM_OUTPUT_CHIP, PWM_CHIP_OUTPUT, LS_PWM_SHARED) != pwm ||
+      libsoc_pwm_free(pwm) == EXIT_FAILURE)
+  {
+    printf("Failed shared request test\n");
+    goto fail;
+  }
+
   libsoc_pwm_set_enabled(pwm, ENABLED);
 
   int enabled = libsoc_pwm_get_enabled(pwm);
@@ -93,6 +101,59 @@ int main(void)
     printf("Driver correctly responded to setting duty higher than period, with error\n");
   }
 
+  // Shrinking the period below the current duty must still succeed
+  if (libsoc_pwm_set_config(pwm, 4, 2, NORMAL, DISABLED) == EXIT_FAILURE ||
+      libsoc_pwm_get_period(pwm) != 4 || libsoc_pwm_get_duty_cycle(pwm) != 2)
+  {
+    printf("Failed config test\n");
+    goto fail;
+  }
+
+  // Group updates go through the same duty_fd
+  pwm_group *group = libsoc_pwm_group_new(&pwm, 1);
+  unsigned int duties[1] = { 3 };
+
+  if (!group || libsoc_pwm_group_set_duty_cycles(group, duties) == EXIT_FAILURE ||
+      libsoc_pwm_get_duty_cycle(pwm) != 3)
+  {
+    printf("Failed group test\n");
+    libsoc_pwm_group_free(group);
+    goto fail;
+  }
+
+  libsoc_pwm_group_free(group);
+
+  // Play a short sequence twice and check it ends on the last step
+  pwm_step steps[3] = { { 1, 1000000 }, { 2, 1000000 }, { 3, 1000000 } };
+  pwm_sequencer_stats stats;
+  pwm_sequencer *seq = libsoc_pwm_sequencer_start(pwm, steps, 3, 2, 50);
+
+  if (!seq || libsoc_pwm_sequencer_wait(seq) == EXIT_FAILURE ||
+      libsoc_pwm_sequencer_get_stats(seq, &stats) == EXIT_FAILURE ||
+      stats.steps != 6 || libsoc_pwm_get_duty_cycle(pwm) != 3)
+  {
+    printf("Failed sequencer test\n");
+    libsoc_pwm_sequencer_free(seq);
+    goto fail;
+  }
+
+  printf("Sequencer: %lu underruns, max late %lluns\n", stats.underruns,
+    (unsigned long long) stats.max_late_ns);
+
+  libsoc_pwm_sequencer_free(seq);
+
+  // Capture measures an input, so only check it runs where supported
+  unsigned int capture_period, capture_duty;
+
+  if (libsoc_pwm_capture(pwm, &capture_period, &capture_duty) == EXIT_SUCCESS)
+  {
+    printf("Captured period %u duty %u\n", capture_period, capture_duty);
+  }
+  else
+  {
+    printf("Failed capture test, this may be an error, or it might not be supported by your driver\n");
+  }
+
   libsoc_pwm_set_polarity(pwm, INVERSED);
 
   int polarity = libsoc_pwm_get_polarity(pwm);
@@ -0,0 +1,197 @@
+#!/usr/bin/python
+
+import ctypes
+import importlib.util
+import os
+import sys
+
+# This test checks the argument validation of the native GPIO, SPI and I2C
+# entry points, then the buffer types they accept against a register file
+# on the i2c simulator. It needs no hardware and is run by "make check"
+# when the Python bindings are enabled. The libsoc package is loaded from
+# the build tree rather than an installed copy.
+
+# Any non NULL address gets past the handle check, nothing dereferences it
+FAKE_HANDLE = 1
+
+SIM_BUS = 1
+REGS_ADDRESS = 0x20
+I2C_SIM_REGISTERS = 1
+
+
+class SimDevice(ctypes.Structure):
+    _fields_ = [('type', ctypes.c_int), ('size', ctypes.c_uint32),
+                ('addr_len', ctypes.c_uint8), ('page_size', ctypes.c_uint16),
+                ('write_cycle', ctypes.c_int)]
+
+
+# The spi struct of libsoc_spi.h, to hand the bindings a device which fails
+# its transfers
+class FakeSpi(ctypes.Structure):
+    _fields_ = [('fd', ctypes.c_int), ('spi_dev', ctypes.c_uint16),
+                ('chip_select', ctypes.c_uint8), ('stats', ctypes.c_void_p)]
+
+
+def load_libsoc():
+    src = os.path.join(os.environ['top_srcdir'], 'bindings', 'python')
+    build = os.path.join(os.environ['top_builddir'], 'bindings', 'python',
+                         '.libs')
+    spec = importlib.util.spec_from_file_location(
+        'libsoc', os.path.join(src, '__init__.py'),
+        submodule_search_locations=[src, build])
+    module = importlib.util.module_from_spec(spec)
+    sys.modules['libsoc'] = module
+    spec.loader.exec_module(module)
+    return module
+
+
+def load_sim():
+    sim = ctypes.CDLL(os.path.join(os.environ['top_builddir'], 'test',
+                                   '.libs', 'libsoc_i2c_sim.so'))
+    sim.libsoc_i2c_sim_memory.restype = ctypes.c_void_p
+    return sim
+
+
+def raises(exc, func, *args):
+    try:
+        func(*args)
+    except exc:
+        return
+    raise AssertionError('%s%r did not raise %s' %
+                         (func.__name__, args, exc.__name__))
+
+
+def test_handles(native, libsoc):
+    for func, args in ((native.gpio_set_level, (1,)),
+                       (native.gpio_get_level, ()),
+                       (native.gpio_poll, (0,)),
+                       (native.spi_write, (b'\x00',)),
+                       (native.spi_read, (1,)),
+                       (native.spi_readinto, (bytearray(1),)),
+                       (native.spi_rw, (b'\x00', 1)),
+                       (native.spi_rw_into, (b'\x00', bytearray(1))),
+                       (native.i2c_write, (b'\x00',)),
+                       (native.i2c_read, (1,)),
+                       (native.i2c_readinto, (bytearray(1),))):
+        raises(IOError, func, None, *args)
+        raises(IOError, func, 0, *args)
+
+    # Classes which were never opened pass None
+    raises(IOError, libsoc.I2C(0, 0x50).read, 1)
+    spi = libsoc.SPI(0, 0, libsoc.MODE_0, 1000000, libsoc.BITS_8)
+    raises(IOError, spi.readinto, bytearray(1))
+    print('None handle : Correct')
+
+
+def test_lengths(native):
+    for length in (0, -1, 1 << 32):
+        raises(ValueError, native.spi_read, FAKE_HANDLE, length)
+        raises(ValueError, native.spi_rw, FAKE_HANDLE, b'\x00', length)
+    for length in (0, -1, 1 << 16):
+        raises(ValueError, native.i2c_read, FAKE_HANDLE, length)
+
+    raises(ValueError, native.spi_readinto, FAKE_HANDLE, bytearray())
+    raises(ValueError, native.spi_rw_into, FAKE_HANDLE, b'\x00', bytearray())
+    raises(ValueError, native.i2c_readinto, FAKE_HANDLE, bytearray())
+    raises(ValueError, native.i2c_readinto, FAKE_HANDLE, bytearray(1 << 16))
+    raises(ValueError, native.i2c_write, FAKE_HANDLE, bytes(1 << 16))
+    print('Lengths : Correct')
+
+
+def test_read_only(native):
+    raises(BufferError, native.spi_readinto, FAKE_HANDLE, b'\x00\x00')
+    raises(BufferError, native.spi_rw_into, FAKE_HANDLE, b'\x00', b'\x00')
+    raises(BufferError, native.i2c_readinto, FAKE_HANDLE, b'\x00\x00')
+    raises(BufferError, native.i2c_readinto, FAKE_HANDLE,
+           memoryview(bytearray(2)).toreadonly())
+    print('Read only buffer : Correct')
+
+
+def test_write_types(native, libsoc, sim):
+    memory = sim.libsoc_i2c_sim_memory(SIM_BUS, REGS_ADDRESS)
+
+    with libsoc.I2C(SIM_BUS, REGS_ADDRESS) as regs:
+        for i, data in enumerate((b'\x10\x01\x02',
+                                  bytearray(b'\x10\x03\x04'),
+                                  memoryview(b'\x00\x10\x05\x06')[1:],
+                                  [0x10, 0x07, 0x08],
+                                  (0x10, 0x09, 0x0a))):
+            regs.write(data)
+            value = bytes((2 * i + 1, 2 * i + 2))
+            assert ctypes.string_at(memory + 0x10, 2) == value, \
+                'Write of %s' % type(data).__name__
+
+        # An int would otherwise be written as that many zero bytes
+        raises(TypeError, regs.write, 5)
+        assert ctypes.string_at(memory, 5) == bytes(5)
+
+    raises(TypeError, native.spi_write, FAKE_HANDLE, 5)
+    raises(TypeError, native.spi_rw, FAKE_HANDLE, 5, 5)
+    print('Write buffer types : Correct')
+
+
+def test_readinto(libsoc, sim):
+    memory = sim.libsoc_i2c_sim_memory(SIM_BUS, REGS_ADDRESS)
+    ctypes.memmove(memory + 0x30, b'\xde\xad\xbe\xef', 4)
+
+    with libsoc.I2C(SIM_BUS, REGS_ADDRESS) as regs:
+        buf = bytearray(4)
+        regs.write(b'\x30')
+        assert regs.readinto(buf) == 4 and buf == b'\xde\xad\xbe\xef'
+
+        buf = bytearray(8)
+        regs.write(b'\x30')
+        assert regs.readinto(memoryview(buf)[2:6]) == 4
+        assert buf == b'\x00\x00\xde\xad\xbe\xef\x00\x00'
+
+    print('Readinto : Correct')
+
+
+def test_rw_into(native):
+    # Bytes past the read would be dropped
+    raises(ValueError, native.spi_rw, FAKE_HANDLE, b'\x00\x00', 1)
+    raises(ValueError, native.spi_rw_into, FAKE_HANDLE, b'\x00\x00',
+           bytearray(1))
+
+    # The same buffer may be written from and read into, the transfer is
+    # reached and fails on a device which is not spidev
+    fd = os.open(os.devnull, os.O_RDWR)
+    spi = FakeSpi(fd=fd)
+    buf = bytearray(b'\x01\x02\x03')
+
+    try:
+        raises(IOError, native.spi_rw_into, ctypes.addressof(spi), buf, buf)
+        raises(IOError, native.spi_rw_into, ctypes.addressof(spi),
+               memoryview(buf)[:2], memoryview(buf))
+    finally:
+        os.close(fd)
+
+    assert buf == b'\x01\x02\x03'
+    print('Rw into : Correct')
+
+
+def main():
+    libsoc = load_libsoc()
+    native = sys.modules['libsoc._libsoc']
+    sim = load_sim()
+
+    test_handles(native, libsoc)
+    test_lengths(native)
+    test_read_only(native)
+
+    device = SimDevice(type=I2C_SIM_REGISTERS, size=256, addr_len=1)
+    sim.libsoc_i2c_sim_enable()
+    assert sim.libsoc_i2c_sim_add(SIM_BUS, REGS_ADDRESS,
+                                  ctypes.byref(device)) == 0
+
+    try:
+        test_write_types(native, libsoc, sim)
+        test_readinto(libsoc, sim)
+    finally:
+        sim.libsoc_i2c_sim_disable()
+
+    test_rw_into(native)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "libsoc_softpwm.h"
+#include "libsoc_debug.h"
+
+/**
+ *
+ * This softpwm_test runs the software PWM engine at a range of channel
+ * counts and reports how late edges are written and how much CPU the
+ * engine uses. It needs no hardware, the channels drive gpio structs
+ * whose value file is /dev/null, so it is run by "make check". The
+ * numbers exclude the gpio driver, run it on a board with real gpios for
+ * those.
+ *
+ */
+
+#define PERIOD_NS    1000000
+#define RUN_MS       500
+#define MAX_CHANNELS 128
+
+static double
+now (clockid_t clock)
+{
+  struct timespec ts;
+
+  clock_gettime (clock, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run(softpwm_engine *engine, gpio *gpios, int num)
+{
+  softpwm *pwms[MAX_CHANNELS];
+  unsigned int duties[MAX_CHANNELS];
+  softpwm_stats before, after;
+  double wall, cpu, expected;
+  unsigned long edges;
+  int i, ret = EXIT_SUCCESS;
+
+  for (i = 0; i < num; i++) {
+    pwms[i] = libsoc_softpwm_request(engine, &gpios[i]);
+
+    if (pwms[i] == NULL || libsoc_softpwm_set_period(pwms[i], PERIOD_NS) == EXIT_FAILURE)
+      return EXIT_FAILURE;
+
+    // Spread the duty cycles so falling edges are not all coincident
+    duties[i] = PERIOD_NS / (num + 1) * (i + 1);
+  }
+
+  if (libsoc_softpwm_set_duty_cycles(pwms, duties, num) == EXIT_FAILURE)
+    return EXIT_FAILURE;
+
+  libsoc_softpwm_engine_get_stats(engine, &before);
+
+  wall = now(CLOCK_MONOTONIC);
+  cpu = now(CLOCK_PROCESS_CPUTIME_ID);
+
+  for (i = 0; i < num; i++)
+    libsoc_softpwm_set_enabled(pwms[i], ENABLED);
+
+  usleep(RUN_MS * 1000);
+
+  for (i = 0; i < num; i++)
+    libsoc_softpwm_free(pwms[i]);
+
+  cpu = now(CLOCK_PROCESS_CPUTIME_ID) - cpu;
+  wall = now(CLOCK_MONOTONIC) - wall;
+
+  libsoc_softpwm_engine_get_stats(engine, &after);
+
+  edges = after.edges - before.edges;
+  expected = 2.0 * num * wall * 1e9 / PERIOD_NS;
+
+  printf("%3d channels : %8lu edges, mean late %6.1fus, max late %7.1fus, "
+    "%5.1f%% CPU\n", num, edges,
+    edges ? (after.total_late_ns - before.total_late_ns) / 1e3 / edges : 0,
+    after.max_late_ns / 1e3, 100 * cpu / wall);
+
+  // Generous, timing on a loaded build machine is not guaranteed
+  if (edges < expected / 2) {
+    printf("Too few edges, expected about %.0f\n", expected);
+    ret = EXIT_FAILURE;
+  }
+
+  return ret;
+}
+
+int main()
+{
+  int counts[] = { 1, 8, 32, MAX_CHANNELS };
+  gpio gpios[MAX_CHANNELS];
+  softpwm_engine *engine;
+  int fd, i, ret = EXIT_SUCCESS;
+
+  fd = open("/dev/null", O_WRONLY);
+
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  memset(gpios, 0, sizeof(gpios));
+
+  for (i = 0; i < MAX_CHANNELS; i++) {
+    gpios[i].gpio = i;
+    gpios[i].value_fd = fd;
+  }
+
+  engine = libsoc_softpwm_engine_new(50);
+
+  if (engine == NULL) {
+    printf("Failed to start softpwm engine\n");
+    return EXIT_FAILURE;
+  }
+
+  printf("Soft PWM benchmark, %d ns period\n", PERIOD_NS);
+
+  for (i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+    if (run(engine, gpios, counts[i]) == EXIT_FAILURE)
+      ret = EXIT_FAILURE;
+  }
+
+  if (libsoc_softpwm_engine_free(engine) == EXIT_FAILURE)
+    ret = EXIT_FAILURE;
+
+  close(fd);
+
+  return ret;
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "libsoc_i2c.h"
+#include "libsoc_i2c_sim.h"
+#include "libsoc_stats.h"
+#include "libsoc_trace.h"
+
+/**
+ *
+ * This stats_test counts i2c transfers to a register file simulated by the
+ * i2c simulator, checking the op, byte and error counts and the latency
+ * histogram of the handle, then times register reads with and without
+ * counters to show their cost and scrapes the OpenMetrics exporter over a
+ * Unix socket, checking a stalled client cannot hold up stopping it. It
+ * needs no hardware and is run by "make check".
+ *
+ */
+
+#define I2C_BUS 1
+#define REGS_ADDRESS 0x20
+
+#define LOOPS 1000
+#define BENCH_LOOPS 100000
+
+#define EXPORT_SIZE 16384
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Counters of the register file, NULL if it has none
+static io_stats *find(io_stats *stats, int num)
+{
+  int i;
+
+  for (i = 0; i < num; i++) {
+    if (stats[i].type == LS_STATS_I2C &&
+        stats[i].device == LIBSOC_TRACE_I2C_ID(I2C_BUS, REGS_ADDRESS))
+      return &stats[i];
+  }
+
+  return NULL;
+}
+
+static double bench(i2c *regs)
+{
+  uint8_t reg = 0x10, val[2];
+  double start;
+  int i;
+
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++) {
+    libsoc_i2c_write(regs, &reg, 1);
+    libsoc_i2c_read(regs, val, 2);
+  }
+
+  return BENCH_LOOPS / (now() - start);
+}
+
+static int exporter_connect(const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0)
+    return -1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+// Scrape the exporter, sending request first if it is not NULL
+static int scrape(const char *path, const char *request, char *buf, int len)
+{
+  int fd, ret, num = 0;
+
+  fd = exporter_connect(path);
+
+  if (fd < 0)
+    return -1;
+
+  if (request)
+    send(fd, request, strlen(request), 0);
+
+  while (num < len - 1 && (ret = recv(fd, buf + num, len - 1 - num, 0)) > 0)
+    num += ret;
+
+  buf[num] = '\0';
+  close(fd);
+
+  return num;
+}
+
+int main()
+{
+  i2c *plain = NULL, *regs = NULL, *again = NULL;
+  io_stats stats[4], *s;
+  static char text[EXPORT_SIZE], line[128];
+  char sock_path[64];
+  uint64_t ops;
+  uint64_t buckets = 0, p50, p99;
+  uint8_t reg_write[3] = { 0x10, 0xab, 0xcd };
+  uint8_t reg_read[2];
+  int i, num, ret = EXIT_FAILURE;
+  double off, on;
+
+  i2c_sim_device regs_desc = {
+    .type = I2C_SIM_REGISTERS,
+    .size = 256,
+    .addr_len = 1,
+  };
+
+  libsoc_i2c_sim_enable();
+
+  if (libsoc_i2c_sim_add(I2C_BUS, REGS_ADDRESS, &regs_desc) == EXIT_FAILURE) {
+    printf("Failed to add simulated device\n");
+    return EXIT_FAILURE;
+  }
+
+  // Only handles opened while counting is enabled are counted
+  plain = libsoc_i2c_init(I2C_BUS, REGS_ADDRESS);
+  libsoc_stats_enable(1);
+  regs = libsoc_i2c_init(I2C_BUS, REGS_ADDRESS);
+  libsoc_stats_enable(0);
+
+  if (plain == NULL || regs == NULL) {
+    printf("Failed to get simulated I2C devices\n");
+    goto free;
+  }
+
+  if (plain->stats != NULL || regs->stats == NULL ||
+      libsoc_stats_snapshot(stats, 4) != 1) {
+    printf("Opt in : Incorrect\n");
+    goto free;
+  }
+
+  printf("Opt in : Correct\n");
+
+  for (i = 0; i < LOOPS; i++) {
+    libsoc_i2c_write(regs, reg_write, 3);
+    libsoc_i2c_read(regs, reg_read, 2);
+    libsoc_i2c_read(plain, reg_read, 2);
+  }
+
+  libsoc_i2c_sim_fail(I2C_BUS, REGS_ADDRESS, 2);
+  libsoc_i2c_write(regs, reg_write, 3);
+  libsoc_i2c_read(regs, reg_read, 2);
+
+  num = libsoc_stats_snapshot(stats, 4);
+  s = find(stats, num);
+
+  if (s == NULL || s->ops != LOOPS * 2 + 2 || s->bytes != LOOPS * 5 ||
+      s->errors != 2) {
+    printf("Counters : Incorrect\n");
+    goto free;
+  }
+
+  printf("Counters : Correct\n");
+
+  for (i = 0; i < LIBSOC_STATS_BUCKETS; i++)
+    buckets += s->latency[i];
+
+  p50 = libsoc_stats_percentile(s, 50);
+  p99 = libsoc_stats_percentile(s, 99);
+
+  if (buckets != s->ops || p50 == 0 || p50 > p99 || p99 > s->max_ns ||
+      s->total_ns / s->ops > s->max_ns) {
+    printf("Latency histogram : Incorrect\n");
+    goto free;
+  }
+
+  printf("Latency histogram : Correct, mean %lluns p50 %lluns p99 %lluns "
+    "max %lluns\n", (unsigned long long) (s->total_ns / s->ops),
+    (unsigned long long) p50, (unsigned long long) p99,
+    (unsigned long long) s->max_ns);
+
+  off = bench(plain);
+  on = bench(regs);
+
+  printf("Register read benchmark : %.0f/s without counters, %.0f/s with\n",
+    off, on);
+
+  // Handles on the same device are exported as one series
+  libsoc_stats_enable(1);
+  again = libsoc_i2c_init(I2C_BUS, REGS_ADDRESS);
+  libsoc_stats_enable(0);
+
+  if (again == NULL) {
+    printf("Failed to get simulated I2C device\n");
+    goto free;
+  }
+
+  libsoc_i2c_read(again, reg_read, 2);
+
+  num = libsoc_stats_snapshot(stats, 4);
+
+  for (i = 0, ops = 0; i < num; i++)
+    ops += stats[i].ops;
+
+  snprintf(line, sizeof(line), "libsoc_operations_total{type=\"i2c\","
+    "device=\"i2c-%d@0x%02x\"} %llu\n", I2C_BUS, REGS_ADDRESS,
+    (unsigned long long) ops);
+  snprintf(sock_path, sizeof(sock_path), "/tmp/libsoc_stats%d.sock", getpid());
+
+  if (libsoc_stats_export_start(sock_path) == EXIT_FAILURE) {
+    printf("Failed to start the exporter\n");
+    goto free;
+  }
+
+  if (scrape(sock_path, "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n",
+        text, sizeof(text)) <= 0 ||
+      strncmp(text, "HTTP/1.0 200 OK\r\n", 17) || !strstr(text, line) ||
+      strstr(strstr(text, line) + 1, "libsoc_operations_total{") ||
+      !strstr(text, "le=\"+Inf\"} ") ||
+      strcmp(text + strlen(text) - 6, "# EOF\n")) {
+    printf("HTTP scrape : Incorrect\n");
+    libsoc_stats_export_stop();
+    goto free;
+  }
+
+  printf("HTTP scrape : Correct\n");
+
+  if (scrape(sock_path, NULL, text, sizeof(text)) <= 0 ||
+      strncmp(text, "# TYPE libsoc_operations counter\n", 33) ||
+      !strstr(text, line)) {
+    printf("Text scrape : Incorrect\n");
+    libsoc_stats_export_stop();
+    goto free;
+  }
+
+  printf("Text scrape : Correct\n");
+
+  // A client stuck part way through its request must not hold up stopping
+  int slow = exporter_connect(sock_path);
+  double stop_start;
+
+  if (slow < 0 || send(slow, "GET ", 4, 0) != 4) {
+    printf("Exporter stop : Incorrect\n");
+    libsoc_stats_export_stop();
+    goto free;
+  }
+
+  usleep(100000);
+  stop_start = now();
+
+  if (libsoc_stats_export_stop() == EXIT_FAILURE ||
+      access(sock_path, F_OK) == 0 || now() - stop_start > 0.5) {
+    printf("Exporter stop : Incorrect\n");
+    close(slow);
+    goto free;
+  }
+
+  close(slow);
+
+  printf("Exporter stop : Correct\n");
+
+  libsoc_i2c_free(again);
+  again = NULL;
+  libsoc_i2c_free(regs);
+  regs = NULL;
+
+  if (libsoc_stats_snapshot(stats, 4) != 0) {
+    printf("Free : Incorrect\n");
+    goto free;
+  }
+
+  ret = EXIT_SUCCESS;
+
+  free:
+
+  if (plain)
+    libsoc_i2c_free(plain);
+
+  if (regs)
+    libsoc_i2c_free(regs);
+
+  if (again)
+    libsoc_i2c_free(again);
+
+  libsoc_i2c_sim_disable();
+
+  return ret;
+}
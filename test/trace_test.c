@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "libsoc_gpio.h"
+#include "libsoc_i2c.h"
+#include "libsoc_i2c_sim.h"
+#include "libsoc_trace.h"
+
+/**
+ *
+ * This trace_test records gpio level changes from several threads and i2c
+ * transfers through the i2c simulator, checking the records of each ring,
+ * ring wraparound, dumping and streaming to a trace file, then times the
+ * gpio toggle path with tracing off and on to show the cost of a record.
+ * The gpios are backed by /dev/null so it needs no hardware and is run by
+ * "make check".
+ *
+ */
+
+#define RING_RECORDS 64
+#define THREADS 4
+#define THREAD_LOOPS 100
+#define STREAM_BURSTS 10
+#define STREAM_BURST 32
+
+#define I2C_BUS 1
+#define REGS_ADDRESS 0x20
+
+#define BENCH_LOOPS 2000000
+
+static char trace_path[] = "/tmp/libsoc_traceXXXXXX";
+static pthread_barrier_t barrier;
+
+static double
+now ()
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *toggle(void *arg)
+{
+  gpio *gpio = arg;
+  int i;
+
+  for (i = 0; i < THREAD_LOOPS; i++)
+    libsoc_gpio_set_level(gpio, i & 1);
+
+  // Exited threads hand their rings on, keep them all until every one is done
+  pthread_barrier_wait(&barrier);
+
+  return NULL;
+}
+
+// Number of records of an op on a device, checking they are in time order
+static int count(trace_record *records, int num, int op, uint32_t device)
+{
+  int i, n = 0;
+
+  for (i = 0; i < num; i++) {
+    if (i > 0 && records[i].timestamp < records[i - 1].timestamp)
+      return -1;
+
+    if (records[i].op == op && records[i].device == device)
+      n++;
+  }
+
+  return n;
+}
+
+// Number of records in a trace file, -1 if it is not valid
+static int file_records(const char *path)
+{
+  trace_file_header header;
+  trace_record rec;
+  FILE *file;
+  int n = 0;
+
+  file = fopen(path, "r");
+
+  if (file == NULL)
+    return -1;
+
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      memcmp(header.magic, LIBSOC_TRACE_MAGIC, sizeof(LIBSOC_TRACE_MAGIC)) ||
+      header.record_size != sizeof(trace_record)) {
+    fclose(file);
+    return -1;
+  }
+
+  while (fread(&rec, sizeof(rec), 1, file) == 1)
+    n++;
+
+  fclose(file);
+
+  return n;
+}
+
+static double bench(gpio *gpio)
+{
+  double start;
+  int i;
+
+  start = now();
+
+  for (i = 0; i < BENCH_LOOPS; i++)
+    libsoc_gpio_set_level(gpio, i & 1);
+
+  return (now() - start) / BENCH_LOOPS * 1e9;
+}
+
+int main()
+{
+  trace_record records[THREADS * RING_RECORDS * 2];
+  gpio gpios[THREADS];
+  pthread_t threads[THREADS];
+  i2c *regs = NULL;
+  int i, num, fd, ret = EXIT_FAILURE;
+  double off, on;
+
+  i2c_sim_device regs_desc = {
+    .type = I2C_SIM_REGISTERS,
+    .size = 256,
+    .addr_len = 1,
+  };
+
+  memset(gpios, 0, sizeof(gpios));
+
+  for (i = 0; i < THREADS; i++) {
+    gpios[i].gpio = i + 1;
+    gpios[i].value_fd = open("/dev/null", O_WRONLY);
+
+    if (gpios[i].value_fd < 0)
+      return EXIT_FAILURE;
+  }
+
+  fd = mkstemp(trace_path);
+
+  if (fd < 0)
+    return EXIT_FAILURE;
+
+  close(fd);
+
+  if (libsoc_trace_enable(RING_RECORDS) == EXIT_FAILURE) {
+    printf("Failed to enable tracing\n");
+    return EXIT_FAILURE;
+  }
+
+  // Each thread records into its own ring, which keeps its newest records
+  pthread_barrier_init(&barrier, NULL, THREADS);
+
+  for (i = 0; i < THREADS; i++)
+    pthread_create(&threads[i], NULL, toggle, &gpios[i]);
+
+  for (i = 0; i < THREADS; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_barrier_destroy(&barrier);
+
+  num = libsoc_trace_snapshot(records, sizeof(records) / sizeof(records[0]));
+
+  for (i = 0; i < THREADS; i++) {
+    if (count(records, num, LS_TRACE_GPIO_SET_LEVEL, i + 1) != RING_RECORDS) {
+      printf("Thread rings : Incorrect\n");
+      goto free;
+    }
+  }
+
+  if (records[num - 1].length != (THREAD_LOOPS - 1) % 2 ||
+      records[num - 1].result != 1) {
+    printf("Thread rings : Incorrect\n");
+    goto free;
+  }
+
+  printf("Thread rings : Correct\n");
+
+  // I2C transfers, including a failure and the errno it set
+  libsoc_i2c_sim_enable();
+
+  if (libsoc_i2c_sim_add(I2C_BUS, REGS_ADDRESS, &regs_desc) == EXIT_FAILURE ||
+      (regs = libsoc_i2c_init(I2C_BUS, REGS_ADDRESS)) == NULL) {
+    printf("Failed to get simulated I2C device\n");
+    goto free;
+  }
+
+  uint8_t reg_write[3] = { 0x10, 0xab, 0xcd };
+  uint8_t reg_read[2];
+
+  libsoc_i2c_write(regs, reg_write, 3);
+  libsoc_i2c_write(regs, reg_write, 1);
+  libsoc_i2c_read(regs, reg_read, 2);
+  libsoc_i2c_sim_fail(I2C_BUS, REGS_ADDRESS, 1);
+  libsoc_i2c_read(regs, reg_read, 2);
+
+  num = libsoc_trace_snapshot(records, 4);
+
+  if (num != 4 ||
+      records[0].op != LS_TRACE_I2C_WRITE || records[0].length != 3 ||
+      records[0].device != LIBSOC_TRACE_I2C_ID(I2C_BUS, REGS_ADDRESS) ||
+      records[2].op != LS_TRACE_I2C_READ || records[2].length != 2 ||
+      records[2].result != 1 || records[2].error != 0 ||
+      records[3].result != -1 || records[3].error != EREMOTEIO) {
+    printf("I2C records : Incorrect\n");
+    goto free;
+  }
+
+  printf("I2C records : Correct\n");
+
+  // Dump every ring to a file
+  num = libsoc_trace_snapshot(records, sizeof(records) / sizeof(records[0]));
+
+  if (libsoc_trace_dump(trace_path) == EXIT_FAILURE ||
+      file_records(trace_path) != num) {
+    printf("Trace dump : Incorrect\n");
+    goto free;
+  }
+
+  printf("Trace dump : Correct, %d records\n", num);
+
+  // Stream while toggling in bursts, every record is written or lost
+  if (libsoc_trace_stream_start(trace_path, 5) == EXIT_FAILURE) {
+    printf("Failed to start the trace stream\n");
+    goto free;
+  }
+
+  for (i = 0; i < STREAM_BURSTS * STREAM_BURST; i++) {
+    libsoc_gpio_set_level(&gpios[0], i & 1);
+
+    if (i % STREAM_BURST == STREAM_BURST - 1)
+      usleep(20000);
+  }
+
+  if (libsoc_trace_stream_stop() == EXIT_FAILURE ||
+      file_records(trace_path) + libsoc_trace_lost() !=
+      STREAM_BURSTS * STREAM_BURST) {
+    printf("Trace stream : Incorrect\n");
+    goto free;
+  }
+
+  printf("Trace stream : Correct, %lu records lost\n", libsoc_trace_lost());
+
+  // Benchmark the cost of a record on the toggle path
+  libsoc_trace_disable();
+  off = bench(&gpios[0]);
+  libsoc_trace_enable(RING_RECORDS);
+  on = bench(&gpios[0]);
+  libsoc_trace_disable();
+
+  printf("Toggle benchmark : %.0fns tracing off, %.0fns tracing on\n",
+    off, on);
+
+  ret = EXIT_SUCCESS;
+
+  free:
+
+  if (regs)
+    libsoc_i2c_free(regs);
+
+  libsoc_i2c_sim_disable();
+
+  for (i = 0; i < THREADS; i++)
+    close(gpios[i].value_fd);
+
+  unlink(trace_path);
+
+  return ret;
+}
@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libsoc_trace.h"
+
+/*
+ * Decode a trace file written by libsoc_trace_dump or
+ * libsoc_trace_stream_start, printing the records in time order or a
+ * summary of each operation.
+ */
+
+static void
+usage (const char *name)
+{
+  fprintf (stderr, "usage: %s [-s] FILE\n"
+	   "  -s  print a summary of each operation instead of the records\n",
+	   name);
+}
+
+static int
+record_cmp (const void *a, const void *b)
+{
+  const trace_record *ra = a, *rb = b;
+
+  if (ra->timestamp != rb->timestamp)
+    return ra->timestamp < rb->timestamp ? -1 : 1;
+
+  return 0;
+}
+
+static void
+format_device (char *buf, size_t len, const trace_record * rec)
+{
+  switch (rec->op)
+    {
+    case LS_TRACE_GPIO_SET_LEVEL:
+    case LS_TRACE_GPIO_GET_LEVEL:
+    case LS_TRACE_GPIO_POLL:
+      snprintf (buf, len, "gpio%u", rec->device);
+      break;
+
+    case LS_TRACE_SPI_WRITE:
+    case LS_TRACE_SPI_READ:
+    case LS_TRACE_SPI_RW:
+      snprintf (buf, len, "spidev%u.%u", rec->device >> 8,
+		rec->device & 0xff);
+      break;
+
+    case LS_TRACE_I2C_WRITE:
+    case LS_TRACE_I2C_READ:
+      snprintf (buf, len, "i2c-%u@0x%02x", rec->device >> 8,
+		rec->device & 0xff);
+      break;
+
+    case LS_TRACE_PWM_SET_ENABLED:
+    case LS_TRACE_PWM_SET_PERIOD:
+    case LS_TRACE_PWM_SET_DUTY:
+      snprintf (buf, len, "pwmchip%u/pwm%u", rec->device >> 16,
+		rec->device & 0xffff);
+      break;
+
+    default:
+      snprintf (buf, len, "%u", rec->device);
+      break;
+    }
+}
+
+static void
+print_records (trace_record * records, size_t num)
+{
+  char device[32];
+  size_t i;
+
+  printf ("%14s %7s %-16s %-16s %10s %7s %10s\n", "time(us)", "tid", "op",
+	  "device", "length", "result", "ns");
+
+  for (i = 0; i < num; i++)
+    {
+      format_device (device, sizeof (device), &records[i]);
+
+      printf ("%14.3f %7u %-16s %-16s %10u %7d %10u",
+	      (records[i].timestamp - records[0].timestamp) / 1e3,
+	      records[i].tid, libsoc_trace_op_name (records[i].op), device,
+	      records[i].length, records[i].result, records[i].duration);
+
+      if (records[i].error)
+	printf (" %s", strerror (records[i].error));
+
+      printf ("\n");
+    }
+}
+
+static void
+print_summary (trace_record * records, size_t num)
+{
+  unsigned long count[LS_TRACE_NUM_OPS] = { 0 };
+  unsigned long errors[LS_TRACE_NUM_OPS] = { 0 };
+  uint64_t bytes[LS_TRACE_NUM_OPS] = { 0 };
+  uint64_t total[LS_TRACE_NUM_OPS] = { 0 };
+  uint32_t max[LS_TRACE_NUM_OPS] = { 0 };
+  size_t i;
+  int op;
+
+  for (i = 0; i < num; i++)
+    {
+      op = records[i].op < LS_TRACE_NUM_OPS ? records[i].op : LS_TRACE_NONE;
+
+      count[op]++;
+      errors[op] += records[i].error != 0;
+      bytes[op] += records[i].length;
+      total[op] += records[i].duration;
+
+      if (records[i].duration > max[op])
+	max[op] = records[i].duration;
+    }
+
+  printf ("%-16s %10s %8s %12s %10s %10s\n", "op", "count", "errors",
+	  "length", "mean ns", "max ns");
+
+  for (op = 0; op < LS_TRACE_NUM_OPS; op++)
+    {
+      if (count[op] == 0)
+	continue;
+
+      printf ("%-16s %10lu %8lu %12llu %10llu %10u\n",
+	      libsoc_trace_op_name (op), count[op], errors[op],
+	      (unsigned long long) bytes[op],
+	      (unsigned long long) (total[op] / count[op]), max[op]);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  trace_file_header header;
+  trace_record *records = NULL, *tmp;
+  size_t num = 0, size = 0;
+  int opt, summary = 0;
+  FILE *file;
+
+  while ((opt = getopt (argc, argv, "sh")) != -1)
+    {
+      switch (opt)
+	{
+	case 's':
+	  summary = 1;
+	  break;
+
+	default:
+	  usage (argv[0]);
+	  return EXIT_FAILURE;
+	}
+    }
+
+  if (optind != argc - 1)
+    {
+      usage (argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  file = fopen (argv[optind], "r");
+
+  if (file == NULL)
+    {
+      perror (argv[optind]);
+      return EXIT_FAILURE;
+    }
+
+  if (fread (&header, sizeof (header), 1, file) != 1 ||
+      memcmp (header.magic, LIBSOC_TRACE_MAGIC,
+	      sizeof (LIBSOC_TRACE_MAGIC)) != 0)
+    {
+      fprintf (stderr, "%s: not a libsoc trace file\n", argv[optind]);
+      fclose (file);
+      return EXIT_FAILURE;
+    }
+
+  if (header.version != LIBSOC_TRACE_VERSION ||
+      header.record_size != sizeof (trace_record))
+    {
+      fprintf (stderr, "%s: unsupported trace version %u\n", argv[optind],
+	       header.version);
+      fclose (file);
+      return EXIT_FAILURE;
+    }
+
+  while (1)
+    {
+      if (num == size)
+	{
+	  size = size ? size * 2 : 4096;
+	  tmp = realloc (records, size * sizeof (trace_record));
+
+	  if (tmp == NULL)
+	    {
+	      fprintf (stderr, "out of memory\n");
+	      free (records);
+	      fclose (file);
+	      return EXIT_FAILURE;
+	    }
+
+	  records = tmp;
+	}
+
+      if (fread (&records[num], sizeof (trace_record), 1, file) != 1)
+	break;
+
+      num++;
+    }
+
+  fclose (file);
+
+  // Streamed records are written a ring at a time
+  qsort (records, num, sizeof (trace_record), record_cmp);
+
+  if (summary)
+    print_summary (records, num);
+  else
+    print_records (records, num);
+
+  free (records);
+
+  return EXIT_SUCCESS;
+}